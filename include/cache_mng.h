@@ -35,6 +35,15 @@ typedef void (*cache_mng_on_store_file_buf_cb) (gboolean success, void *ctx);
 void cache_mng_store_file_buf (CacheMng *cmng, fuse_ino_t ino, size_t size, off_t off, unsigned char *buf,
         cache_mng_on_store_file_buf_cb on_store_file_buf_cb, void *ctx);
 
+// keep cache file opened for writing until cache_mng_release_file () is called,
+// every cache_mng_hold_file () call must be paired with cache_mng_release_file ()
+void cache_mng_hold_file (CacheMng *cmng, fuse_ino_t ino);
+void cache_mng_release_file (CacheMng *cmng, fuse_ino_t ino);
+
+// hard link the cache file to "link_path", the link keeps all data written to the file while it's held,
+// even if the file is removed from the cache
+gboolean cache_mng_link_file (CacheMng *cmng, fuse_ino_t ino, const gchar *link_path);
+
 // removes file from local storage
 void cache_mng_remove_file (CacheMng *cmng, fuse_ino_t ino);
 
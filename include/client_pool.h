@@ -20,6 +20,14 @@
 
 #include "global.h"
 
+// awaiting requests are kept in separate lanes, selected by the size of request:
+// small requests (saving small files, metadata operations) are not queued behind large multipart uploads
+typedef enum {
+    CLIENT_POOL_LANE_INTERACTIVE = 0,
+    CLIENT_POOL_LANE_BULK = 1,
+    CLIENT_POOL_LANES = 2,
+} ClientPoolLane;
+
 typedef gpointer (*ClientPool_client_create) (Application *app);
 typedef void (*ClientPool_client_destroy) (gpointer client);
 typedef void (*ClientPool_on_released_cb) (gpointer client, gpointer ctx);
@@ -44,7 +52,11 @@ void client_pool_destroy (ClientPool *pool);
 // return TRUE if added, FALSE if list is full
 typedef void (*ClientPool_on_client_ready) (gpointer client, gpointer ctx);
 gboolean client_pool_get_client (ClientPool *pool, ClientPool_on_client_ready on_client_ready, gpointer ctx);
+// same as client_pool_get_client (), "size" is the amount of data the request is going to transfer
+gboolean client_pool_get_client_sized (ClientPool *pool, guint64 size, ClientPool_on_client_ready on_client_ready, gpointer ctx);
 gint client_pool_get_client_count (ClientPool *pool);
+// number of awaiting requests in the lane
+guint client_pool_get_queue_depth (ClientPool *pool, ClientPoolLane lane);
 
 typedef void (*ClientPool_on_request_done) (gpointer callback_data, gboolean success);
 void client_pool_add_request (ClientPool *pool,
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2012-2014 Paul Ionkin <paul.ionkin@gmail.com>
+ * Copyright (C) 2012-2014 Skoobe GmbH. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef _DIR_BUF_H_
+#define _DIR_BUF_H_
+
+#include "global.h"
+
+// FUSE directory buffer, which is maintained incrementally:
+// new entries are appended, removed entries are marked as deleted
+// and dropped the next time the buffer content is requested.
+
+typedef struct _DirBuf DirBuf;
+typedef struct _DirBufSnapshot DirBufSnapshot;
+
+// "size_hint" is the sum of dir_buf_entry_size () of all entries, "." and ".." are added automatically
+DirBuf *dir_buf_create (fuse_ino_t ino, size_t size_hint);
+void dir_buf_destroy (DirBuf *dbuf);
+
+// size of entry in the buffer
+size_t dir_buf_entry_size (const gchar *name);
+
+// append entry, replaces already existing entry with the same inode
+void dir_buf_add (DirBuf *dbuf, const gchar *name, fuse_ino_t ino, mode_t mode);
+// mark entry as removed, return FALSE if entry is not found
+gboolean dir_buf_remove (DirBuf *dbuf, fuse_ino_t ino);
+gboolean dir_buf_contains (DirBuf *dbuf, fuse_ino_t ino);
+
+// synchronize buffer with the directory content:
+// call dir_buf_mark () for every existing entry, then dir_buf_sweep () removes all unmarked entries
+void dir_buf_mark_begin (DirBuf *dbuf);
+// return FALSE if entry is not in the buffer or was changed, such entry has to be added
+gboolean dir_buf_mark (DirBuf *dbuf, const gchar *name, fuse_ino_t ino, mode_t mode);
+// return the number of removed entries
+guint dir_buf_sweep (DirBuf *dbuf);
+
+// number of entries, excluding "." and ".."
+guint dir_buf_get_count (DirBuf *dbuf);
+
+// return buffer to send to FUSE, removed entries are dropped
+const gchar *dir_buf_get_data (DirBuf *dbuf, size_t *size);
+
+// walk buffer returned by dir_buf_get_data () or dir_buf_snapshot_get_data (), starting at offset "off"
+// "next_off" is the offset of the next entry, callback returns FALSE to stop
+typedef gboolean (*DirBuf_entry_cb) (const gchar *name, fuse_ino_t ino, mode_t mode, off_t next_off, gpointer ctx);
+void dir_buf_data_foreach (const gchar *buf, size_t size, off_t off, DirBuf_entry_cb entry_cb, gpointer ctx);
+
+// immutable copy of the buffer content, shared by all directory handles until the buffer is changed
+DirBufSnapshot *dir_buf_get_snapshot (DirBuf *dbuf);
+DirBufSnapshot *dir_buf_snapshot_ref (DirBufSnapshot *snapshot);
+void dir_buf_snapshot_unref (DirBufSnapshot *snapshot);
+const gchar *dir_buf_snapshot_get_data (DirBufSnapshot *snapshot, size_t *size);
+
+#endif
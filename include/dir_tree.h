@@ -30,13 +30,15 @@ typedef struct _DirEntry DirEntry;
 DirTree *dir_tree_create (Application *app);
 void dir_tree_destroy (DirTree *dtree);
 
+// "etag" is the quoted ETag from the listing, NULL if unknown
 DirEntry *dir_tree_update_entry (DirTree *dtree, const gchar *path, DirEntryType type,
-    fuse_ino_t parent_ino, const gchar *entry_name, long long size, time_t last_modified);
+    fuse_ino_t parent_ino, const gchar *entry_name, long long size, time_t last_modified, const gchar *etag);
 
 // mark that DirTree is being updated
 
 void dir_tree_start_update (DirEntry *en, G_GNUC_UNUSED const gchar *dir_path);
-void dir_tree_stop_update (DirTree *dtree, fuse_ino_t parent_ino);
+// "success" is FALSE if the listing is incomplete
+void dir_tree_stop_update (DirTree *dtree, fuse_ino_t parent_ino, gboolean success);
 
 gboolean dir_tree_opendir (DirTree *dtree, fuse_ino_t ino, struct fuse_file_info *fi);
 gboolean dir_tree_releasedir (DirTree *dtree, fuse_ino_t ino, struct fuse_file_info *fi);
@@ -57,6 +59,8 @@ void dir_tree_lookup (DirTree *dtree, fuse_ino_t parent_ino, const char *name,
 typedef void (*dir_tree_getattr_cb) (fuse_req_t req, gboolean success, fuse_ino_t ino, int mode, off_t file_size, time_t ctime);
 void dir_tree_getattr (DirTree *dtree, fuse_ino_t ino,
     dir_tree_getattr_cb getattr_cb, fuse_req_t req);
+// return FALSE if entry is not in DirTree
+gboolean dir_tree_get_cached_attr (DirTree *dtree, fuse_ino_t ino, int *mode, off_t *file_size, time_t *ctime);
 
 typedef void (*dir_tree_setattr_cb) (fuse_req_t req, gboolean success, fuse_ino_t ino, int mode, off_t file_size);
 void dir_tree_setattr (DirTree *dtree, fuse_ino_t ino,
@@ -106,10 +110,35 @@ void dir_tree_getxattr (DirTree *dtree, fuse_ino_t ino,
     dir_tree_getxattr_cb getxattr_cb, fuse_req_t req);
 
 void dir_tree_get_stats (DirTree *dtree, guint32 *total_inodes, guint32 *file_num, guint32 *dir_num);
+// number of cached missing names and lookups answered from that cache
+void dir_tree_get_negative_cache_stats (DirTree *dtree, guint32 *entries, guint64 *hits);
+// inodes limit (0 if not set) and the number of evicted entries
+void dir_tree_get_eviction_stats (DirTree *dtree, guint32 *max_inodes, guint64 *evicted);
+// stale window and the number of requests answered from the expired cache
+void dir_tree_get_stale_stats (DirTree *dtree, guint32 *stale_time, guint64 *stale_hits);
+
+// kernel lookup count, entry is not evicted while it's referenced by the kernel
+// call dir_tree_lookup_ref () for every successful fuse_reply_entry () / fuse_reply_create ()
+void dir_tree_lookup_ref (DirTree *dtree, fuse_ino_t ino);
+void dir_tree_forget (DirTree *dtree, fuse_ino_t ino, guint64 nlookup);
+
+// kernel entry and attribute cache timeout (seconds), it's longer for entries of directories which don't change
+gdouble dir_tree_get_timeout (DirTree *dtree, fuse_ino_t ino);
 
 guint dir_tree_get_inode_count (DirTree *dtree);
 
+// call "subdir_cb" for every subdirectory of directory "ino" which is already in DirTree
+typedef void (*DirTree_subdir_cb) (fuse_ino_t ino, const gchar *fullpath, gpointer ctx);
+void dir_tree_foreach_subdir (DirTree *dtree, fuse_ino_t ino, DirTree_subdir_cb subdir_cb, gpointer ctx);
+
+// write DirTree to the snapshot file, which is loaded by dir_tree_create () on the next start
+gboolean dir_tree_snapshot_save (DirTree *dtree);
+
 void dir_tree_set_entry_exist (DirTree *dtree, fuse_ino_t ino);
+void dir_tree_set_entry_etag (DirTree *dtree, fuse_ino_t ino, const gchar *etag, const gchar *version_id,
+    const gchar *content_type);
+// update ETag, version-id and Content-Type from GET / HEAD response headers
+void dir_tree_set_entry_xattrs (DirTree *dtree, fuse_ino_t ino, struct evkeyvalq *headers);
 
 
 typedef void (*DirTree_symlink_cb) (fuse_req_t req, gboolean success, fuse_ino_t ino, int mode, off_t file_size, time_t ctime);
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2012-2014 Paul Ionkin <paul.ionkin@gmail.com>
+ * Copyright (C) 2012-2014 Skoobe GmbH. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef _DIR_WARMUP_H_
+#define _DIR_WARMUP_H_
+
+#include "global.h"
+
+// Background crawler, which lists directories breadth-first after mount
+// (the whole bucket or "warmup.prefixes") and fills DirTree before users access it.
+// Directories are listed one by one, only when there are no other requests waiting for the operations pool.
+
+typedef struct _DirWarmup DirWarmup;
+
+DirWarmup *dir_warmup_create (Application *app);
+void dir_warmup_destroy (DirWarmup *warmup);
+
+// does nothing if "warmup.enabled" is not set
+void dir_warmup_start (DirWarmup *warmup);
+
+#endif
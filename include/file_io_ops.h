@@ -25,8 +25,15 @@ typedef struct _FileIO FileIO;
 FileIO *fileio_create (Application *app, const gchar *fname, fuse_ino_t ino, gboolean assume_new);
 void fileio_destroy (FileIO *fop);
 
+// ETag of the object on the server when the file was opened, NULL if it doesn't exist
+void fileio_set_base_etag (FileIO *fop, const gchar *etag);
+void fileio_set_keep_content (FileIO *fop, gboolean keep_content);
+
 void fileio_release (FileIO *fop);
 
+// returns TRUE if the existing object is modified in place, size is set to the resulting file size
+gboolean fileio_get_patched_size (FileIO *fop, guint64 *size);
+
 typedef void (*FileIO_on_buffer_written_cb) (FileIO *fop, gpointer ctx, gboolean success, size_t count);
 void fileio_write_buffer (FileIO *fop,
     const char *buf, size_t buf_size, off_t off, fuse_ino_t ino,
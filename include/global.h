@@ -66,9 +66,7 @@
 #include <math.h>
 #include <ftw.h>
 //#include <sys/xattr.h>
-#if defined(__APPLE__)
-    #include <pthread.h>
-#endif
+#include <pthread.h>
 
 #include <glib.h>
 #include <glib/gprintf.h>
@@ -105,7 +103,8 @@
 #include <libxml/tree.h>
 
 //#define FUSE_USE_VERSION 26
-#if defined(__APPLE__)
+// libfuse 3 headers are installed into "fuse3" directory, which is in FUSE_CFLAGS
+#if defined(__APPLE__) || FUSE_USE_VERSION >= 30
     #include <fuse_lowlevel.h>
 #else
     #include <fuse/fuse_lowlevel.h>
@@ -119,6 +118,7 @@ typedef struct _ClientPool ClientPool;
 typedef struct _ConfData ConfData;
 typedef struct _CacheMng CacheMng;
 typedef struct _StatSrv StatSrv;
+typedef struct _UploadJournal UploadJournal;
 
 struct event_base *application_get_evbase (Application *app);
 struct evdns_base *application_get_dnsbase (Application *app);
@@ -130,6 +130,7 @@ ClientPool *application_get_ops_client_pool (Application *app);
 DirTree *application_get_dir_tree (Application *app);
 CacheMng *application_get_cache_mng (Application *app);
 StatSrv *application_get_stat_srv (Application *app);
+UploadJournal *application_get_upload_journal (Application *app);
 RFuse *application_get_rfuse (Application *app);
 
 #ifdef SSL_ENABLED
@@ -71,7 +71,10 @@ gboolean http_connection_connect (HttpConnection *con);
 void http_connection_send (HttpConnection *con, struct evbuffer *outbuf);
 
 typedef void (*HttpConnection_directory_listing_callback) (gpointer callback_data, gboolean success);
+// a page of directory listing is parsed, more pages are requested
+typedef void (*HttpConnection_directory_listing_page_callback) (gpointer callback_data);
 void http_connection_get_directory_listing (HttpConnection *con, const gchar *path, fuse_ino_t ino,
+    HttpConnection_directory_listing_page_callback directory_listing_page_callback,
     HttpConnection_directory_listing_callback directory_listing_callback, gpointer callback_data);
 
 typedef void (*BucketClient_on_cb) (gpointer ctx, gboolean success, const gchar *buf, size_t buf_len);
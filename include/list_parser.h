@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2012-2014 Paul Ionkin <paul.ionkin@gmail.com>
+ * Copyright (C) 2012-2014 Skoobe GmbH. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef _LIST_PARSER_H_
+#define _LIST_PARSER_H_
+
+#include "global.h"
+
+// Single pass parser of ListBucketResult (ListObjects and ListObjectsV2 responses).
+// Entries are passed to the callback as soon as they are parsed, no document tree is built.
+// Parser doesn't depend on the application state and can be called from any thread.
+
+typedef struct {
+    gboolean is_truncated;
+    gchar *next_marker; // NextMarker, NULL if not set
+    gchar *next_continuation_token; // NextContinuationToken, NULL if not set
+} ListParserResult;
+
+// "is_prefix" is TRUE for CommonPrefixes, "size", "last_modified" and "etag" are not set for them
+// "etag" is quoted, as it's returned by the server, NULL if not set
+typedef void (*ListParser_on_entry) (gpointer ctx, const gchar *key, gboolean is_prefix, gint64 size, time_t last_modified,
+    const gchar *etag);
+
+// return FALSE if the buffer is not a valid ListBucketResult
+gboolean list_parser_parse (const gchar *xml, size_t xml_len,
+    ListParser_on_entry on_entry, gpointer ctx, ListParserResult *result);
+
+// free strings of the result
+void list_parser_result_clear (ListParserResult *result);
+
+#endif
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2012-2014 Paul Ionkin <paul.ionkin@gmail.com>
+ * Copyright (C) 2012-2014 Skoobe GmbH. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef _NAME_POOL_H_
+#define _NAME_POOL_H_
+
+#include "global.h"
+
+// Pool of interned, reference counted strings.
+// Equal strings share a single copy, e.g. file names which are repeated in many directories.
+// A string is released when its last reference is dropped, name_pool_unref () doesn't need the pool pointer.
+
+typedef struct _NamePool NamePool;
+
+NamePool *name_pool_create ();
+// all strings must be unreferenced before
+void name_pool_destroy (NamePool *pool);
+
+// return interned copy of "name", must be released with name_pool_unref ()
+const gchar *name_pool_ref (NamePool *pool, const gchar *name);
+// "name" must be returned by name_pool_ref ()
+void name_pool_unref (const gchar *name);
+
+// number of unique strings and the number of bytes they take
+void name_pool_get_stats (NamePool *pool, guint *count, guint64 *bytes);
+
+#endif
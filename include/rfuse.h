@@ -34,6 +34,11 @@ void rfuse_unmount (RFuse *rfuse);
 
 void rfuse_add_dirbuf (fuse_req_t req, struct dirbuf *b, const char *name, fuse_ino_t ino, off_t file_size);
 
+// ask the kernel to drop cached attributes and data of the inode / the name in directory "parent_ino",
+// requests are queued and sent asynchronously, can be called from any request handler
+void rfuse_notify_inval_inode (RFuse *rfuse, fuse_ino_t ino);
+void rfuse_notify_inval_entry (RFuse *rfuse, fuse_ino_t parent_ino, const gchar *name);
+
 void rfuse_get_stats (RFuse *rfuse, guint64 *read_ops, guint64 *write_ops, guint64 *readdir_ops, guint64 *lookup_ops);
 
 #endif
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2012-2014 Paul Ionkin <paul.ionkin@gmail.com>
+ * Copyright (C) 2012-2014 Skoobe GmbH. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include "global.h"
+
+// Allocator of fixed size objects.
+// Objects are carved from large aligned blocks, so they don't carry per-allocation malloc overhead,
+// and a block is found from the object address: slab_free () doesn't need the Slab pointer.
+// Block is released when all its objects are freed.
+
+typedef struct _Slab Slab;
+
+Slab *slab_create (size_t obj_size);
+// all objects must be freed before, blocks which are still full are not released
+void slab_destroy (Slab *slab);
+
+// return zero-filled object
+gpointer slab_alloc0 (Slab *slab);
+void slab_free (gpointer obj);
+
+// number of allocated objects and the number of bytes taken by blocks
+void slab_get_stats (Slab *slab, guint64 *objects, guint64 *bytes);
+
+#endif
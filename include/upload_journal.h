@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2012-2014 Paul Ionkin <paul.ionkin@gmail.com>
+ * Copyright (C) 2012-2014 Skoobe GmbH. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#ifndef _UPLOAD_JOURNAL_H_
+#define _UPLOAD_JOURNAL_H_
+
+#include "global.h"
+
+// On-disk journal of multipart uploads.
+// Every multipart upload gets a journal file (uploadid, sent and completed parts)
+// and a hard link to the CacheMng file with the uploaded content, both kept in "filesystem.cache_dir".
+// After restart unfinished uploads are either resumed and completed, or aborted.
+
+typedef struct _UploadJournalEntry UploadJournalEntry;
+
+UploadJournal *upload_journal_create (Application *app);
+void upload_journal_destroy (UploadJournal *journal);
+
+// scan journal directory, resume released uploads and abort orphaned ones,
+// uploads of objects which were changed by someone else are aborted too
+void upload_journal_recover (UploadJournal *journal);
+
+// returns NULL if journal is disabled or failed to create journal files
+// cache file of "ino" must be held by CacheMng till the file is released
+// "base_etag" is the ETag of the object when the file was opened, NULL if the object is new:
+// the upload is resumed only if the object wasn't changed since then
+UploadJournalEntry *upload_journal_entry_create (UploadJournal *journal, const gchar *fname, const gchar *uploadid,
+    fuse_ino_t ino, const gchar *base_etag);
+
+// part is being sent
+void upload_journal_entry_add_part (UploadJournalEntry *jentry, guint part_number, off_t off, size_t size, const gchar *md5str);
+// part is stored on the server
+void upload_journal_entry_part_done (UploadJournalEntry *jentry, guint part_number, const gchar *etag);
+// file is released by the user, all data is stored in the cache file
+// returns FALSE if the cache file doesn't contain all data, the upload can't be resumed then
+gboolean upload_journal_entry_set_size (UploadJournalEntry *jentry, guint64 size);
+
+// upload is completed, remove journal files
+void upload_journal_entry_remove (UploadJournalEntry *jentry);
+// upload is interrupted, keep journal files for the next start
+void upload_journal_entry_close (UploadJournalEntry *jentry);
+
+#endif
@@ -42,6 +42,8 @@ struct _CacheEntry {
     time_t modification_time;
     GList *ll_lru;
     gchar *etag;
+    int fd; // opened cache file, -1 if not held by a writer
+    guint holders; // number of writers, see cache_mng_hold_file ()
 };
 
 struct _CacheContext {
@@ -118,6 +120,8 @@ static struct _CacheEntry* cache_entry_create (fuse_ino_t ino)
     entry->ll_lru = NULL;
     entry->modification_time = time (NULL);
     entry->etag = NULL;
+    entry->fd = -1;
+    entry->holders = 0;
 
     return entry;
 }
@@ -127,6 +131,8 @@ static void cache_entry_destroy (gpointer data)
     struct _CacheEntry * entry = (struct _CacheEntry*) data;
 
     range_destroy(entry->avail_range);
+    if (entry->fd >= 0)
+        close (entry->fd);
     if (entry->etag)
         g_free (entry->etag);
     g_free(entry);
@@ -177,6 +183,21 @@ guint64 cache_mng_get_file_length (CacheMng *cmng, fuse_ino_t ino)
     return range_length (entry->avail_range);
 }
 
+static struct _CacheEntry *cache_mng_get_entry (CacheMng *cmng, fuse_ino_t ino)
+{
+    struct _CacheEntry *entry;
+
+    entry = g_hash_table_lookup (cmng->h_entries, GUINT_TO_POINTER (ino));
+    if (!entry) {
+        entry = cache_entry_create (ino);
+        g_queue_push_head (cmng->q_lru, entry);
+        entry->ll_lru = g_queue_peek_head_link (cmng->q_lru);
+        g_hash_table_insert (cmng->h_entries, GUINT_TO_POINTER (ino), entry);
+    }
+
+    return entry;
+}
+
 static void cache_mng_rm_cache_dir (CacheMng *cmng)
 {
     if (cmng->cache_dir)
@@ -254,8 +275,13 @@ void cache_mng_retrieve_file_buf (CacheMng *cmng, fuse_ino_t ino, size_t size, o
             return;
         }
 
-        cache_mng_file_name (cmng, path, sizeof (path), ino);
-        fd = open (path, O_RDONLY);
+        // file is being written, use already opened descriptor
+        if (entry->fd >= 0) {
+            fd = entry->fd;
+        } else {
+            cache_mng_file_name (cmng, path, sizeof (path), ino);
+            fd = open (path, O_RDONLY);
+        }
         if (fd < 0) {
             LOG_err (CMNG_LOG, INO_H"Failed to open file for reading! Path: %s", INO_T (ino), path);
             if (context->cb.retrieve_cb)
@@ -267,7 +293,8 @@ void cache_mng_retrieve_file_buf (CacheMng *cmng, fuse_ino_t ino, size_t size, o
 
         context->buf = g_malloc (size);
         res = pread (fd, context->buf, size, off);
-        close (fd);
+        if (fd != entry->fd)
+            close (fd);
         context->success = (res == (ssize_t) size);
 
         LOG_debug (CMNG_LOG, INO_H"Read [%"OFF_FMT":%zu] bytes, result: %s",
@@ -329,11 +356,17 @@ void cache_mng_store_file_buf (CacheMng *cmng, fuse_ino_t ino, size_t size, off_
     // limit the number of cache checks
     now = time (NULL);
     if (cmng->check_time < now && now - cmng->check_time >= 10) {
-        // remove data until we have at least size bytes of max_size left
-        while (cmng->max_size < cmng->size + size && g_queue_peek_tail (cmng->q_lru)) {
-            entry = (struct _CacheEntry *) g_queue_peek_tail (cmng->q_lru);
+        GList *l = g_queue_peek_tail_link (cmng->q_lru);
 
-            cache_mng_remove_file (cmng, entry->ino);
+        // remove data until we have at least size bytes of max_size left
+        while (cmng->max_size < cmng->size + size && l) {
+            GList *prev = g_list_previous (l);
+
+            entry = (struct _CacheEntry *) l->data;
+            // files which are being written are kept
+            if (!entry->holders)
+                cache_mng_remove_file (cmng, entry->ino);
+            l = prev;
         }
         cmng->check_time = now;
     }
@@ -341,8 +374,15 @@ void cache_mng_store_file_buf (CacheMng *cmng, fuse_ino_t ino, size_t size, off_
     context = cache_context_create (size, ctx);
     context->cb.store_cb = on_store_file_buf_cb;
 
-    cache_mng_file_name (cmng, path, sizeof (path), ino);
-    fd = open (path, O_WRONLY|O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    entry = cache_mng_get_entry (cmng, ino);
+
+    // held file is opened once and kept open until the last writer releases it
+    if (entry->fd >= 0) {
+        fd = entry->fd;
+    } else {
+        cache_mng_file_name (cmng, path, sizeof (path), ino);
+        fd = open (path, (entry->holders ? O_RDWR : O_WRONLY)|O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    }
     if (fd < 0) {
         LOG_err (CMNG_LOG, INO_H"Failed to create / open file for writing! Path: %s", INO_T (ino), path);
         if (context->cb.store_cb)
@@ -350,17 +390,11 @@ void cache_mng_store_file_buf (CacheMng *cmng, fuse_ino_t ino, size_t size, off_
         cache_context_destroy (context);
         return;
     }
-    res = pwrite(fd, buf, size, off);
-    close (fd);
-
-    entry = g_hash_table_lookup (cmng->h_entries, GUINT_TO_POINTER (ino));
-
-    if (!entry) {
-        entry = cache_entry_create (ino);
-        g_queue_push_head (cmng->q_lru, entry);
-        entry->ll_lru = g_queue_peek_head_link (cmng->q_lru);
-        g_hash_table_insert (cmng->h_entries, GUINT_TO_POINTER (ino), entry);
-    }
+    res = pwrite (fd, buf, size, off);
+    if (entry->holders)
+        entry->fd = fd;
+    else
+        close (fd);
 
     old_length = range_length (entry->avail_range);
     range_add (entry->avail_range, off, range_size);
@@ -388,6 +422,60 @@ void cache_mng_store_file_buf (CacheMng *cmng, fuse_ino_t ino, size_t size, off_
 }
 /*}}}*/
 
+/*{{{ hold_file / release_file */
+// keep cache file opened while the file is being written
+void cache_mng_hold_file (CacheMng *cmng, fuse_ino_t ino)
+{
+    struct _CacheEntry *entry;
+
+    entry = cache_mng_get_entry (cmng, ino);
+    entry->holders++;
+}
+
+void cache_mng_release_file (CacheMng *cmng, fuse_ino_t ino)
+{
+    struct _CacheEntry *entry;
+
+    // entry could be removed meanwhile
+    entry = g_hash_table_lookup (cmng->h_entries, GUINT_TO_POINTER (ino));
+    if (!entry || !entry->holders)
+        return;
+
+    entry->holders--;
+    if (!entry->holders && entry->fd >= 0) {
+        close (entry->fd);
+        entry->fd = -1;
+    }
+}
+/*}}}*/
+
+/*{{{ link_file */
+// create a hard link to the cache file: data stored later is visible through the link,
+// and it stays on disk after the cache file is removed
+gboolean cache_mng_link_file (CacheMng *cmng, fuse_ino_t ino, const gchar *link_path)
+{
+    char path[PATH_MAX];
+    int fd;
+
+    cache_mng_file_name (cmng, path, sizeof (path), ino);
+
+    // data might be not stored yet
+    fd = open (path, O_WRONLY|O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd < 0) {
+        LOG_err (CMNG_LOG, INO_H"Failed to create / open file ! Path: %s", INO_T (ino), path);
+        return FALSE;
+    }
+    close (fd);
+
+    if (link (path, link_path) != 0) {
+        LOG_err (CMNG_LOG, INO_H"Failed to link %s to %s: %s", INO_T (ino), path, link_path, strerror (errno));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+/*}}}*/
+
 /*{{{ remove_file*/
 // removes file from local storage
 void cache_mng_remove_file (CacheMng *cmng, fuse_ino_t ino)
@@ -24,7 +24,11 @@ struct _ClientPool {
     struct event_base *evbase;
     struct evdns_base *dns_base;
     GList *l_clients; // the list of PoolClient (HTTPClient or HTTPConnection)
-    GQueue *q_requests; // the queue of awaiting requests
+    GQueue *q_requests[CLIENT_POOL_LANES]; // the queues of awaiting requests, one per lane
+    guint64 bulk_request_size; // requests of this size and larger go to the bulk lane
+    guint interactive_weight; // interactive requests served in a row while bulk requests are waiting
+    guint interactive_reserve; // awaiting queue slots which can't be taken by bulk requests
+    guint interactive_served;
 };
 
 typedef struct {
@@ -68,7 +72,22 @@ ClientPool *client_pool_create (Application *app,
     pool->evbase = application_get_evbase (app);
     pool->dns_base = application_get_dnsbase (app);
     pool->l_clients = NULL;
-    pool->q_requests = g_queue_new ();
+    for (i = 0; i < CLIENT_POOL_LANES; i++)
+        pool->q_requests[i] = g_queue_new ();
+
+    if (conf_node_exists (application_get_conf (app), "pool.bulk_request_size"))
+        pool->bulk_request_size = conf_get_uint (application_get_conf (app), "pool.bulk_request_size");
+    else
+        pool->bulk_request_size = 1024 * 1024;
+    if (conf_node_exists (application_get_conf (app), "pool.interactive_weight"))
+        pool->interactive_weight = conf_get_uint (application_get_conf (app), "pool.interactive_weight");
+    else
+        pool->interactive_weight = 4;
+    if (conf_node_exists (application_get_conf (app), "pool.interactive_reserve"))
+        pool->interactive_reserve = conf_get_uint (application_get_conf (app), "pool.interactive_reserve");
+    else
+        pool->interactive_reserve = 20;
+    pool->interactive_served = 0;
 
     for (i = 0; i < client_count; i++) {
         pc = g_new0 (PoolClient, 1);
@@ -91,9 +110,12 @@ void client_pool_destroy (ClientPool *pool)
 {
     GList *l;
     PoolClient *pc;
+    gint i;
 
-    if (pool->q_requests)
-        _queue_free_full (pool->q_requests, g_free);
+    for (i = 0; i < CLIENT_POOL_LANES; i++) {
+        if (pool->q_requests[i])
+            _queue_free_full (pool->q_requests[i], g_free);
+    }
     for (l = g_list_first (pool->l_clients); l; l = g_list_next (l)) {
         pc = (PoolClient *) l->data;
         pc->client_destroy (pc->client);
@@ -104,6 +126,26 @@ void client_pool_destroy (ClientPool *pool)
     g_free (pool);
 }
 
+// get the next awaiting request:
+// interactive requests go first, but after "interactive_weight" of them a bulk request is served,
+// so bulk uploads are never starved
+static RequestData *client_pool_pop_request (ClientPool *pool)
+{
+    GQueue *q_interactive = pool->q_requests[CLIENT_POOL_LANE_INTERACTIVE];
+    GQueue *q_bulk = pool->q_requests[CLIENT_POOL_LANE_BULK];
+
+    if (g_queue_is_empty (q_bulk))
+        return g_queue_pop_head (q_interactive);
+
+    if (g_queue_is_empty (q_interactive) || pool->interactive_served >= pool->interactive_weight) {
+        pool->interactive_served = 0;
+        return g_queue_pop_head (q_bulk);
+    }
+
+    pool->interactive_served++;
+    return g_queue_pop_head (q_interactive);
+}
+
 // callback executed when a client done with a request
 static void client_pool_on_client_released (gpointer client, gpointer ctx)
 {
@@ -111,7 +153,7 @@ static void client_pool_on_client_released (gpointer client, gpointer ctx)
     RequestData *data;
 
     // if we have a request pending
-    data = g_queue_pop_head (pc->pool->q_requests);
+    data = client_pool_pop_request (pc->pool);
     if (data) {
         LOG_debug (POOL, "Retrieving client from the Pool: %p", data->ctx);
         data->on_client_ready (client, data->ctx);
@@ -122,17 +164,42 @@ static void client_pool_on_client_released (gpointer client, gpointer ctx)
 // add client's callback to the awaiting queue
 // return TRUE if added, FALSE if list is full
 gboolean client_pool_get_client (ClientPool *pool, ClientPool_on_client_ready on_client_ready, gpointer ctx)
+{
+    return client_pool_get_client_sized (pool, 0, on_client_ready, ctx);
+}
+
+// add client's callback to the awaiting queue of the lane, selected by request size
+// return TRUE if added, FALSE if list is full
+gboolean client_pool_get_client_sized (ClientPool *pool, guint64 size, ClientPool_on_client_ready on_client_ready, gpointer ctx)
 {
     GList *l;
     RequestData *data;
     PoolClient *pc;
+    ClientPoolLane lane;
+    guint max_requests;
+    guint queued;
+
+    if (size >= pool->bulk_request_size)
+        lane = CLIENT_POOL_LANE_BULK;
+    else
+        lane = CLIENT_POOL_LANE_INTERACTIVE;
 
     // check if the awaiting queue is full
-    if (g_queue_get_length (pool->q_requests) >= conf_get_uint (application_get_conf (pool->app), "pool.max_requests_per_pool")) {
+    max_requests = conf_get_uint (application_get_conf (pool->app), "pool.max_requests_per_pool");
+    queued = g_queue_get_length (pool->q_requests[CLIENT_POOL_LANE_INTERACTIVE]) +
+        g_queue_get_length (pool->q_requests[CLIENT_POOL_LANE_BULK]);
+    if (queued >= max_requests) {
         LOG_debug (POOL, "Pool's client awaiting queue is full !");
         return FALSE;
     }
 
+    // bulk requests leave room for the interactive ones, the reserve is limited to a half of the queue
+    if (lane == CLIENT_POOL_LANE_BULK &&
+        queued >= max_requests - MIN (pool->interactive_reserve, max_requests / 2)) {
+        LOG_debug (POOL, "Pool's client awaiting queue is full for bulk requests !");
+        return FALSE;
+    }
+
     // check if there is a client which is ready to execute a new request
     for (l = g_list_first (pool->l_clients); l; l = g_list_next (l)) {
         pc = (PoolClient *) l->data;
@@ -144,13 +211,14 @@ gboolean client_pool_get_client (ClientPool *pool, ClientPool_on_client_ready on
         }
     }
 
-    LOG_debug (POOL, "all Pool's clients are busy, putting into queue: %p", ctx);
+    LOG_debug (POOL, "all Pool's clients are busy, putting into %s queue: %p",
+        lane == CLIENT_POOL_LANE_BULK ? "bulk" : "interactive", ctx);
 
     // add client to the end of queue
     data = g_new0 (RequestData, 1);
     data->on_client_ready = on_client_ready;
     data->ctx = ctx;
-    g_queue_push_tail (pool->q_requests, data);
+    g_queue_push_tail (pool->q_requests[lane], data);
 
     return TRUE;
 }
@@ -160,6 +228,11 @@ gint client_pool_get_client_count (ClientPool *pool)
     return g_list_length (pool->l_clients);
 }
 
+guint client_pool_get_queue_depth (ClientPool *pool, ClientPoolLane lane)
+{
+    return g_queue_get_length (pool->q_requests[lane]);
+}
+
 // collects statistics information from clients
 void client_pool_get_client_stats_info (ClientPool *pool, GString *str, struct PrintFormat *print_format)
 {
@@ -0,0 +1,343 @@
+/*
+ * Copyright (C) 2012-2014 Paul Ionkin <paul.ionkin@gmail.com>
+ * Copyright (C) 2012-2014 Skoobe GmbH. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "dir_buf.h"
+
+/*{{{ struct / defines */
+
+struct _DirBuf {
+    gchar *p;
+    size_t size; // used bytes
+    size_t alloc; // allocated bytes
+    size_t dots_size; // size of "." and ".." entries at the beginning of the buffer
+
+    GHashTable *h_slots; // ino -> DirBufSlot
+    size_t removed_size; // bytes occupied by removed entries
+    guint mark;
+
+    DirBufSnapshot *snapshot; // content of the buffer, NULL if buffer was changed
+};
+
+struct _DirBufSnapshot {
+    gint ref;
+    size_t size;
+    gchar data[];
+};
+
+typedef struct {
+    size_t off; // entry offset in the buffer
+    guint mark;
+} DirBufSlot;
+
+// directory entry as it is sent to the kernel, see "struct fuse_dirent" in fuse_kernel.h
+typedef struct {
+    guint64 ino; // 0 if entry is removed
+    guint64 off; // offset of the next entry
+    guint32 namelen;
+    guint32 type;
+    char name[];
+} DirBufEntry;
+
+#define DIR_BUF_ENTRY_SIZE(namelen) \
+    ((offsetof (DirBufEntry, name) + (namelen) + sizeof (guint64) - 1) & ~(sizeof (guint64) - 1))
+
+#define DIR_BUF_MIN_SIZE 4096
+/*}}}*/
+
+/*{{{ create / destroy */
+
+static void dir_buf_append (DirBuf *dbuf, const gchar *name, fuse_ino_t ino, mode_t mode);
+
+DirBuf *dir_buf_create (fuse_ino_t ino, size_t size_hint)
+{
+    DirBuf *dbuf;
+
+    dbuf = g_new0 (DirBuf, 1);
+    dbuf->alloc = size_hint + dir_buf_entry_size (".") + dir_buf_entry_size ("..");
+    dbuf->p = g_malloc (dbuf->alloc);
+    dbuf->size = 0;
+    dbuf->h_slots = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+    dbuf->removed_size = 0;
+    dbuf->mark = 0;
+    dbuf->snapshot = NULL;
+
+    dir_buf_append (dbuf, ".", ino, S_IFDIR);
+    dir_buf_append (dbuf, "..", ino, S_IFDIR);
+    dbuf->dots_size = dbuf->size;
+
+    return dbuf;
+}
+
+void dir_buf_destroy (DirBuf *dbuf)
+{
+    if (dbuf->snapshot)
+        dir_buf_snapshot_unref (dbuf->snapshot);
+    g_hash_table_destroy (dbuf->h_slots);
+    g_free (dbuf->p);
+    g_free (dbuf);
+}
+/*}}}*/
+
+/*{{{ add / remove */
+
+// buffer is changed, handles keep the previous snapshot
+static void dir_buf_changed (DirBuf *dbuf)
+{
+    if (dbuf->snapshot) {
+        dir_buf_snapshot_unref (dbuf->snapshot);
+        dbuf->snapshot = NULL;
+    }
+}
+
+size_t dir_buf_entry_size (const gchar *name)
+{
+    return DIR_BUF_ENTRY_SIZE (strlen (name));
+}
+
+static void dir_buf_append (DirBuf *dbuf, const gchar *name, fuse_ino_t ino, mode_t mode)
+{
+    DirBufEntry *de;
+    size_t namelen;
+    size_t esize;
+
+    namelen = strlen (name);
+    esize = DIR_BUF_ENTRY_SIZE (namelen);
+
+    // grow geometrically
+    if (dbuf->size + esize > dbuf->alloc) {
+        dbuf->alloc = MAX (MAX (dbuf->alloc * 2, dbuf->size + esize), DIR_BUF_MIN_SIZE);
+        dbuf->p = g_realloc (dbuf->p, dbuf->alloc);
+    }
+
+    de = (DirBufEntry *) (dbuf->p + dbuf->size);
+    memset (de, 0, esize);
+    de->ino = ino;
+    de->off = dbuf->size + esize;
+    de->namelen = namelen;
+    de->type = (mode & S_IFMT) >> 12;
+    memcpy (de->name, name, namelen);
+
+    dbuf->size += esize;
+
+    dir_buf_changed (dbuf);
+}
+
+void dir_buf_add (DirBuf *dbuf, const gchar *name, fuse_ino_t ino, mode_t mode)
+{
+    DirBufSlot *slot;
+
+    dir_buf_remove (dbuf, ino);
+
+    slot = g_new0 (DirBufSlot, 1);
+    slot->off = dbuf->size;
+    slot->mark = dbuf->mark;
+    g_hash_table_insert (dbuf->h_slots, GUINT_TO_POINTER (ino), slot);
+
+    dir_buf_append (dbuf, name, ino, mode);
+}
+
+gboolean dir_buf_remove (DirBuf *dbuf, fuse_ino_t ino)
+{
+    DirBufSlot *slot;
+    DirBufEntry *de;
+
+    slot = g_hash_table_lookup (dbuf->h_slots, GUINT_TO_POINTER (ino));
+    if (!slot)
+        return FALSE;
+
+    de = (DirBufEntry *) (dbuf->p + slot->off);
+    de->ino = 0;
+    dbuf->removed_size += DIR_BUF_ENTRY_SIZE (de->namelen);
+    dir_buf_changed (dbuf);
+
+    g_hash_table_remove (dbuf->h_slots, GUINT_TO_POINTER (ino));
+
+    return TRUE;
+}
+
+gboolean dir_buf_contains (DirBuf *dbuf, fuse_ino_t ino)
+{
+    return g_hash_table_lookup (dbuf->h_slots, GUINT_TO_POINTER (ino)) != NULL;
+}
+/*}}}*/
+
+/*{{{ mark / sweep */
+
+void dir_buf_mark_begin (DirBuf *dbuf)
+{
+    dbuf->mark++;
+}
+
+gboolean dir_buf_mark (DirBuf *dbuf, const gchar *name, fuse_ino_t ino, mode_t mode)
+{
+    DirBufSlot *slot;
+    DirBufEntry *de;
+
+    slot = g_hash_table_lookup (dbuf->h_slots, GUINT_TO_POINTER (ino));
+    if (!slot)
+        return FALSE;
+
+    // entry was renamed or changed its type
+    de = (DirBufEntry *) (dbuf->p + slot->off);
+    if (de->type != (mode & S_IFMT) >> 12 ||
+        de->namelen != strlen (name) || memcmp (de->name, name, de->namelen)) {
+        dir_buf_remove (dbuf, ino);
+        return FALSE;
+    }
+
+    slot->mark = dbuf->mark;
+
+    return TRUE;
+}
+
+static gboolean dir_buf_sweep_cb (gpointer key, gpointer value, gpointer ctx)
+{
+    DirBuf *dbuf = (DirBuf *) ctx;
+    DirBufSlot *slot = (DirBufSlot *) value;
+    DirBufEntry *de;
+
+    if (slot->mark == dbuf->mark)
+        return FALSE;
+
+    de = (DirBufEntry *) (dbuf->p + slot->off);
+    de->ino = 0;
+    dbuf->removed_size += DIR_BUF_ENTRY_SIZE (de->namelen);
+    dir_buf_changed (dbuf);
+
+    (void) key;
+    return TRUE;
+}
+
+guint dir_buf_sweep (DirBuf *dbuf)
+{
+    return g_hash_table_foreach_remove (dbuf->h_slots, dir_buf_sweep_cb, dbuf);
+}
+/*}}}*/
+
+/*{{{ get_data */
+
+guint dir_buf_get_count (DirBuf *dbuf)
+{
+    return g_hash_table_size (dbuf->h_slots);
+}
+
+// drop removed entries, moving the rest of entries to the beginning of the buffer
+static void dir_buf_compact (DirBuf *dbuf)
+{
+    size_t pos;
+    size_t new_size;
+
+    pos = new_size = dbuf->dots_size;
+    while (pos < dbuf->size) {
+        DirBufEntry *de = (DirBufEntry *) (dbuf->p + pos);
+        size_t esize = DIR_BUF_ENTRY_SIZE (de->namelen);
+
+        if (de->ino) {
+            DirBufSlot *slot;
+
+            slot = g_hash_table_lookup (dbuf->h_slots, GUINT_TO_POINTER (de->ino));
+            if (slot)
+                slot->off = new_size;
+
+            if (new_size != pos)
+                memmove (dbuf->p + new_size, de, esize);
+            new_size += esize;
+            ((DirBufEntry *) (dbuf->p + new_size - esize))->off = new_size;
+        }
+        pos += esize;
+    }
+
+    dbuf->size = new_size;
+    dbuf->removed_size = 0;
+}
+
+const gchar *dir_buf_get_data (DirBuf *dbuf, size_t *size)
+{
+    if (dbuf->removed_size)
+        dir_buf_compact (dbuf);
+
+    *size = dbuf->size;
+    return dbuf->p;
+}
+/*}}}*/
+
+/*{{{ foreach */
+
+void dir_buf_data_foreach (const gchar *buf, size_t size, off_t off, DirBuf_entry_cb entry_cb, gpointer ctx)
+{
+    GString *name;
+    size_t pos;
+
+    name = g_string_sized_new (64);
+
+    pos = off;
+    while (pos + offsetof (DirBufEntry, name) <= size) {
+        const DirBufEntry *de = (const DirBufEntry *) (buf + pos);
+
+        if (de->off <= pos || de->off > size)
+            break;
+
+        g_string_truncate (name, 0);
+        g_string_append_len (name, de->name, de->namelen);
+        if (!entry_cb (name->str, de->ino, de->type << 12, de->off, ctx))
+            break;
+
+        pos = de->off;
+    }
+
+    g_string_free (name, TRUE);
+}
+/*}}}*/
+
+/*{{{ snapshot */
+
+DirBufSnapshot *dir_buf_get_snapshot (DirBuf *dbuf)
+{
+    const gchar *buf;
+    size_t size;
+
+    if (!dbuf->snapshot) {
+        buf = dir_buf_get_data (dbuf, &size);
+
+        dbuf->snapshot = g_malloc (sizeof (DirBufSnapshot) + size);
+        dbuf->snapshot->ref = 1;
+        dbuf->snapshot->size = size;
+        memcpy (dbuf->snapshot->data, buf, size);
+    }
+
+    return dir_buf_snapshot_ref (dbuf->snapshot);
+}
+
+DirBufSnapshot *dir_buf_snapshot_ref (DirBufSnapshot *snapshot)
+{
+    snapshot->ref++;
+    return snapshot;
+}
+
+void dir_buf_snapshot_unref (DirBufSnapshot *snapshot)
+{
+    snapshot->ref--;
+    if (!snapshot->ref)
+        g_free (snapshot);
+}
+
+const gchar *dir_buf_snapshot_get_data (DirBufSnapshot *snapshot, size_t *size)
+{
+    *size = snapshot->size;
+    return snapshot->data;
+}
+/*}}}*/
@@ -21,7 +21,14 @@
 #include "client_pool.h"
 #include "file_io_ops.h"
 #include "cache_mng.h"
+#include "dir_buf.h"
+#include "slab.h"
+#include "name_pool.h"
 #include "utils.h"
+#include "list_parser.h"
+
+#include <sys/mman.h>
+#include <sys/file.h>
 
 /*
  * The following union and convert_*() routines
@@ -54,33 +61,48 @@ static void *convert_fh_to_ptr (uint64_t fh)
 
 /*{{{ struct / defines*/
 
+// directory part of DirEntry, allocated by dir_tree_entry_set_dir ()
+typedef struct {
+    gchar *fullpath; // directory name with path and delimiters, see dir_tree_entry_get_fullpath ()
+
+    DirBuf *dir_cache; // FUSE directory cache
+    time_t dir_cache_created;
+    GList *l_dir_readers; // list of DirOpData, reading the directory while it's being listed
+    GList *l_dir_waiters; // list of DirReaddirWaiter, waiting for more entries
+    GList *l_dir_refresh; // list of DirTreeFillDirData, waiting for the listing in progress
+
+    // content of the directory
+    GHashTable *h_dir_tree; // name -> DirEntry
+} DirEntryDir;
+
 struct _DirEntry {
     fuse_ino_t ino;
     fuse_ino_t parent_ino;
-    gchar *basename; // file name, without path
-    gchar *fullpath; // file name with path and delimiters
+    const gchar *basename; // file name, without path, interned in DirTree names pool
 
     // type of directory entry
     DirEntryType type;
+    mode_t mode;
 
     guint64 age; // if age >= parent's age, then show entry in directory listing
-    gboolean removed;
-    gboolean is_modified; // do not show it
+    guint removed:1;
+    guint is_modified:1; // do not show it
+    guint is_updating:1; // TRUE if getting attributes
+    guint dir_cache_dirty:1; // directory content was changed, cache must be synchronized
+    guint dir_cache_updating:1; // currently sending request for a fresh copy of dir list, other requests wait for it
+    // directory is listed for the first time, readdir is served while the listing is in progress
+    guint dir_cache_progressive:1;
+    guint dir_changed:1; // content was changed since the last listing was started
+    guint truncated:1; // file size was set, the next opened handle replaces the object
+    guint dir_stable:4; // number of successive listings which didn't change the directory
+    guint hits:16; // number of accesses, halved every dir_cache_max_time without access, see dir_tree_entry_touch ()
+    guint32 nlookup; // kernel lookup count, entry is not evicted while it's referenced
 
     guint64 size;
-    mode_t mode;
     time_t ctime;
 
-    // for type == DET_dir
-    char *dir_cache; // FUSE directory cache
-    size_t dir_cache_size; // directory cache size
-    time_t dir_cache_created;
-    gboolean dir_cache_updating; // currently sending request for a fresh copy of dir list, return local directory cache
-
-    // for directory only, content of the directory
-    GHashTable *h_dir_tree; // name -> DirEntry
+    DirEntryDir *dir; // for type == DET_dir, NULL for files
 
-    gboolean is_updating; // TRUE if getting attributes
     time_t updated_time; // time when entry was updated
     time_t access_time; // time when entry was accessed
 
@@ -88,8 +110,22 @@ struct _DirEntry {
     gchar *version_id;
     gchar *content_type;
     time_t xattr_time; // time when XAttrs were updated
+
+    gchar *link_target; // symlink target, NULL if not known, dropped when the listing reports a new ETag
 };
 
+// snapshot is written in parts, so the event loop isn't blocked by large trees
+typedef struct {
+    FILE *f;
+    gchar *tmp_path;
+    GQueue *q_dirs; // inodes of directories to write, parents go first
+    GArray *a_inos; // inodes of the current directory entries
+    guint pos; // next entry in a_inos
+    guint32 entry_count;
+    gint64 created;
+    guint64 changes; // value of DirTree "changes" when snapshot was started
+} DirTreeSnapshotSave;
+
 struct _DirTree {
     DirEntry *root;
     GHashTable *h_inodes; // inode -> DirEntry
@@ -97,14 +133,60 @@ struct _DirTree {
 
     fuse_ino_t max_ino; // value for the new DirEntry->ino
 
+    Slab *entries; // DirEntry allocator
+    Slab *dirs; // DirEntryDir allocator
+    NamePool *names; // DirEntry basenames
+
+    // cold entries are evicted when the number of inodes exceeds max_inodes
+    guint max_inodes; // 0 for no limit
+    struct event *ev_evict;
+    time_t evict_failed_time; // the last eviction which couldn't reach the target, 0 if none
+    guint64 evicted;
+
+    // kernel entry / attribute timeouts, seconds
+    guint timeout_min;
+    guint timeout_max;
+
+    // expired directory listings and file attributes are returned for stale_time more seconds,
+    // while they are refreshed in the background
+    guint stale_time;
+    guint64 stale_hits;
+
     gint64 current_write_ops; // the number of current write operations
 
     // files and directories mode, -1 to use the default value
     gint fmode;
     gint dmode;
+
+    // on-disk copy of DirTree, NULL if disabled
+    gchar *snapshot_path;
+    int snapshot_lock_fd; // locked by the instance which owns the snapshot, -1 if none
+    struct event *ev_snapshot; // saves snapshot periodically
+    struct event *ev_snapshot_step; // writes the next part of snapshot
+    DirTreeSnapshotSave *snapshot_save; // snapshot being written, NULL if none
+    guint64 changes; // number of DirTree modifications
+    guint64 snapshot_changes; // value of "changes" when snapshot was saved
+
+    // names which don't exist on the server
+    GHashTable *h_negative; // "parent_ino/name" -> DirTreeNegativeEntry
+    GQueue *q_negative; // keys of h_negative, the oldest first
+    guint negative_ttl; // seconds, 0 to disable
+    guint negative_max_entries;
+    guint64 negative_hits;
 };
 
+typedef struct {
+    time_t created;
+    GList *link; // in q_negative
+} DirTreeNegativeEntry;
+
 #define DIR_TREE_LOG "dir_tree"
+#define DIR_STABLE_MAX 15
+#define DIR_ENTRY_HITS_MAX 0xFFFF
+// seconds between eviction attempts, if entries couldn't be evicted because they are in use
+#define DIR_TREE_EVICT_RETRY 10
+// frequently accessed entries are kept up to this number of dir_cache_max_time after the last access
+#define DIR_ENTRY_RETENTION_MAX 4
 #define DIR_DEFAULT_MODE S_IFDIR | 0755
 #define FILE_DEFAULT_MODE S_IFREG | 0644
 /*}}}*/
@@ -115,6 +197,19 @@ static DirEntry *dir_tree_add_entry (DirTree *dtree, const gchar *basename, mode
 static void dir_tree_entry_modified (DirTree *dtree, DirEntry *en);
 static void dir_entry_destroy (gpointer data);
 static void dir_tree_entry_update_xattrs (DirEntry *en, struct evkeyvalq *headers);
+static void dir_tree_progressive_done (DirEntry *en, gboolean success);
+static void dir_tree_refresh_done (DirEntry *en, gboolean success);
+static void dir_tree_fill_dir_on_http_ready (gpointer client, gpointer ctx);
+static gboolean dir_tree_snapshot_lock (DirTree *dtree);
+static void dir_tree_snapshot_load (DirTree *dtree);
+static void dir_tree_snapshot_on_timer_cb (evutil_socket_t fd, short event, void *ctx);
+static void dir_tree_snapshot_on_step_cb (evutil_socket_t fd, short event, void *ctx);
+static gboolean dir_tree_snapshot_finish (DirTree *dtree, gboolean res);
+static void dir_tree_negative_remove (DirTree *dtree, fuse_ino_t parent_ino, const gchar *name);
+static void dir_tree_evict_on_cb (evutil_socket_t fd, short event, void *ctx);
+static void dir_tree_evict_schedule (DirTree *dtree);
+static void dir_tree_lookup_entry (DirTree *dtree, fuse_ino_t parent_ino, const char *name,
+    dir_tree_lookup_cb lookup_cb, fuse_req_t req, gboolean check_expired);
 /*}}}*/
 
 /*{{{ create / destroy */
@@ -129,6 +224,30 @@ DirTree *dir_tree_create (Application *app)
     dtree->h_inodes = g_hash_table_new (g_direct_hash, g_direct_equal);
     dtree->max_ino = FUSE_ROOT_ID;
     dtree->current_write_ops = 0;
+    dtree->entries = slab_create (sizeof (DirEntry));
+    dtree->dirs = slab_create (sizeof (DirEntryDir));
+    dtree->names = name_pool_create ();
+    dtree->snapshot_lock_fd = -1;
+
+    dtree->max_inodes = 0;
+    if (conf_node_exists (application_get_conf (app), "filesystem.max_inodes"))
+        dtree->max_inodes = conf_get_uint (application_get_conf (app), "filesystem.max_inodes");
+    dtree->ev_evict = event_new (application_get_evbase (app), -1, 0, dir_tree_evict_on_cb, dtree);
+    dtree->evicted = 0;
+
+    dtree->timeout_min = 1;
+    if (conf_node_exists (application_get_conf (app), "filesystem.kernel_timeout_min"))
+        dtree->timeout_min = conf_get_uint (application_get_conf (app), "filesystem.kernel_timeout_min");
+    dtree->timeout_max = 60;
+    if (conf_node_exists (application_get_conf (app), "filesystem.kernel_timeout_max"))
+        dtree->timeout_max = conf_get_uint (application_get_conf (app), "filesystem.kernel_timeout_max");
+    if (dtree->timeout_max < dtree->timeout_min)
+        dtree->timeout_max = dtree->timeout_min;
+
+    dtree->stale_time = 60;
+    if (conf_node_exists (application_get_conf (app), "filesystem.dir_cache_stale_time"))
+        dtree->stale_time = conf_get_uint (application_get_conf (app), "filesystem.dir_cache_stale_time");
+    dtree->stale_hits = 0;
 
     dtree->fmode = conf_get_int (application_get_conf (app), "filesystem.file_mode");
     if (dtree->fmode < 0)
@@ -142,8 +261,45 @@ DirTree *dir_tree_create (Application *app)
     else
         dtree->dmode = dtree->dmode | S_IFDIR;
 
+    dtree->h_negative = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    dtree->q_negative = g_queue_new ();
+    dtree->negative_hits = 0;
+    // by default missing names are cached as long as file attributes
+    if (conf_node_exists (application_get_conf (app), "filesystem.negative_cache_ttl"))
+        dtree->negative_ttl = conf_get_uint (application_get_conf (app), "filesystem.negative_cache_ttl");
+    else
+        dtree->negative_ttl = conf_get_uint (application_get_conf (app), "filesystem.file_cache_max_time");
+    dtree->negative_max_entries = 10000;
+    if (conf_node_exists (application_get_conf (app), "filesystem.negative_cache_max_entries"))
+        dtree->negative_max_entries = conf_get_uint (application_get_conf (app), "filesystem.negative_cache_max_entries");
+
     dtree->root = dir_tree_add_entry (dtree, "/", dtree->dmode, DET_dir, 0, 0, time (NULL));
 
+    // restore DirTree saved by the previous run
+    if (conf_node_exists (application_get_conf (app), "filesystem.dir_tree_snapshot_enabled") &&
+        conf_get_boolean (application_get_conf (app), "filesystem.dir_tree_snapshot_enabled")) {
+        dtree->snapshot_path = g_strdup_printf ("%s/dir_tree.%s.snapshot",
+            conf_get_string (application_get_conf (app), "filesystem.cache_dir"),
+            conf_get_string (application_get_conf (app), "s3.bucket_name"));
+        if (dir_tree_snapshot_lock (dtree))
+            dir_tree_snapshot_load (dtree);
+    }
+
+    if (dtree->snapshot_path) {
+        struct timeval tv;
+
+        tv.tv_sec = 600;
+        if (conf_node_exists (application_get_conf (app), "filesystem.dir_tree_snapshot_interval"))
+            tv.tv_sec = conf_get_uint (application_get_conf (app), "filesystem.dir_tree_snapshot_interval");
+        tv.tv_usec = 0;
+
+        dtree->ev_snapshot_step = event_new (application_get_evbase (app), -1, 0, dir_tree_snapshot_on_step_cb, dtree);
+        if (tv.tv_sec) {
+            dtree->ev_snapshot = event_new (application_get_evbase (app), -1, EV_PERSIST, dir_tree_snapshot_on_timer_cb, dtree);
+            event_add (dtree->ev_snapshot, &tv);
+        }
+    }
+
     LOG_debug (DIR_TREE_LOG, "DirTree created");
 
     return dtree;
@@ -151,8 +307,26 @@ DirTree *dir_tree_create (Application *app)
 
 void dir_tree_destroy (DirTree *dtree)
 {
+    if (dtree->snapshot_save)
+        dir_tree_snapshot_finish (dtree, FALSE);
+    if (dtree->ev_snapshot)
+        event_free (dtree->ev_snapshot);
+    if (dtree->ev_snapshot_step)
+        event_free (dtree->ev_snapshot_step);
+    g_free (dtree->snapshot_path);
+    if (dtree->snapshot_lock_fd >= 0)
+        close (dtree->snapshot_lock_fd);
+    event_free (dtree->ev_evict);
+
+    g_queue_free (dtree->q_negative);
+    g_hash_table_destroy (dtree->h_negative);
+
     g_hash_table_destroy (dtree->h_inodes);
     dir_entry_destroy (dtree->root);
+
+    slab_destroy (dtree->entries);
+    slab_destroy (dtree->dirs);
+    name_pool_destroy (dtree->names);
     g_free (dtree);
 }
 
@@ -166,21 +340,81 @@ static void dir_entry_destroy (gpointer data)
     if (!en)
         return;
 
-    // recursively delete entries
-    if (en->h_dir_tree)
-        g_hash_table_destroy (en->h_dir_tree);
-    if (en->dir_cache)
-        g_free (en->dir_cache);
+    if (en->dir) {
+        // recursively delete entries
+        g_hash_table_destroy (en->dir->h_dir_tree);
+        if (en->dir_cache_progressive)
+            dir_tree_progressive_done (en, FALSE);
+        if (en->dir->l_dir_refresh)
+            dir_tree_refresh_done (en, FALSE);
+        if (en->dir->dir_cache)
+            dir_buf_destroy (en->dir->dir_cache);
+        g_free (en->dir->fullpath);
+        slab_free (en->dir);
+    }
     if (en->etag)
         g_free (en->etag);
     if (en->version_id)
         g_free (en->version_id);
     if (en->content_type)
         g_free (en->content_type);
+    g_free (en->link_target);
+
+    name_pool_unref (en->basename);
+    slab_free (en);
+}
+
+// return full path of the entry, must be freed
+// only directories keep their path, file path is built from the parent's one
+static gchar *dir_tree_entry_get_fullpath (DirTree *dtree, DirEntry *en)
+{
+    DirEntry *parent_en;
+
+    if (en->dir)
+        return g_strdup (en->dir->fullpath);
+
+    if (en->parent_ino == FUSE_ROOT_ID)
+        return g_strdup (en->basename);
+
+    parent_en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (en->parent_ino));
+    if (!parent_en || !parent_en->dir) {
+        LOG_err (DIR_TREE_LOG, INO_H"Parent not found for ino: %"INO_FMT" !", INO_T (en->ino), INO en->parent_ino);
+        return g_strdup (en->basename);
+    }
+
+    return g_strdup_printf ("%s/%s", parent_en->dir->fullpath, en->basename);
+}
+
+// return object path for HTTP requests, must be freed
+static gchar *dir_tree_entry_get_req_path (DirTree *dtree, DirEntry *en)
+{
+    gchar *fullpath;
+    gchar *req_path;
+
+    fullpath = dir_tree_entry_get_fullpath (dtree, en);
+    req_path = g_strdup_printf ("/%s", fullpath);
+    g_free (fullpath);
+
+    return req_path;
+}
+
+// turn entry into a directory
+static void dir_tree_entry_set_dir (DirTree *dtree, DirEntry *en)
+{
+    DirEntryDir *dir;
+
+    en->type = DET_dir;
+    if (en->dir)
+        return;
 
-    g_free (en->basename);
-    g_free (en->fullpath);
-    g_free (en);
+    dir = slab_alloc0 (dtree->dirs);
+    // keys are basenames of children entries
+    dir->h_dir_tree = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, dir_entry_destroy);
+    if (en->parent_ino)
+        dir->fullpath = dir_tree_entry_get_fullpath (dtree, en);
+    else
+        dir->fullpath = g_strdup ("");
+    en->dir = dir;
 }
 
 // create and add a new entry (file or dir) to DirTree
@@ -189,7 +423,6 @@ static DirEntry *dir_tree_add_entry (DirTree *dtree, const gchar *basename, mode
 {
     DirEntry *en;
     DirEntry *parent_en = NULL;
-    gchar *fullpath = NULL;
     char tmbuf[64];
     struct tm *nowtm;
     guint64 current_age = 0;
@@ -197,7 +430,7 @@ static DirEntry *dir_tree_add_entry (DirTree *dtree, const gchar *basename, mode
     // get the parent, for inodes > 0
     if (parent_ino) {
         parent_en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (parent_ino));
-        if (!parent_en) {
+        if (!parent_en || !parent_en->dir) {
             LOG_err (DIR_TREE_LOG, "Parent not found for ino: %"INO_FMT" !", INO parent_ino);
             return NULL;
         }
@@ -205,33 +438,25 @@ static DirEntry *dir_tree_add_entry (DirTree *dtree, const gchar *basename, mode
 
     if (parent_en) {
         // check if parent already contains file with the same name.
-        en = g_hash_table_lookup (parent_en->h_dir_tree, basename);
+        en = g_hash_table_lookup (parent_en->dir->h_dir_tree, basename);
         if (en && en->type != type) {
             LOG_debug (DIR_TREE_LOG, "Parent already contains file %s!", basename);
             return NULL;
         }
     }
 
-    // get fullname
     if (parent_ino) {
         // update directory buffer
         dir_tree_entry_modified (dtree, parent_en);
         current_age = parent_en->age;
-
-        if (parent_ino == FUSE_ROOT_ID)
-            fullpath = g_strdup_printf ("%s", basename);
-        else
-            fullpath = g_strdup_printf ("%s/%s", parent_en->fullpath, basename);
-    } else {
-        fullpath = g_strdup ("");
     }
 
-    en = g_new0 (DirEntry, 1);
+    en = slab_alloc0 (dtree->entries);
     en->is_updating = FALSE;
-    en->fullpath = fullpath;
+    en->dir = NULL;
     en->ino = dtree->max_ino++;
     en->age = current_age;
-    en->basename = g_strdup (basename);
+    en->basename = name_pool_ref (dtree->names, basename);
     en->mode = mode;
     en->size = size;
     en->parent_ino = parent_ino;
@@ -242,34 +467,42 @@ static DirEntry *dir_tree_add_entry (DirTree *dtree, const gchar *basename, mode
     en->updated_time = 0;
     en->access_time = time (NULL);
     en->xattr_time = 0;
+    en->link_target = NULL;
+    en->hits = 0;
 
     // cache is empty
-    en->dir_cache = NULL;
-    en->dir_cache_size = 0;
-    en->dir_cache_created = 0;
+    en->dir_cache_dirty = FALSE;
     en->dir_cache_updating = FALSE;
+    en->dir_cache_progressive = FALSE;
 
     nowtm = localtime (&en->ctime);
     strftime (tmbuf, sizeof (tmbuf), "%Y-%m-%d %H:%M:%S", nowtm);
 
-    LOG_debug (DIR_TREE_LOG, INO_H"Creating new DirEntry: %s, fullpath: %s, mode: %d time: %s",
-        INO_T (en->ino), en->basename, en->fullpath, en->mode, tmbuf);
+    LOG_debug (DIR_TREE_LOG, INO_H"Creating new DirEntry: %s, parent_ino: %"INO_FMT", mode: %d time: %s",
+        INO_T (en->ino), en->basename, INO parent_ino, en->mode, tmbuf);
 
-    if (type == DET_dir) {
-        en->h_dir_tree = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, dir_entry_destroy);
-    }
+    if (type == DET_dir)
+        dir_tree_entry_set_dir (dtree, en);
 
     // add to global inode hash
     g_hash_table_insert (dtree->h_inodes, GUINT_TO_POINTER (en->ino), en);
 
     // add to the parent's hash
-    if (parent_ino)
-        g_hash_table_insert (parent_en->h_dir_tree, g_strdup (en->basename), en);
+    if (parent_ino) {
+        g_hash_table_insert (parent_en->dir->h_dir_tree, (gpointer) en->basename, en);
+        // name is created locally or returned by directory listing
+        dir_tree_negative_remove (dtree, parent_ino, en->basename);
+    }
 
     // inform parent that the directory cache has changed
     if (parent_ino)
         dir_tree_entry_modified (dtree, parent_en);
 
+    // evict cold entries from the event loop, callers keep pointers to the entries
+    if (dtree->max_inodes && g_hash_table_size (dtree->h_inodes) > dtree->max_inodes &&
+        !event_pending (dtree->ev_evict, EV_TIMEOUT, NULL))
+        dir_tree_evict_schedule (dtree);
+
     return en;
 }
 
@@ -277,18 +510,18 @@ static gboolean dir_tree_is_cache_expired (DirTree *dtree, DirEntry *en)
 {
     time_t t;
 
-    // cache is not filled
-    if (!en->dir_cache_size || !en->dir_cache_created)
+    // cache is not filled or must be synchronized
+    if (!en->dir->dir_cache || en->dir_cache_dirty || !en->dir->dir_cache_created)
         return TRUE;
 
     t = time (NULL);
 
     // make sure "now" is greater than cache time
-    if (t < en->dir_cache_created)
+    if (t < en->dir->dir_cache_created)
         return FALSE;
 
     // is it expired
-    if (t - en->dir_cache_created > (time_t)conf_get_uint (application_get_conf (dtree->app), "filesystem.dir_cache_max_time"))
+    if (t - en->dir->dir_cache_created > (time_t)conf_get_uint (application_get_conf (dtree->app), "filesystem.dir_cache_max_time"))
         return TRUE;
 
     // if directory was modified, the cache is no longer valid
@@ -298,19 +531,366 @@ static gboolean dir_tree_is_cache_expired (DirTree *dtree, DirEntry *en)
     return FALSE;
 }
 
+// cache is expired by time, but not older than dir_cache_stale_time after that:
+// it can be returned while the directory is listed in the background
+static gboolean dir_tree_is_cache_stale (DirTree *dtree, DirEntry *en)
+{
+    time_t t;
+    time_t max_time;
+
+    if (!dtree->stale_time)
+        return FALSE;
+
+    // local changes must be synchronized first
+    if (!en->dir->dir_cache || en->dir_cache_dirty || !en->dir->dir_cache_created || en->is_modified)
+        return FALSE;
+
+    t = time (NULL);
+    max_time = (time_t)conf_get_uint (application_get_conf (dtree->app), "filesystem.dir_cache_max_time");
+
+    return t - en->dir->dir_cache_created > max_time &&
+        t - en->dir->dir_cache_created <= max_time + (time_t)dtree->stale_time;
+}
+
+/*{{{ retention */
+// entries are kept in memory according to the number of recent accesses:
+// entries which were accessed once (e.g. by a scan) are dropped soon, frequently accessed ones survive listings
+
+// number of hits, decayed by the time since the last access
+static guint dir_tree_entry_get_hits (DirTree *dtree, DirEntry *en, time_t now)
+{
+    guint32 half_life;
+    guint32 periods;
+
+    if (now <= en->access_time)
+        return en->hits;
+
+    half_life = MAX (conf_get_uint (application_get_conf (dtree->app), "filesystem.dir_cache_max_time"), 1);
+    periods = (now - en->access_time) / half_life;
+    if (periods >= 16)
+        return 0;
+
+    return en->hits >> periods;
+}
+
+// entry is accessed
+static void dir_tree_entry_touch (DirTree *dtree, DirEntry *en)
+{
+    time_t now = time (NULL);
+
+    en->hits = MIN (dir_tree_entry_get_hits (dtree, en, now) + 1, DIR_ENTRY_HITS_MAX);
+    en->access_time = now;
+}
+
+// time to keep entry after the last access: file_cache_max_time for every hit,
+// up to DIR_ENTRY_RETENTION_MAX * dir_cache_max_time
+static guint32 dir_tree_entry_get_retention (DirTree *dtree, DirEntry *en, time_t now)
+{
+    guint64 retention;
+
+    retention = (guint64) conf_get_uint (application_get_conf (dtree->app), "filesystem.file_cache_max_time") *
+        MAX (dir_tree_entry_get_hits (dtree, en, now), 1);
+
+    return MIN (retention,
+        (guint64) conf_get_uint (application_get_conf (dtree->app), "filesystem.dir_cache_max_time") * DIR_ENTRY_RETENTION_MAX);
+}
+/*}}}*/
+
+/*{{{ eviction */
+
+// entry is referenced by the kernel or is in use
+static gboolean dir_tree_entry_is_pinned (DirTree *dtree, DirEntry *en, time_t now)
+{
+    return !en->parent_ino || en->nlookup || en->is_modified || en->is_updating ||
+        en->dir_cache_updating || en->dir_cache_progressive || (en->dir && en->dir->l_dir_readers) ||
+        now < en->access_time ||
+        (guint32)(now - en->access_time) < dir_tree_entry_get_retention (dtree, en, now);
+}
+
+// return TRUE if entry and all its children can be removed, "count" is set to the number of entries in subtree
+static gboolean dir_tree_subtree_is_evictable (DirTree *dtree, DirEntry *en, time_t now, guint *count)
+{
+    GHashTableIter iter;
+    gpointer value;
+    guint n = 1;
+
+    if (dir_tree_entry_is_pinned (dtree, en, now))
+        return FALSE;
+
+    if (en->dir) {
+        g_hash_table_iter_init (&iter, en->dir->h_dir_tree);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+            guint child_count = 0;
+
+            if (!dir_tree_subtree_is_evictable (dtree, (DirEntry *) value, now, &child_count))
+                return FALSE;
+            n += child_count;
+        }
+    }
+
+    if (count)
+        *count = n;
+
+    return TRUE;
+}
+
+// remove entry and its children from the inode hash table, entries are destroyed with the parent's h_dir_tree record
+static void dir_tree_subtree_unindex (DirTree *dtree, DirEntry *en)
+{
+    GHashTableIter iter;
+    gpointer value;
+
+    if (en->dir) {
+        g_hash_table_iter_init (&iter, en->dir->h_dir_tree);
+        while (g_hash_table_iter_next (&iter, NULL, &value))
+            dir_tree_subtree_unindex (dtree, (DirEntry *) value);
+    } else {
+        cache_mng_remove_file (application_get_cache_mng (dtree->app), en->ino);
+    }
+
+    g_hash_table_remove (dtree->h_inodes, GUINT_TO_POINTER (en->ino));
+}
+
+typedef struct {
+    DirEntry *en;
+    guint count; // entries in subtree
+    guint hits; // decayed hits of the subtree root
+} DirTreeEvictCandidate;
+
+// collect the largest subtrees which can be evicted, return TRUE if the whole subtree of "en" can be evicted
+static gboolean dir_tree_evict_collect (DirTree *dtree, DirEntry *en, time_t now, GArray *a_candidates, guint *count)
+{
+    GHashTableIter iter;
+    gpointer value;
+    gboolean evictable;
+    guint first = a_candidates->len;
+    guint n = 1;
+
+    evictable = !dir_tree_entry_is_pinned (dtree, en, now);
+
+    if (en->dir) {
+        g_hash_table_iter_init (&iter, en->dir->h_dir_tree);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+            DirEntry *child = (DirEntry *) value;
+            guint child_count = 0;
+
+            if (dir_tree_evict_collect (dtree, child, now, a_candidates, &child_count)) {
+                DirTreeEvictCandidate c;
+
+                c.en = child;
+                c.count = child_count;
+                c.hits = dir_tree_entry_get_hits (dtree, child, now);
+                g_array_append_val (a_candidates, c);
+                n += child_count;
+            } else {
+                evictable = FALSE;
+            }
+        }
+    }
+
+    // the whole subtree is evicted by parent, drop children candidates
+    if (evictable)
+        g_array_set_size (a_candidates, first);
+
+    *count = n;
+    return evictable;
+}
+
+static gint dir_tree_evict_candidate_cmp (gconstpointer a, gconstpointer b)
+{
+    const DirTreeEvictCandidate *c1 = (const DirTreeEvictCandidate *) a;
+    const DirTreeEvictCandidate *c2 = (const DirTreeEvictCandidate *) b;
+
+    // the least frequently, then the least recently accessed first
+    if (c1->hits != c2->hits)
+        return c1->hits < c2->hits ? -1 : 1;
+    if (c1->en->access_time != c2->en->access_time)
+        return c1->en->access_time < c2->en->access_time ? -1 : 1;
+    return 0;
+}
+
+// remove cold entries until the number of inodes drops below 90% of max_inodes
+static void dir_tree_evict (DirTree *dtree)
+{
+    GArray *a_candidates;
+    guint total;
+    guint target;
+    guint count;
+    guint evicted = 0;
+    guint i;
+    time_t now = time (NULL);
+
+    total = g_hash_table_size (dtree->h_inodes);
+    target = dtree->max_inodes - dtree->max_inodes / 10;
+    if (total <= target)
+        return;
+
+    a_candidates = g_array_new (FALSE, FALSE, sizeof (DirTreeEvictCandidate));
+    dir_tree_evict_collect (dtree, dtree->root, now, a_candidates, &count);
+    g_array_sort (a_candidates, dir_tree_evict_candidate_cmp);
+
+    for (i = 0; i < a_candidates->len && total - evicted > target; i++) {
+        DirTreeEvictCandidate *c = &g_array_index (a_candidates, DirTreeEvictCandidate, i);
+        DirEntry *parent_en;
+
+        parent_en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (c->en->parent_ino));
+        if (!parent_en)
+            continue;
+
+        // directory listing doesn't match the content anymore, it has to be requested again
+        parent_en->dir->dir_cache_created = 0;
+
+        dir_tree_subtree_unindex (dtree, c->en);
+        // destroys entry
+        g_hash_table_remove (parent_en->dir->h_dir_tree, c->en->basename);
+        dir_tree_entry_modified (dtree, parent_en);
+        evicted += c->count;
+    }
+
+    dtree->evicted += evicted;
+    // entries are in use, the next attempt is delayed
+    dtree->evict_failed_time = total - evicted > target ? now : 0;
+    if (total - evicted > target)
+        LOG_msg (DIR_TREE_LOG, "Evicted %u entries, inodes: %u, limit: %u, the rest of entries are in use",
+            evicted, total - evicted, dtree->max_inodes);
+    else
+        LOG_debug (DIR_TREE_LOG, "Evicted %u entries, inodes: %u", evicted, total - evicted);
+
+    g_array_free (a_candidates, TRUE);
+}
+
+static void dir_tree_evict_on_cb (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short event, void *ctx)
+{
+    DirTree *dtree = (DirTree *) ctx;
+
+    dir_tree_evict (dtree);
+}
+
+// run eviction on the next loop iteration, or DIR_TREE_EVICT_RETRY seconds after the failed one
+static void dir_tree_evict_schedule (DirTree *dtree)
+{
+    struct timeval tv;
+    time_t now = time (NULL);
+
+    if (!dtree->evict_failed_time || now < dtree->evict_failed_time ||
+        now - dtree->evict_failed_time >= DIR_TREE_EVICT_RETRY) {
+        event_active (dtree->ev_evict, EV_TIMEOUT, 0);
+        return;
+    }
+
+    tv.tv_sec = DIR_TREE_EVICT_RETRY - (now - dtree->evict_failed_time);
+    tv.tv_usec = 0;
+    event_add (dtree->ev_evict, &tv);
+}
+
+// kernel has got a reference to the entry
+void dir_tree_lookup_ref (DirTree *dtree, fuse_ino_t ino)
+{
+    DirEntry *en;
+
+    en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (ino));
+    if (en)
+        en->nlookup++;
+}
+
+// kernel dropped "nlookup" references
+void dir_tree_forget (DirTree *dtree, fuse_ino_t ino, guint64 nlookup)
+{
+    DirEntry *en;
+
+    en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (ino));
+    if (!en)
+        return;
+
+    if (nlookup > en->nlookup) {
+        LOG_debug (DIR_TREE_LOG, INO_H"Forget nlookup %"G_GUINT64_FORMAT" is larger than the lookup count %u",
+            INO_T (ino), nlookup, en->nlookup);
+        en->nlookup = 0;
+    } else
+        en->nlookup -= nlookup;
+}
+
+void dir_tree_get_eviction_stats (DirTree *dtree, guint32 *max_inodes, guint64 *evicted)
+{
+    *max_inodes = dtree->max_inodes;
+    *evicted = dtree->evicted;
+}
+
+void dir_tree_get_stale_stats (DirTree *dtree, guint32 *stale_time, guint64 *stale_hits)
+{
+    *stale_time = dtree->stale_time;
+    *stale_hits = dtree->stale_hits;
+}
+/*}}}*/
+
+/*{{{ kernel timeouts */
+
+// timeout doubles with every listing of the parent directory which didn't change it
+gdouble dir_tree_get_timeout (DirTree *dtree, fuse_ino_t ino)
+{
+    DirEntry *en;
+    DirEntry *parent_en;
+    guint64 timeout;
+
+    en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (ino));
+    if (!en || en->is_modified)
+        return dtree->timeout_min;
+
+    if (en->parent_ino)
+        parent_en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (en->parent_ino));
+    else
+        parent_en = en;
+    if (!parent_en)
+        return dtree->timeout_min;
+
+    timeout = (guint64) dtree->timeout_min << parent_en->dir_stable;
+
+    return MIN (timeout, dtree->timeout_max);
+}
+/*}}}*/
+
 // increase the age of directory
 void dir_tree_start_update (DirEntry *en, G_GNUC_UNUSED const gchar *dir_path)
 {
     //XXX: per directory ?
     en->age++;
+    en->dir_changed = FALSE;
 
     LOG_debug (DIR_TREE_LOG, "UPDATED CURRENT AGE: %"G_GUINT64_FORMAT, en->age);
 }
 
+/*{{{ kernel cache invalidation */
+// only entries which were looked up by the kernel can be in its cache
+
+// attributes or content of the entry were changed on the server
+static void dir_tree_notify_inval_inode (DirTree *dtree, DirEntry *en)
+{
+    if (!en->nlookup)
+        return;
+
+    rfuse_notify_inval_inode (application_get_rfuse (dtree->app), en->ino);
+}
+
+// entry was removed from the server
+static void dir_tree_notify_inval_entry (DirTree *dtree, DirEntry *en)
+{
+    if (!en->nlookup)
+        return;
+
+    rfuse_notify_inval_entry (application_get_rfuse (dtree->app), en->parent_ino, en->basename);
+}
+/*}}}*/
+
+typedef struct {
+    DirTree *dtree;
+    gboolean success; // listing is complete
+} DirTreeStopUpdateData;
+
 // remove DirEntry, which age is lower than the current
 static gboolean dir_tree_stop_update_on_remove_child_cb (gpointer key, gpointer value, gpointer ctx)
 {
-    DirTree *dtree = (DirTree *)ctx;
+    DirTreeStopUpdateData *stop_data = (DirTreeStopUpdateData *) ctx;
+    DirTree *dtree = stop_data->dtree;
     DirEntry *en = (DirEntry *) value;
     DirEntry *parent_en;
     const gchar *name = (const gchar *) key;
@@ -322,38 +902,41 @@ static gboolean dir_tree_stop_update_on_remove_child_cb (gpointer key, gpointer
         return FALSE;
     }
 
+    // entry was in the previous listing, but is gone now
+    if (stop_data->success && en->age + 1 == parent_en->age && !en->is_modified)
+        dir_tree_notify_inval_entry (dtree, en);
+
     // if entry is "old", but someone still tries to access it - leave it untouched
     // is_modified = TRUE - the local file has a modification, don't remove it for now
-    // XXX: implement smarter algorithm here, "time to remove" should be based on the number of hits
-    // process files only
+    // the more hits entry has, the longer it's kept, see dir_tree_entry_get_retention ()
     if (en->age < parent_en->age &&
         !en->is_modified &&
         now > en->access_time &&
-        (guint32)(now - en->access_time) >= conf_get_uint (application_get_conf (dtree->app), "filesystem.dir_cache_max_time") &&
-        en->type != DET_dir) {
-
-        // first remove item from the inode hash table !
-        g_hash_table_remove (dtree->h_inodes, GUINT_TO_POINTER (en->ino));
+        (guint32)(now - en->access_time) >= dir_tree_entry_get_retention (dtree, en, now)) {
 
         // now remove from parent's hash table, it will call destroy () fucntion
         if (en->type == DET_dir) {
-            // XXX:
-            LOG_debug (DIR_TREE_LOG, INO_H"Removing dir: %s", INO_T (en->ino), en->fullpath);
-            return TRUE;
+            // directory is removed with its content, unless kernel still references any entry
+            if (!dir_tree_subtree_is_evictable (dtree, en, now, NULL))
+                return FALSE;
+            LOG_debug (DIR_TREE_LOG, INO_H"Removing dir: %s", INO_T (en->ino), en->dir->fullpath);
         } else {
             LOG_debug (DIR_TREE_LOG, INO_H"Removing file %s", INO_T (en->ino), name);
-            //XXX:
-            return TRUE;
         }
+
+        // first remove items from the inode hash table !
+        dir_tree_subtree_unindex (dtree, en);
+        return TRUE;
     }
 
     return FALSE;
 }
 
 // remove all entries which age is less than current
-void dir_tree_stop_update (DirTree *dtree, fuse_ino_t parent_ino)
+void dir_tree_stop_update (DirTree *dtree, fuse_ino_t parent_ino, gboolean success)
 {
     DirEntry *parent_en;
+    DirTreeStopUpdateData stop_data;
     guint res;
 
     parent_en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (parent_ino));
@@ -361,23 +944,26 @@ void dir_tree_stop_update (DirTree *dtree, fuse_ino_t parent_ino)
         LOG_err (DIR_TREE_LOG, INO_H"DirEntry is not a directory !", INO_T (parent_ino));
         return;
     }
-    LOG_debug (DIR_TREE_LOG, INO_H"Removing old DirEntries for: %s ..", INO_T (parent_ino), parent_en->fullpath);
+    LOG_debug (DIR_TREE_LOG, INO_H"Removing old DirEntries for: %s ..", INO_T (parent_ino), parent_en->dir->fullpath);
 
     if (parent_en->type != DET_dir) {
         LOG_err (DIR_TREE_LOG, INO_H"Parent is not a directory !", INO_T (parent_ino));
         return;
     }
 
-    res = g_hash_table_foreach_remove (parent_en->h_dir_tree, dir_tree_stop_update_on_remove_child_cb, dtree);
+    stop_data.dtree = dtree;
+    stop_data.success = success;
+    res = g_hash_table_foreach_remove (parent_en->dir->h_dir_tree, dir_tree_stop_update_on_remove_child_cb, &stop_data);
     if (res)
         LOG_debug (DIR_TREE_LOG, INO_H"Removed: %u entries !", INO_T (parent_ino), res);
 }
 
 DirEntry *dir_tree_update_entry (DirTree *dtree, G_GNUC_UNUSED const gchar *path, DirEntryType type,
-    fuse_ino_t parent_ino, const gchar *entry_name, long long size, time_t last_modified)
+    fuse_ino_t parent_ino, const gchar *entry_name, long long size, time_t last_modified, const gchar *etag)
 {
     DirEntry *parent_en;
     DirEntry *en;
+    gchar *new_etag = NULL;
 
 
     // get parent
@@ -388,8 +974,47 @@ DirEntry *dir_tree_update_entry (DirTree *dtree, G_GNUC_UNUSED const gchar *path
     }
 
     // get child
-    en = g_hash_table_lookup (parent_en->h_dir_tree, entry_name);
-    if (en) {
+    en = g_hash_table_lookup (parent_en->dir->h_dir_tree, entry_name);
+    if (en && type == DET_dir && en->type == DET_file) {
+        // compatibility with s3fs: directory is stored as an empty object, "name/" prefix exists if it's not empty
+        if (en->size == 0 && !en->is_modified &&
+            conf_get_boolean (application_get_conf (dtree->app), "s3.check_empty_files")) {
+            LOG_debug (DIR_TREE_LOG, INO_H"Converting to directory: %s", INO_T (en->ino), entry_name);
+            dir_tree_entry_set_dir (dtree, en);
+            en->mode = dtree->dmode;
+            parent_en->dir_changed = TRUE;
+            dir_tree_notify_inval_entry (dtree, en);
+            // offsets of a progressive listing must stay valid, entry type is fixed
+            // by the mark / sweep when the listing is finished
+        }
+        en->age = parent_en->age;
+        en->removed = FALSE;
+    } else if (en) {
+        gboolean etag_changed = FALSE;
+
+        if (etag && en->type == DET_file) {
+            new_etag = str_remove_quotes (g_strdup (etag));
+            etag_changed = en->etag && strcmp (en->etag, new_etag);
+        }
+
+        // same size rewrite changes only ETag, directory isn't stable either
+        if (en->size != (guint64) size || en->removed || etag_changed)
+            parent_en->dir_changed = TRUE;
+        // file was changed on the server, kernel keeps old attributes and pages
+        if ((en->size != (guint64) size || etag_changed) && !en->removed && !en->is_modified && en->type == DET_file) {
+            dir_tree_notify_inval_inode (dtree, en);
+            // metadata, xattrs and symlink target have to be requested again
+            en->updated_time = 0;
+            en->xattr_time = 0;
+            g_free (en->link_target);
+            en->link_target = NULL;
+        }
+        // ETag is sent in every listing, getxattr doesn't need HEAD request for it
+        if (new_etag && !en->is_modified) {
+            g_free (en->etag);
+            en->etag = new_etag;
+            new_etag = NULL;
+        }
         en->age = parent_en->age;
         en->size = size;
         // we got this entry from the server, mark as existing file
@@ -404,7 +1029,14 @@ DirEntry *dir_tree_update_entry (DirTree *dtree, G_GNUC_UNUSED const gchar *path
 
         en = dir_tree_add_entry (dtree, entry_name, mode,
             type, parent_ino, size, last_modified);
+        if (en && etag && type == DET_file)
+            en->etag = str_remove_quotes (g_strdup (etag));
     }
+    g_free (new_etag);
+
+    // directory is being listed for the first time, show the entry right away
+    if (en && parent_en->dir_cache_progressive && !dir_buf_contains (parent_en->dir->dir_cache, en->ino))
+        dir_buf_add (parent_en->dir->dir_cache, en->basename, en->ino, en->mode);
 
     LOG_debug (DIR_TREE_LOG, INO_H"Updating %s, size: %lld", INO_T (en->ino), entry_name, size);
 
@@ -414,12 +1046,13 @@ DirEntry *dir_tree_update_entry (DirTree *dtree, G_GNUC_UNUSED const gchar *path
 // let it know that directory cache have to be updated
 static void dir_tree_entry_modified (DirTree *dtree, DirEntry *en)
 {
+    dtree->changes++;
+
     if (en->type == DET_dir) {
-        if (en->dir_cache)
-            g_free (en->dir_cache);
-        en->dir_cache = NULL;
-        en->dir_cache_size = 0;
-        //en->dir_cache_created = 0;
+        // directory buffer is kept, only changed entries are updated
+        en->dir_cache_dirty = TRUE;
+        en->dir_changed = TRUE;
+        en->dir_stable = 0;
 
         LOG_debug (DIR_TREE_LOG, INO_H"Invalidating cache for directory: %s", INO_T (en->ino), en->basename);
     } else {
@@ -438,9 +1071,11 @@ static void dir_tree_entry_modified (DirTree *dtree, DirEntry *en)
 
 /*{{{ dir_tree_fill_dir_buf */
 
+// opened directory handle
 typedef struct {
-    gchar *buf;
-    size_t size;
+    DirBufSnapshot *snapshot; // directory content, shared with other handles
+    fuse_ino_t ino;
+    gboolean progressive; // reading directory buffer while the directory is being listed
 } DirOpData;
 
 typedef struct {
@@ -452,18 +1087,215 @@ typedef struct {
     fuse_req_t req;
     gpointer ctx;
     DirOpData *dop;
+    gboolean progressive; // request is served by dir_tree_progressive_* ()
+    gboolean listed; // directory listing was requested from the server
 } DirTreeFillDirData;
 
-// callback: directory structure
-void dir_tree_fill_on_dir_buf_cb (gpointer callback_data, gboolean success)
-{
-    DirTreeFillDirData *dir_fill_data = (DirTreeFillDirData *) callback_data;
-    DirEntry *en;
-
-    en = g_hash_table_lookup (dir_fill_data->dtree->h_inodes, GUINT_TO_POINTER (dir_fill_data->ino));
-    if (!en) {
+// readdir request, waiting for the next page of directory listing
+typedef struct {
+    size_t size;
+    off_t off;
+    dir_tree_readdir_cb readdir_cb;
+    fuse_req_t req;
+    gpointer ctx;
+} DirReaddirWaiter;
+
+/*{{{ progressive readdir */
+// directory is listed for the first time:
+// entries are added to the directory buffer as soon as a listing page is received,
+// handles read the growing buffer, offsets are stable as entries are only appended
+
+// send entries which are already received, "partial" - reply even if there is less than requested
+static gboolean dir_tree_progressive_reply (DirEntry *en, size_t size, off_t off,
+    dir_tree_readdir_cb readdir_cb, fuse_req_t req, gpointer ctx, gboolean partial)
+{
+    const gchar *buf;
+    size_t buf_size;
+
+    buf = dir_buf_get_data (en->dir->dir_cache, &buf_size);
+    if ((size_t) off >= buf_size || (!partial && buf_size - off < size))
+        return FALSE;
+
+    readdir_cb (req, TRUE, size, off, buf, buf_size, ctx);
+    return TRUE;
+}
+
+static void dir_tree_progressive_readdir (DirEntry *en, size_t size, off_t off,
+    dir_tree_readdir_cb readdir_cb, fuse_req_t req, gpointer ctx)
+{
+    DirReaddirWaiter *waiter;
+
+    if (dir_tree_progressive_reply (en, size, off, readdir_cb, req, ctx, FALSE))
+        return;
+
+    LOG_debug (DIR_TREE_LOG, INO_H"Waiting for more directory entries, offset: %"OFF_FMT, INO_T (en->ino), off);
+
+    waiter = g_new0 (DirReaddirWaiter, 1);
+    waiter->size = size;
+    waiter->off = off;
+    waiter->readdir_cb = readdir_cb;
+    waiter->req = req;
+    waiter->ctx = ctx;
+    en->dir->l_dir_waiters = g_list_append (en->dir->l_dir_waiters, waiter);
+}
+
+// a page of directory listing is received
+static void dir_tree_progressive_on_page_cb (gpointer callback_data)
+{
+    DirTreeFillDirData *dir_fill_data = (DirTreeFillDirData *) callback_data;
+    DirEntry *en;
+    GList *l, *next;
+
+    en = g_hash_table_lookup (dir_fill_data->dtree->h_inodes, GUINT_TO_POINTER (dir_fill_data->ino));
+    if (!en || !en->dir_cache_progressive)
+        return;
+
+    for (l = en->dir->l_dir_waiters; l; l = next) {
+        DirReaddirWaiter *waiter = (DirReaddirWaiter *) l->data;
+
+        next = g_list_next (l);
+        if (dir_tree_progressive_reply (en, waiter->size, waiter->off, waiter->readdir_cb, waiter->req, waiter->ctx, TRUE)) {
+            en->dir->l_dir_waiters = g_list_delete_link (en->dir->l_dir_waiters, l);
+            g_free (waiter);
+        }
+    }
+}
+
+// listing is finished, readers continue with the snapshot of the current buffer
+static void dir_tree_progressive_done (DirEntry *en, gboolean success)
+{
+    DirBufSnapshot *snapshot;
+    const gchar *buf;
+    size_t buf_size;
+    GList *l;
+
+    en->dir_cache_progressive = FALSE;
+
+    snapshot = dir_buf_get_snapshot (en->dir->dir_cache);
+    buf = dir_buf_snapshot_get_data (snapshot, &buf_size);
+
+    for (l = g_list_first (en->dir->l_dir_readers); l; l = g_list_next (l)) {
+        DirOpData *dop = (DirOpData *) l->data;
+
+        dop->progressive = FALSE;
+        dop->snapshot = dir_buf_snapshot_ref (snapshot);
+    }
+    g_list_free (en->dir->l_dir_readers);
+    en->dir->l_dir_readers = NULL;
+
+    for (l = g_list_first (en->dir->l_dir_waiters); l; l = g_list_next (l)) {
+        DirReaddirWaiter *waiter = (DirReaddirWaiter *) l->data;
+
+        if (success)
+            waiter->readdir_cb (waiter->req, TRUE, waiter->size, waiter->off, buf, buf_size, waiter->ctx);
+        else
+            waiter->readdir_cb (waiter->req, FALSE, waiter->size, waiter->off, NULL, 0, waiter->ctx);
+        g_free (waiter);
+    }
+    g_list_free (en->dir->l_dir_waiters);
+    en->dir->l_dir_waiters = NULL;
+
+    dir_buf_snapshot_unref (snapshot);
+}
+/*}}}*/
+
+/*{{{ single-flight refresh */
+// only one listing per directory is sent at a time,
+// readdir and lookup requests which arrive meanwhile are replied when it's finished
+
+static void dir_tree_on_refresh_read (G_GNUC_UNUSED fuse_req_t req, gboolean success,
+    G_GNUC_UNUSED size_t max_size, G_GNUC_UNUSED off_t off,
+    G_GNUC_UNUSED const char *buf, G_GNUC_UNUSED size_t buf_size,
+    gpointer ctx)
+{
+    DirTreeFillDirData *dir_fill_data = (DirTreeFillDirData *) ctx;
+
+    LOG_debug (DIR_TREE_LOG, INO_H"Background directory listing: %s", INO_T (dir_fill_data->ino), success ? "SUCCESS" : "FAILED");
+}
+
+// list stale directory, nobody waits for the result
+static void dir_tree_refresh_start (DirTree *dtree, DirEntry *en)
+{
+    DirTreeFillDirData *dir_fill_data;
+
+    if (en->dir_cache_updating)
+        return;
+
+    LOG_debug (DIR_TREE_LOG, INO_H"Directory cache is stale, refreshing it in the background", INO_T (en->ino));
+
+    dir_fill_data = g_new0 (DirTreeFillDirData, 1);
+    dir_fill_data->dtree = dtree;
+    dir_fill_data->ino = en->ino;
+    dir_fill_data->readdir_cb = dir_tree_on_refresh_read;
+    dir_fill_data->ctx = dir_fill_data;
+
+    en->dir_cache_updating = TRUE;
+
+    if (!client_pool_get_client (application_get_ops_client_pool (dtree->app), dir_tree_fill_dir_on_http_ready, dir_fill_data)) {
+        LOG_err (DIR_TREE_LOG, "Failed to get http client !");
+        en->dir_cache_updating = FALSE;
+        g_free (dir_fill_data);
+    }
+}
+
+static void dir_tree_refresh_wait (DirEntry *en, DirTreeFillDirData *dir_fill_data)
+{
+    LOG_debug (DIR_TREE_LOG, INO_H"Directory is being listed, waiting for it", INO_T (en->ino));
+    en->dir->l_dir_refresh = g_list_append (en->dir->l_dir_refresh, dir_fill_data);
+}
+
+// listing is finished, reply to all waiting requests with the same directory buffer
+static void dir_tree_refresh_done (DirEntry *en, gboolean success)
+{
+    GList *l_refresh;
+    GList *l;
+    const gchar *buf = NULL;
+    size_t buf_size = 0;
+
+    // callbacks might start a new listing
+    l_refresh = en->dir->l_dir_refresh;
+    en->dir->l_dir_refresh = NULL;
+
+    if (success && en->dir->dir_cache)
+        buf = dir_buf_get_data (en->dir->dir_cache, &buf_size);
+
+    for (l = g_list_first (l_refresh); l; l = g_list_next (l)) {
+        DirTreeFillDirData *dir_fill_data = (DirTreeFillDirData *) l->data;
+
+        if (!buf) {
+            dir_fill_data->readdir_cb (dir_fill_data->req, FALSE, dir_fill_data->size, dir_fill_data->off, NULL, 0, dir_fill_data->ctx);
+        } else if (dir_fill_data->dop) {
+            const gchar *snapshot_buf;
+            size_t snapshot_size;
+
+            if (dir_fill_data->dop->snapshot)
+                dir_buf_snapshot_unref (dir_fill_data->dop->snapshot);
+            dir_fill_data->dop->snapshot = dir_buf_get_snapshot (en->dir->dir_cache);
+            snapshot_buf = dir_buf_snapshot_get_data (dir_fill_data->dop->snapshot, &snapshot_size);
+            dir_fill_data->readdir_cb (dir_fill_data->req, TRUE, dir_fill_data->size, dir_fill_data->off,
+                snapshot_buf, snapshot_size, dir_fill_data->ctx);
+        } else {
+            dir_fill_data->readdir_cb (dir_fill_data->req, TRUE, dir_fill_data->size, dir_fill_data->off,
+                buf, buf_size, dir_fill_data->ctx);
+        }
+        g_free (dir_fill_data);
+    }
+    g_list_free (l_refresh);
+}
+/*}}}*/
+
+// callback: directory structure
+void dir_tree_fill_on_dir_buf_cb (gpointer callback_data, gboolean success)
+{
+    DirTreeFillDirData *dir_fill_data = (DirTreeFillDirData *) callback_data;
+    DirEntry *en;
+
+    en = g_hash_table_lookup (dir_fill_data->dtree->h_inodes, GUINT_TO_POINTER (dir_fill_data->ino));
+    if (!en) {
         LOG_err (DIR_TREE_LOG, INO_H"Entry not found!", INO_T (dir_fill_data->ino));
-        dir_fill_data->readdir_cb (dir_fill_data->req, FALSE, dir_fill_data->size, dir_fill_data->off, NULL, 0, dir_fill_data->ctx);
+        // waiting requests are replied when the entry is destroyed
+        if (!dir_fill_data->progressive)
+            dir_fill_data->readdir_cb (dir_fill_data->req, FALSE, dir_fill_data->size, dir_fill_data->off, NULL, 0, dir_fill_data->ctx);
         g_free (dir_fill_data);
         return;
     }
@@ -471,39 +1303,70 @@ void dir_tree_fill_on_dir_buf_cb (gpointer callback_data, gboolean success)
     LOG_debug (DIR_TREE_LOG, "[ino: %"INO_FMT" req: %p] Dir fill callback: %s",
         INO_T (dir_fill_data->ino), (void *)dir_fill_data->req, success ? "SUCCESS" : "FAILED");
 
+    // directory is still being listed, return entries received so far
+    if (en->dir_cache_progressive && !dir_fill_data->progressive) {
+        const gchar *buf;
+        size_t buf_size;
+
+        buf = dir_buf_get_data (en->dir->dir_cache, &buf_size);
+        dir_fill_data->readdir_cb (dir_fill_data->req, TRUE, dir_fill_data->size, dir_fill_data->off,
+            buf, buf_size, dir_fill_data->ctx);
+        g_free (dir_fill_data);
+        return;
+    }
+
     en->dir_cache_updating = FALSE;
     // directory is updated
     en->is_modified = FALSE;
 
+    // handles which read the directory during listing keep their offsets
+    if (dir_fill_data->progressive && en->dir_cache_progressive)
+        dir_tree_progressive_done (en, success);
+
     if (!success) {
         LOG_debug (DIR_TREE_LOG, INO_H"Failed to fill directory listing !", INO_T (dir_fill_data->ino));
-        dir_fill_data->readdir_cb (dir_fill_data->req, FALSE, dir_fill_data->size, dir_fill_data->off, NULL, 0, dir_fill_data->ctx);
+        if (!dir_fill_data->progressive)
+            dir_fill_data->readdir_cb (dir_fill_data->req, FALSE, dir_fill_data->size, dir_fill_data->off, NULL, 0, dir_fill_data->ctx);
     } else {
-        struct dirbuf b; // directory buffer
         GHashTableIter iter;
         gpointer value;
         DirEntry *parent_en;
         guint32 items = 0;
-
-        // construct directory buffer
-        // add "." and ".."
-        memset (&b, 0, sizeof(b));
-        rfuse_add_dirbuf (dir_fill_data->req, &b, ".", dir_fill_data->ino, 0);
-        rfuse_add_dirbuf (dir_fill_data->req, &b, "..", dir_fill_data->ino, 0);
+        guint added = 0;
+        guint removed;
+        const gchar *buf;
+        size_t buf_size;
 
         parent_en = g_hash_table_lookup (dir_fill_data->dtree->h_inodes, GUINT_TO_POINTER (dir_fill_data->ino));
         if (!parent_en) {
             LOG_err (DIR_TREE_LOG, INO_H"Parent not found !", INO_T (dir_fill_data->ino));
-            dir_fill_data->readdir_cb (dir_fill_data->req, FALSE, dir_fill_data->size, dir_fill_data->off,
-                NULL, 0, dir_fill_data->ctx);
+            if (!dir_fill_data->progressive)
+                dir_fill_data->readdir_cb (dir_fill_data->req, FALSE, dir_fill_data->size, dir_fill_data->off,
+                    NULL, 0, dir_fill_data->ctx);
             g_free (dir_fill_data);
             return;
         }
 
-        LOG_debug (DIR_TREE_LOG, INO_H"Total entries in directory: %u", INO_T (dir_fill_data->ino), g_hash_table_size (en->h_dir_tree));
+        LOG_debug (DIR_TREE_LOG, INO_H"Total entries in directory: %u", INO_T (dir_fill_data->ino), g_hash_table_size (en->dir->h_dir_tree));
+
+        // construct directory buffer, allocate exactly the required size
+        if (!en->dir->dir_cache) {
+            size_t size_hint = 0;
+
+            g_hash_table_iter_init (&iter, en->dir->h_dir_tree);
+            while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                DirEntry *tmp_en = (DirEntry *) value;
 
-        // get all directory items
-        g_hash_table_iter_init (&iter, en->h_dir_tree);
+                if (tmp_en->age >= parent_en->age && !tmp_en->removed)
+                    size_hint += dir_buf_entry_size (tmp_en->basename);
+            }
+            en->dir->dir_cache = dir_buf_create (dir_fill_data->ino, size_hint);
+        }
+
+        // synchronize directory buffer with directory items:
+        // append new entries, drop entries which are no longer in the directory
+        dir_buf_mark_begin (en->dir->dir_cache);
+        g_hash_table_iter_init (&iter, en->dir->h_dir_tree);
         while (g_hash_table_iter_next (&iter, NULL, &value)) {
             DirEntry *tmp_en = (DirEntry *) value;
 
@@ -511,44 +1374,58 @@ void dir_tree_fill_on_dir_buf_cb (gpointer callback_data, gboolean success)
             // 1) updated entries
             // 2) which are not "removed"
             if (tmp_en->age >= parent_en->age && !tmp_en->removed) {
-                rfuse_add_dirbuf (dir_fill_data->req, &b, tmp_en->basename, tmp_en->ino, tmp_en->size);
+                if (!dir_buf_mark (en->dir->dir_cache, tmp_en->basename, tmp_en->ino, tmp_en->mode)) {
+                    dir_buf_add (en->dir->dir_cache, tmp_en->basename, tmp_en->ino, tmp_en->mode);
+                    added++;
+                }
                 items++;
             } else {
                 LOG_debug (DIR_TREE_LOG, INO_H"Entry %s is removed from directory listing!",
                     INO_T (tmp_en->ino), tmp_en->basename);
             }
         }
+        removed = dir_buf_sweep (en->dir->dir_cache);
+        en->dir_cache_dirty = FALSE;
+
+        // directories which don't change get longer kernel cache timeouts
+        if (dir_fill_data->listed) {
+            if (en->dir_changed || added || removed)
+                en->dir_stable = 0;
+            else if (en->dir_stable < DIR_STABLE_MAX)
+                en->dir_stable++;
+        }
+
+        buf = dir_buf_get_data (en->dir->dir_cache, &buf_size);
 
-        // 1. Update directory cache
-        if (en->dir_cache)
-            g_free (en->dir_cache);
-        en->dir_cache_size = b.size;
-        en->dir_cache = g_malloc0 (b.size);
-        memcpy (en->dir_cache, b.p, b.size);
-
-        // 2. Update request buffer
-        if (dir_fill_data->dop) {
-            if (dir_fill_data->dop->buf)
-                g_free (dir_fill_data->dop->buf);
-            dir_fill_data->dop->size = b.size;
-            dir_fill_data->dop->buf = g_malloc0 (b.size);
-            memcpy (dir_fill_data->dop->buf, b.p, b.size);
+        // Update request buffer
+        if (dir_fill_data->progressive) {
+            LOG_debug (DIR_TREE_LOG, INO_H"Directory was read during listing.", INO_T (dir_fill_data->ino));
+        } else if (dir_fill_data->dop) {
+            if (dir_fill_data->dop->snapshot)
+                dir_buf_snapshot_unref (dir_fill_data->dop->snapshot);
+            dir_fill_data->dop->snapshot = dir_buf_get_snapshot (en->dir->dir_cache);
         } else {
             LOG_debug (DIR_TREE_LOG, INO_H"Dir data is not set (lookup request).", INO_T (dir_fill_data->ino));
         }
 
-        en->dir_cache_created = time (NULL);
+        en->dir->dir_cache_created = time (NULL);
 
         // send buffer to fuse
-        dir_fill_data->readdir_cb (dir_fill_data->req, TRUE,
-            dir_fill_data->size, dir_fill_data->off,
-            en->dir_cache, en->dir_cache_size,
-            dir_fill_data->ctx);
-
-        //free buffer
-        g_free (b.p);
+        if (!dir_fill_data->progressive)
+            dir_fill_data->readdir_cb (dir_fill_data->req, TRUE,
+                dir_fill_data->size, dir_fill_data->off,
+                buf, buf_size,
+                dir_fill_data->ctx);
+
+        LOG_debug (DIR_TREE_LOG, INO_H"Dir cache synchronized, added: %u, removed: %u", INO_T (dir_fill_data->ino), added, removed);
+        LOG_debug (DIR_TREE_LOG, INO_H"Dir cache updated: %u, items: %u", INO_T (dir_fill_data->ino), (guint)en->dir->dir_cache_created, items);
+    }
 
-        LOG_debug (DIR_TREE_LOG, INO_H"Dir cache updated: %u, items: %u", INO_T (dir_fill_data->ino), (guint)en->dir_cache_created, items);
+    // requests which arrived during the listing get the same result
+    if (dir_fill_data->listed) {
+        en = g_hash_table_lookup (dir_fill_data->dtree->h_inodes, GUINT_TO_POINTER (dir_fill_data->ino));
+        if (en && en->dir->l_dir_refresh)
+            dir_tree_refresh_done (en, success);
     }
 
     g_free (dir_fill_data);
@@ -563,7 +1440,8 @@ static void dir_tree_fill_dir_on_http_ready (gpointer client, gpointer ctx)
     en = g_hash_table_lookup (dir_fill_data->dtree->h_inodes, GUINT_TO_POINTER (dir_fill_data->ino));
     if (!en) {
         LOG_err (DIR_TREE_LOG, INO_H"Entry not found!", INO_T (dir_fill_data->ino));
-        dir_fill_data->readdir_cb (dir_fill_data->req, FALSE, dir_fill_data->size, dir_fill_data->off, NULL, 0, dir_fill_data->ctx);
+        if (!dir_fill_data->progressive)
+            dir_fill_data->readdir_cb (dir_fill_data->req, FALSE, dir_fill_data->size, dir_fill_data->off, NULL, 0, dir_fill_data->ctx);
         g_free (dir_fill_data);
         return;
     }
@@ -571,16 +1449,19 @@ static void dir_tree_fill_dir_on_http_ready (gpointer client, gpointer ctx)
     en = g_hash_table_lookup (dir_fill_data->dtree->h_inodes, GUINT_TO_POINTER (dir_fill_data->ino));
     if (!en) {
         LOG_err (DIR_TREE_LOG, INO_H"Entry not found!", INO_T (dir_fill_data->ino));
-        dir_fill_data->readdir_cb (dir_fill_data->req, FALSE, dir_fill_data->size, dir_fill_data->off, NULL, 0, dir_fill_data->ctx);
+        if (!dir_fill_data->progressive)
+            dir_fill_data->readdir_cb (dir_fill_data->req, FALSE, dir_fill_data->size, dir_fill_data->off, NULL, 0, dir_fill_data->ctx);
         g_free (dir_fill_data);
         return;
     }
 
     // increase directory "age"
     dir_tree_start_update (en, NULL);
+    dir_fill_data->listed = TRUE;
     //send http request
     http_connection_get_directory_listing (con,
-        en->fullpath, dir_fill_data->ino,
+        en->dir->fullpath, dir_fill_data->ino,
+        dir_fill_data->progressive ? dir_tree_progressive_on_page_cb : NULL,
         dir_tree_fill_on_dir_buf_cb, dir_fill_data
     );
 }
@@ -595,22 +1476,29 @@ gboolean dir_tree_opendir (DirTree *dtree, fuse_ino_t ino, struct fuse_file_info
     }
 
     dop = g_new0 (DirOpData, 1);
-    dop->buf = NULL;
-    dop->size = 0;
+    dop->snapshot = NULL;
+    dop->ino = ino;
+    dop->progressive = FALSE;
 
     fi->fh = convert_ptr_to_fh (dop);
 
     return TRUE;
 }
 
-gboolean dir_tree_releasedir (G_GNUC_UNUSED DirTree *dtree, G_GNUC_UNUSED fuse_ino_t ino, struct fuse_file_info *fi)
+gboolean dir_tree_releasedir (DirTree *dtree, G_GNUC_UNUSED fuse_ino_t ino, struct fuse_file_info *fi)
 {
     DirOpData *dop;
+    DirEntry *en;
 
     dop = convert_fh_to_ptr (fi->fh);
     if (dop) {
-        if (dop->buf)
-            g_free (dop->buf);
+        if (dop->progressive) {
+            en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (dop->ino));
+            if (en)
+                en->dir->l_dir_readers = g_list_remove (en->dir->l_dir_readers, dop);
+        }
+        if (dop->snapshot)
+            dir_buf_snapshot_unref (dop->snapshot);
         g_free (dop);
     }
 
@@ -640,56 +1528,73 @@ void dir_tree_fill_dir_buf (DirTree *dtree,
         return;
     }
 
+    // directory is read from the beginning
+    if (off == 0)
+        dir_tree_entry_touch (dtree, en);
+
     // get request structure
     if (fi && fi->fh) {
         dop = convert_fh_to_ptr (fi->fh);
     }
 
     // if request buffer is set - return it right away
-    if (dop && dop->buf) {
+    if (dop && dop->snapshot) {
+        const gchar *buf;
+        size_t buf_size;
+
         LOG_debug (DIR_TREE_LOG, INO_H"Returning request cache ..", INO_T (ino));
-        readdir_cb (req, TRUE, size, off, dop->buf, dop->size, ctx);
+        buf = dir_buf_snapshot_get_data (dop->snapshot, &buf_size);
+        readdir_cb (req, TRUE, size, off, buf, buf_size, ctx);
         return;
     }
 
+    // directory is being listed, return entries which are already received
+    if (dop && en->dir_cache_progressive && (dop->progressive || off == 0)) {
+        if (!dop->progressive) {
+            dop->progressive = TRUE;
+            en->dir->l_dir_readers = g_list_prepend (en->dir->l_dir_readers, dop);
+        }
+        dir_tree_progressive_readdir (en, size, off, readdir_cb, req, ctx);
+        return;
+    }
+
+    // stale cache is returned right away, only one background listing is sent
+    if (dir_tree_is_cache_stale (dtree, en)) {
+        dtree->stale_hits++;
+        dir_tree_refresh_start (dtree, en);
+    }
+
     // already have directory buffer in the cache
-    if (!dir_tree_is_cache_expired (dtree, en)) {
+    if (!dir_tree_is_cache_expired (dtree, en) || dir_tree_is_cache_stale (dtree, en)) {
         LOG_debug (DIR_TREE_LOG, INO_H"Sending directory buffer from cache !", INO_T (ino));
 
         // Fuse request
         if (dop) {
-            // cache is empty
-            if (!dop->buf) {
-                dop->buf = g_malloc0 (en->dir_cache_size);
-                dop->size = en->dir_cache_size;
-                memcpy (dop->buf, en->dir_cache, en->dir_cache_size);
-            }
-            readdir_cb (req, TRUE, size, off, dop->buf, dop->size, ctx);
-        } else
-            readdir_cb (req, TRUE, size, off, en->dir_cache, en->dir_cache_size, ctx);
+            const gchar *buf;
+            size_t buf_size;
+
+            // all handles opened before the directory is changed share the same snapshot
+            dop->snapshot = dir_buf_get_snapshot (en->dir->dir_cache);
+            buf = dir_buf_snapshot_get_data (dop->snapshot, &buf_size);
+            readdir_cb (req, TRUE, size, off, buf, buf_size, ctx);
+        } else {
+            const gchar *buf;
+            size_t buf_size;
+
+            buf = dir_buf_get_data (en->dir->dir_cache, &buf_size);
+            readdir_cb (req, TRUE, size, off, buf, buf_size, ctx);
+        }
         return;
     }
 
     // make sure that subsequent requests return the same directory structure
     if (off > 0) {
-        // must be set !
-        if (!dop || !dop->buf) {
-            LOG_err (DIR_TREE_LOG, INO_H"Dir cache is not set !", INO_T (ino));
-            readdir_cb (req, FALSE, size, off, NULL, 0, ctx);
-            return;
-        }
-        LOG_debug (DIR_TREE_LOG, INO_H"Sending directory buffer from cache !", INO_T (ino));
-        readdir_cb (req, TRUE, size, off, dop->buf, dop->size, ctx);
+        // must be set, handle's snapshot is returned above !
+        LOG_err (DIR_TREE_LOG, INO_H"Dir cache is not set !", INO_T (ino));
+        readdir_cb (req, FALSE, size, off, NULL, 0, ctx);
         return;
     }
 
-    // reset dir cache
-    if (en->dir_cache)
-        g_free (en->dir_cache);
-    en->dir_cache = NULL;
-    en->dir_cache_size = 0;
-    //en->dir_cache_created = 0;
-
     dir_fill_data = g_new0 (DirTreeFillDirData, 1);
     dir_fill_data->dtree = dtree;
     dir_fill_data->ino = ino;
@@ -700,20 +1605,37 @@ void dir_tree_fill_dir_buf (DirTree *dtree,
     dir_fill_data->ctx = ctx;
     dir_fill_data->dop = dop;
 
-    // if no request is being sent
-    // and it's new or expired
-    if (!en->dir_cache_updating &&
-        (!en->dir_cache_created ||
-        time (NULL) - en->dir_cache_created >
-        (time_t)conf_get_uint (application_get_conf (dtree->app), "filesystem.dir_cache_max_time")))
+    // listing is already sent, reply when it's finished
+    if (en->dir_cache_updating) {
+        dir_tree_refresh_wait (en, dir_fill_data);
+        return;
+    }
+
+    // it's new or expired
+    if (!en->dir->dir_cache_created ||
+        time (NULL) - en->dir->dir_cache_created >
+        (time_t)conf_get_uint (application_get_conf (dtree->app), "filesystem.dir_cache_max_time"))
     {
         LOG_debug (DIR_TREE_LOG, INO_H"Directory cache is expired, getting a fresh list from the server !", INO_T (en->ino));
 
         en->dir_cache_updating = TRUE;
 
+        // the first listing of directory: reply as soon as the first page is received
+        if (dop && !en->dir->dir_cache) {
+            en->dir->dir_cache = dir_buf_create (ino, 0);
+            en->dir_cache_progressive = TRUE;
+            dop->progressive = TRUE;
+            en->dir->l_dir_readers = g_list_prepend (en->dir->l_dir_readers, dop);
+            dir_tree_progressive_readdir (en, size, off, readdir_cb, req, ctx);
+            dir_fill_data->progressive = TRUE;
+        }
+
         if (!client_pool_get_client (application_get_ops_client_pool (dtree->app), dir_tree_fill_dir_on_http_ready, dir_fill_data)) {
             LOG_err (DIR_TREE_LOG, "Failed to get http client !");
-            readdir_cb (req, FALSE, size, off, NULL, 0, ctx);
+            if (dir_fill_data->progressive)
+                dir_tree_progressive_done (en, FALSE);
+            else
+                readdir_cb (req, FALSE, size, off, NULL, 0, ctx);
             en->dir_cache_updating = FALSE;
             g_free (dir_fill_data);
         }
@@ -724,8 +1646,116 @@ void dir_tree_fill_dir_buf (DirTree *dtree,
 }
 /*}}}*/
 
+/*{{{ negative lookup cache */
+// names which were looked up, but don't exist on the server
+
+static gchar *dir_tree_negative_key (fuse_ino_t parent_ino, const gchar *name)
+{
+    return g_strdup_printf ("%"INO_FMT"/%s", INO parent_ino, name);
+}
+
+static void dir_tree_negative_remove (DirTree *dtree, fuse_ino_t parent_ino, const gchar *name)
+{
+    DirTreeNegativeEntry *neg_en;
+    gchar *key;
+
+    if (!g_hash_table_size (dtree->h_negative))
+        return;
+
+    key = dir_tree_negative_key (parent_ino, name);
+    neg_en = g_hash_table_lookup (dtree->h_negative, key);
+    if (neg_en) {
+        g_queue_delete_link (dtree->q_negative, neg_en->link);
+        g_hash_table_remove (dtree->h_negative, key);
+    }
+    g_free (key);
+}
+
+static void dir_tree_negative_add (DirTree *dtree, fuse_ino_t parent_ino, const gchar *name)
+{
+    DirTreeNegativeEntry *neg_en;
+    gchar *key;
+
+    if (!dtree->negative_ttl || !dtree->negative_max_entries)
+        return;
+
+    dir_tree_negative_remove (dtree, parent_ino, name);
+
+    // all entries have the same TTL, the oldest one expires first
+    while (g_hash_table_size (dtree->h_negative) >= dtree->negative_max_entries) {
+        key = g_queue_pop_head (dtree->q_negative);
+        g_hash_table_remove (dtree->h_negative, key);
+    }
+
+    key = dir_tree_negative_key (parent_ino, name);
+    neg_en = g_new0 (DirTreeNegativeEntry, 1);
+    neg_en->created = time (NULL);
+    g_queue_push_tail (dtree->q_negative, key);
+    neg_en->link = g_queue_peek_tail_link (dtree->q_negative);
+    g_hash_table_insert (dtree->h_negative, key, neg_en);
+}
+
+// return TRUE if name is known to be missing
+static gboolean dir_tree_negative_lookup (DirTree *dtree, fuse_ino_t parent_ino, const gchar *name)
+{
+    DirTreeNegativeEntry *neg_en;
+    gchar *key;
+    time_t t;
+
+    if (!g_hash_table_size (dtree->h_negative))
+        return FALSE;
+
+    key = dir_tree_negative_key (parent_ino, name);
+    neg_en = g_hash_table_lookup (dtree->h_negative, key);
+    g_free (key);
+    if (!neg_en)
+        return FALSE;
+
+    t = time (NULL);
+    if (t < neg_en->created || t - neg_en->created >= (time_t) dtree->negative_ttl) {
+        dir_tree_negative_remove (dtree, parent_ino, name);
+        return FALSE;
+    }
+
+    dtree->negative_hits++;
+    return TRUE;
+}
+
+void dir_tree_get_negative_cache_stats (DirTree *dtree, guint32 *entries, guint64 *hits)
+{
+    *entries = g_hash_table_size (dtree->h_negative);
+    *hits = dtree->negative_hits;
+}
+/*}}}*/
+
 /*{{{ dir_tree_lookup */
 
+// mode and creation time are stored in the object metadata, returned by HEAD and GET requests
+static void dir_tree_entry_update_meta (DirEntry *en, struct evkeyvalq *headers)
+{
+    const gchar *mode_str;
+    const gchar *time_str;
+
+    mode_str = http_find_header (headers, "x-amz-meta-mode");
+    if (mode_str) {
+        gint32 val;
+        val = strtol ((char *)mode_str, NULL, 10);
+        if (val > 0) {
+            en->mode = val;
+        }
+    }
+
+    time_str = http_find_header (headers, "x-amz-meta-date");
+    if (time_str) {
+        struct tm tmp;
+        LOG_debug (DIR_TREE_LOG, INO_H"Creation time: %s", INO_T (en->ino), time_str);
+        if (strptime (time_str, "%a, %d %b %Y %H:%M:%S %Z", &tmp) ||
+            strptime (time_str, "%a, %d %b %Y %H:%M:%S %z", &tmp)) {
+            en->ctime = timegm (&tmp);
+        }
+    }
+}
+
 typedef struct {
     DirTree *dtree;
     dir_tree_lookup_cb lookup_cb;
@@ -745,8 +1775,6 @@ static void dir_tree_on_lookup_cb (HttpConnection *con, void *ctx, gboolean succ
     const gchar *size_header;
     const gchar *content_type;
     DirEntry  *en;
-    const gchar *mode_str;
-    const gchar *time_str;
 
     LOG_debug (DIR_TREE_LOG, INO_H"Got attributes", INO_T (op_data->ino));
 
@@ -787,40 +1815,17 @@ static void dir_tree_on_lookup_cb (HttpConnection *con, void *ctx, gboolean succ
     // check if this is a directory
     content_type = http_find_header (headers, "Content-Type");
     if (content_type && !strncmp ((const char *)content_type, "application/x-directory", strlen ("application/x-directory"))) {
-        en->type = DET_dir;
+        dir_tree_entry_set_dir (op_data->dtree, en);
         en->mode = op_data->dtree->dmode;
 
-        if (!en->h_dir_tree)
-            en->h_dir_tree = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, dir_entry_destroy);
-
-        if (en->dir_cache)
-            g_free (en->dir_cache);
-        en->dir_cache = NULL;
-        en->dir_cache_size = 0;
-        //en->dir_cache_created = 0;
+        if (en->dir->dir_cache)
+            dir_buf_destroy (en->dir->dir_cache);
+        en->dir->dir_cache = NULL;
 
-        LOG_debug (DIR_TREE_LOG, INO_H"Converting to directory: %s", INO_T (en->ino), en->fullpath);
+        LOG_debug (DIR_TREE_LOG, INO_H"Converting to directory: %s", INO_T (en->ino), en->dir->fullpath);
     }
 
-    mode_str = http_find_header (headers, "x-amz-meta-mode");
-    if (mode_str) {
-        gint32 val;
-        val = strtol ((char *)mode_str, NULL, 10);
-        if (val > 0) {
-            en->mode = val;
-        }
-        LOG_debug (DIR_TREE_LOG, "XXXXXXXXXXXXXXXXXX: %d", val);
-    }
-
-    time_str = http_find_header (headers, "x-amz-meta-date");
-    if (time_str) {
-        struct tm tmp;
-        LOG_debug (DIR_TREE_LOG, INO_H"Creation time: %s", INO_T (en->ino), time_str);
-        if (strptime (time_str, "%a, %d %b %Y %H:%M:%S %Z", &tmp) ||
-            strptime (time_str, "%a, %d %b %Y %H:%M:%S %z", &tmp)) {
-            en->ctime = timegm (&tmp);
-        }
-    }
+    dir_tree_entry_update_meta (en, headers);
 
     en->is_updating = FALSE;
     en->updated_time = time (NULL);
@@ -848,7 +1853,7 @@ static void dir_tree_on_lookup_con_cb (gpointer client, gpointer ctx)
 
     http_connection_acquire (con);
 
-    req_path = g_strdup_printf ("/%s", en->fullpath);
+    req_path = dir_tree_entry_get_req_path (op_data->dtree, en);
 
     res = http_connection_make_request (con,
         req_path, "HEAD", NULL, FALSE, NULL,
@@ -899,15 +1904,8 @@ static void dir_tree_on_lookup_not_found_cb (HttpConnection *con, void *ctx, gbo
     if (!success) {
         LOG_debug (DIR_TREE_LOG, INO_H"Entry not found %s", INO_T (op_data->ino), op_data->name);
 
-        // create a temporary entry to hold this object
-        // this is required to avoid further HEAD requests
-        en = dir_tree_add_entry (op_data->dtree, op_data->name, op_data->dtree->fmode, DET_file, op_data->parent_ino, 0, time (NULL));
-        if (!en) {
-            LOG_err (DIR_TREE_LOG, INO_H"Failed to create file: %s !", INO_T (op_data->ino), op_data->name);
-        } else {
-            // set as removed
-            en->removed = TRUE;
-        }
+        // remember missing name to avoid further HEAD requests
+        dir_tree_negative_add (op_data->dtree, op_data->parent_ino, op_data->name);
 
         op_data->lookup_cb (op_data->req, FALSE, 0, 0, 0, 0);
         g_free (op_data->name);
@@ -933,8 +1931,8 @@ static void dir_tree_on_lookup_not_found_cb (HttpConnection *con, void *ctx, gbo
             last_modified = mktime (&tmp);
     }
 
-    en = dir_tree_update_entry (op_data->dtree, parent_en->fullpath, DET_file,
-        op_data->parent_ino, op_data->name, size, last_modified);
+    en = dir_tree_update_entry (op_data->dtree, parent_en->dir->fullpath, DET_file,
+        op_data->parent_ino, op_data->name, size, last_modified, NULL);
 
     if (!en) {
         LOG_err (DIR_TREE_LOG, INO_H"Failed to create FileEntry parent ino: %"INO_FMT" !",
@@ -978,54 +1976,359 @@ static void dir_tree_on_lookup_not_found_con_cb (gpointer client, gpointer ctx)
     if (op_data->parent_ino == FUSE_ROOT_ID)
         fullpath = g_strdup_printf ("%s", op_data->name);
     else
-        fullpath = g_strdup_printf ("%s/%s", parent_en->fullpath, op_data->name);
+        fullpath = g_strdup_printf ("%s/%s", parent_en->dir->fullpath, op_data->name);
 
     req_path = g_strdup_printf ("/%s", fullpath);
 
     g_free (fullpath);
 
-    res = http_connection_make_request (con,
-        req_path, "HEAD", NULL, FALSE, NULL,
-        dir_tree_on_lookup_not_found_cb,
-        op_data
-    );
+    res = http_connection_make_request (con,
+        req_path, "HEAD", NULL, FALSE, NULL,
+        dir_tree_on_lookup_not_found_cb,
+        op_data
+    );
+
+    g_free (req_path);
+
+    if (!res) {
+        LOG_err (DIR_TREE_LOG, "Failed to create http request !");
+        http_connection_release (con);
+        op_data->lookup_cb (op_data->req, FALSE, 0, 0, 0, 0);
+        g_free (op_data->name);
+        g_free (op_data);
+        return;
+    }
+}
+
+/*{{{ targeted lookup */
+// directory cache is expired: instead of listing the whole directory, only the requested name is checked on the server.
+// HEAD request for "name" object and listing of "name/" prefix (one key) are sent in parallel
+
+typedef struct {
+    DirTree *dtree;
+    dir_tree_lookup_cb lookup_cb;
+    fuse_req_t req;
+    fuse_ino_t parent_ino;
+    gchar *name;
+    gchar *path; // object path, without the leading '/'
+
+    gint pending; // number of requests which are not finished
+    struct evkeyvalq *head_headers; // copy of HEAD response headers, NULL if object doesn't exist
+    gboolean list_success; // "name/" prefix was listed
+    gboolean prefix_found; // "name/" prefix exists, it's a directory
+} LookupTargetData;
+
+static void dir_tree_lookup_target_free (LookupTargetData *tdata)
+{
+    if (tdata->head_headers) {
+        evhttp_clear_headers (tdata->head_headers);
+        g_free (tdata->head_headers);
+    }
+    g_free (tdata->name);
+    g_free (tdata->path);
+    g_free (tdata);
+}
+
+// both requests are finished, update the entry and return its attributes
+static void dir_tree_lookup_target_done (LookupTargetData *tdata)
+{
+    DirTree *dtree = tdata->dtree;
+    DirEntry *parent_en;
+    DirEntry *en;
+    const gchar *content_type = NULL;
+
+    tdata->pending--;
+    if (tdata->pending > 0)
+        return;
+
+    parent_en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (tdata->parent_ino));
+    if (!parent_en || parent_en->type != DET_dir) {
+        LOG_debug (DIR_TREE_LOG, INO_H"Directory not found !", INO_T (tdata->parent_ino));
+        tdata->lookup_cb (tdata->req, FALSE, 0, 0, 0, 0);
+        dir_tree_lookup_target_free (tdata);
+        return;
+    }
+
+    en = g_hash_table_lookup (parent_en->dir->h_dir_tree, tdata->name);
+
+    // entry was changed locally while requests were sent
+    if (en && en->is_modified) {
+        dir_tree_lookup_entry (dtree, tdata->parent_ino, tdata->name, tdata->lookup_cb, tdata->req, FALSE);
+        dir_tree_lookup_target_free (tdata);
+        return;
+    }
+
+    if (tdata->head_headers)
+        content_type = http_find_header (tdata->head_headers, "Content-Type");
+
+    if (tdata->prefix_found ||
+        (content_type && !strncmp (content_type, "application/x-directory", strlen ("application/x-directory")))) {
+
+        LOG_debug (DIR_TREE_LOG, INO_H"Directory %s found", INO_T (tdata->parent_ino), tdata->name);
+
+        en = dir_tree_update_entry (dtree, parent_en->dir->fullpath, DET_dir,
+            tdata->parent_ino, tdata->name, 0, time (NULL), NULL);
+        if (en)
+            en->updated_time = time (NULL);
+
+    } else if (tdata->head_headers) {
+        const gchar *size_header;
+        const gchar *last_modified_header;
+        gint64 size = 0;
+        time_t last_modified = time (NULL);
+
+        LOG_debug (DIR_TREE_LOG, INO_H"File %s found", INO_T (tdata->parent_ino), tdata->name);
+
+        size_header = http_find_header (tdata->head_headers, "Content-Length");
+        if (size_header) {
+            size = strtoll (size_header, NULL, 10);
+            if (size < 0) {
+                LOG_err (DIR_TREE_LOG, INO_H"Header contains incorrect file size!", INO_T (tdata->parent_ino));
+                size = 0;
+            }
+        }
+
+        last_modified_header = http_find_header (tdata->head_headers, "Last-Modified");
+        if (last_modified_header) {
+            struct tm tmp = {0};
+            // Sun, 1 Jan 2006 12:00:00
+            if (strptime (last_modified_header, "%a, %d %b %Y %H:%M:%S", &tmp))
+                last_modified = mktime (&tmp);
+        }
+
+        en = dir_tree_update_entry (dtree, parent_en->dir->fullpath, DET_file,
+            tdata->parent_ino, tdata->name, size, last_modified, http_find_header (tdata->head_headers, "ETag"));
+
+        // HEAD response contains all file attributes, lookup doesn't need another one
+        if (en && en->type == DET_file) {
+            dir_tree_entry_update_xattrs (en, tdata->head_headers);
+            dir_tree_entry_update_meta (en, tdata->head_headers);
+            en->updated_time = time (NULL);
+        }
+
+    } else {
+        LOG_debug (DIR_TREE_LOG, INO_H"Entry not found %s", INO_T (tdata->parent_ino), tdata->name);
+
+        // entry is removed from the tree by the next listing
+        if (en)
+            dir_tree_notify_inval_entry (dtree, en);
+
+        // HEAD request fails for any error, the listing tells that the name doesn't exist
+        if (tdata->list_success)
+            dir_tree_negative_add (dtree, tdata->parent_ino, tdata->name);
+
+        tdata->lookup_cb (tdata->req, FALSE, 0, 0, 0, 0);
+        dir_tree_lookup_target_free (tdata);
+        return;
+    }
+
+    if (!en) {
+        LOG_err (DIR_TREE_LOG, INO_H"Failed to create entry %s !", INO_T (tdata->parent_ino), tdata->name);
+        tdata->lookup_cb (tdata->req, FALSE, 0, 0, 0, 0);
+        dir_tree_lookup_target_free (tdata);
+        return;
+    }
+
+    // entry is up to date, don't check the directory cache again
+    dir_tree_lookup_entry (dtree, tdata->parent_ino, tdata->name, tdata->lookup_cb, tdata->req, FALSE);
+    dir_tree_lookup_target_free (tdata);
+}
+
+static void dir_tree_lookup_target_on_head_cb (HttpConnection *con, void *ctx, gboolean success,
+    G_GNUC_UNUSED const gchar *buf, G_GNUC_UNUSED size_t buf_len,
+    struct evkeyvalq *headers)
+{
+    LookupTargetData *tdata = (LookupTargetData *) ctx;
+
+    // release HttpConnection
+    http_connection_release (con);
+
+    // headers are freed after the callback returns
+    if (success && headers) {
+        struct evkeyval *header;
+
+        tdata->head_headers = g_new0 (struct evkeyvalq, 1);
+        TAILQ_INIT (tdata->head_headers);
+        TAILQ_FOREACH (header, headers, next) {
+            evhttp_add_header (tdata->head_headers, header->key, header->value);
+        }
+    }
+
+    dir_tree_lookup_target_done (tdata);
+}
+
+static void dir_tree_lookup_target_on_head_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    LookupTargetData *tdata = (LookupTargetData *) ctx;
+    gchar *req_path;
+    gboolean res;
+
+    http_connection_acquire (con);
+
+    req_path = g_strdup_printf ("/%s", tdata->path);
+
+    res = http_connection_make_request (con,
+        req_path, "HEAD", NULL, FALSE, NULL,
+        dir_tree_lookup_target_on_head_cb,
+        tdata
+    );
+
+    g_free (req_path);
+
+    if (!res) {
+        LOG_err (DIR_TREE_LOG, "Failed to create http request !");
+        http_connection_release (con);
+        dir_tree_lookup_target_done (tdata);
+    }
+}
+
+static void dir_tree_lookup_target_on_list_entry (gpointer ctx, G_GNUC_UNUSED const gchar *key,
+    G_GNUC_UNUSED gboolean is_prefix, G_GNUC_UNUSED gint64 size, G_GNUC_UNUSED time_t last_modified,
+    G_GNUC_UNUSED const gchar *etag)
+{
+    LookupTargetData *tdata = (LookupTargetData *) ctx;
+
+    // any key or prefix which starts with "name/"
+    tdata->prefix_found = TRUE;
+}
+
+static void dir_tree_lookup_target_on_list_cb (HttpConnection *con, void *ctx, gboolean success,
+    const gchar *buf, size_t buf_len,
+    G_GNUC_UNUSED struct evkeyvalq *headers)
+{
+    LookupTargetData *tdata = (LookupTargetData *) ctx;
+    ListParserResult result;
+
+    // release HttpConnection
+    http_connection_release (con);
+
+    if (success && buf) {
+        tdata->list_success = list_parser_parse (buf, buf_len, dir_tree_lookup_target_on_list_entry, tdata, &result);
+        if (tdata->list_success)
+            list_parser_result_clear (&result);
+        else
+            LOG_err (DIR_TREE_LOG, INO_H"Failed to parse listing of %s/ !", INO_T (tdata->parent_ino), tdata->path);
+    }
+
+    dir_tree_lookup_target_done (tdata);
+}
+
+static void dir_tree_lookup_target_on_list_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    LookupTargetData *tdata = (LookupTargetData *) ctx;
+    gchar *req_path;
+    gboolean res;
+
+    http_connection_acquire (con);
+
+    req_path = g_strdup_printf ("/?delimiter=/&max-keys=1&prefix=%s/", tdata->path);
+
+    res = http_connection_make_request (con,
+        req_path, "GET", NULL, TRUE, NULL,
+        dir_tree_lookup_target_on_list_cb,
+        tdata
+    );
+
+    g_free (req_path);
+
+    if (!res) {
+        LOG_err (DIR_TREE_LOG, "Failed to create http request !");
+        http_connection_release (con);
+        dir_tree_lookup_target_done (tdata);
+    }
+}
+
+static void dir_tree_lookup_target (DirTree *dtree, DirEntry *dir_en, const char *name,
+    dir_tree_lookup_cb lookup_cb, fuse_req_t req)
+{
+    LookupTargetData *tdata;
+
+    tdata = g_new0 (LookupTargetData, 1);
+    tdata->dtree = dtree;
+    tdata->lookup_cb = lookup_cb;
+    tdata->req = req;
+    tdata->parent_ino = dir_en->ino;
+    tdata->name = g_strdup (name);
+    if (dir_en->ino == FUSE_ROOT_ID)
+        tdata->path = g_strdup (name);
+    else
+        tdata->path = g_strdup_printf ("%s/%s", dir_en->dir->fullpath, name);
+    // one reference is held till both requests are sent
+    tdata->pending = 3;
+
+    LOG_debug (DIR_TREE_LOG, INO_H"Checking entry %s on the server ..", INO_T (dir_en->ino), name);
+
+    if (!client_pool_get_client (application_get_ops_client_pool (dtree->app),
+        dir_tree_lookup_target_on_head_con_cb, tdata))
+    {
+        LOG_err (DIR_TREE_LOG, "Failed to get http client !");
+        tdata->pending--;
+    }
+
+    if (!client_pool_get_client (application_get_ops_client_pool (dtree->app),
+        dir_tree_lookup_target_on_list_con_cb, tdata))
+    {
+        LOG_err (DIR_TREE_LOG, "Failed to get http client !");
+        tdata->pending--;
+    }
+
+    dir_tree_lookup_target_done (tdata);
+}
+/*}}}*/
+
+void dir_tree_set_entry_exist (DirTree *dtree, fuse_ino_t ino)
+{
+    DirEntry *en;
 
-    g_free (req_path);
+    en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (ino));
 
-    if (!res) {
-        LOG_err (DIR_TREE_LOG, "Failed to create http request !");
-        http_connection_release (con);
-        op_data->lookup_cb (op_data->req, FALSE, 0, 0, 0, 0);
-        g_free (op_data->name);
-        g_free (op_data);
+    if (!en || en->type != DET_file) {
+        LOG_msg (DIR_TREE_LOG, INO_H"File not found !", INO_T (ino));
         return;
     }
+
+    en->removed = FALSE;
 }
 
-static void dir_tree_on_lookup_read (G_GNUC_UNUSED fuse_req_t req, gboolean success,
-    G_GNUC_UNUSED size_t max_size, G_GNUC_UNUSED off_t off,
-    G_GNUC_UNUSED const char *buf, G_GNUC_UNUSED size_t buf_size,
-    gpointer ctx)
+// file was uploaded, remember the ETag and version-id the server returned and Content-Type which was sent
+void dir_tree_set_entry_etag (DirTree *dtree, fuse_ino_t ino, const gchar *etag, const gchar *version_id,
+    const gchar *content_type)
 {
-    LookupOpData *op_data = (LookupOpData *) ctx;
+    DirEntry *en;
 
-    if (!success) {
-        LOG_err (DIR_TREE_LOG, INO_H"Failed to get directory listing !", INO_T (op_data->ino));
-        op_data->lookup_cb (op_data->req, FALSE, 0, 0, 0, 0);
-        g_free (op_data->name);
-        g_free (op_data);
+    en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (ino));
+
+    if (!en || en->type != DET_file) {
+        LOG_msg (DIR_TREE_LOG, INO_H"File not found !", INO_T (ino));
         return;
     }
 
-    // directory cache is filled, repeat search
-    // XXX: add recursion protection !!
-    dir_tree_lookup (op_data->dtree, op_data->parent_ino, op_data->name,
-        op_data->lookup_cb, op_data->req);
-    g_free (op_data->name);
-    g_free (op_data);
+    if (etag) {
+        if (en->etag)
+            g_free (en->etag);
+        en->etag = str_remove_quotes (g_strdup (etag));
+    }
+
+    if (version_id) {
+        if (en->version_id)
+            g_free (en->version_id);
+        en->version_id = g_strdup (version_id);
+    }
+
+    if (content_type) {
+        if (en->content_type)
+            g_free (en->content_type);
+        en->content_type = g_strdup (content_type);
+    }
+
+    en->removed = FALSE;
+    en->xattr_time = time (NULL);
 }
 
-void dir_tree_set_entry_exist (DirTree *dtree, fuse_ino_t ino)
+// object was downloaded, response headers contain the same xattrs as HEAD response
+void dir_tree_set_entry_xattrs (DirTree *dtree, fuse_ino_t ino, struct evkeyvalq *headers)
 {
     DirEntry *en;
 
@@ -1036,12 +2339,19 @@ void dir_tree_set_entry_exist (DirTree *dtree, fuse_ino_t ino)
         return;
     }
 
-    en->removed = FALSE;
+    dir_tree_entry_update_xattrs (en, headers);
 }
 
 // lookup entry and return attributes
 void dir_tree_lookup (DirTree *dtree, fuse_ino_t parent_ino, const char *name,
     dir_tree_lookup_cb lookup_cb, fuse_req_t req)
+{
+    dir_tree_lookup_entry (dtree, parent_ino, name, lookup_cb, req, TRUE);
+}
+
+// "check_expired" is FALSE if the entry was just checked on the server
+static void dir_tree_lookup_entry (DirTree *dtree, fuse_ino_t parent_ino, const char *name,
+    dir_tree_lookup_cb lookup_cb, fuse_req_t req, gboolean check_expired)
 {
     DirEntry *dir_en, *en;
     time_t t;
@@ -1057,30 +2367,46 @@ void dir_tree_lookup (DirTree *dtree, fuse_ino_t parent_ino, const char *name,
         return;
     }
 
-    // directory cache is expired
-    // XXX: add recursion protection !!
-    if (dir_tree_is_cache_expired (dtree, dir_en)) {
+    // stale directory: look up in the current content, while it's listed in the background
+    if (dir_tree_is_cache_stale (dtree, dir_en)) {
+        dtree->stale_hits++;
+        dir_tree_refresh_start (dtree, dir_en);
+    }
 
-        LookupOpData *op_data;
+    en = g_hash_table_lookup (dir_en->dir->h_dir_tree, name);
 
-        op_data = g_new0 (LookupOpData, 1);
-        op_data->dtree = dtree;
-        op_data->lookup_cb = lookup_cb;
-        op_data->req = req;
-        op_data->not_found = TRUE;
-        op_data->parent_ino = parent_ino;
-        op_data->name = g_strdup (name);
+    // directory cache is expired: check only this entry, local changes are returned as they are
+    if (check_expired && (!en || !en->is_modified) &&
+        dir_tree_is_cache_expired (dtree, dir_en) && !dir_tree_is_cache_stale (dtree, dir_en)) {
 
-        LOG_debug (DIR_TREE_LOG, INO_H"Getting directory listing for lookup op ..", INO_T (dir_en->ino));
-        dir_tree_fill_dir_buf (dtree, dir_en->ino, 1024*1024*1, 0, dir_tree_on_lookup_read, req, op_data, NULL);
+        // the directory isn't listed here: it might be huge, readdir lists it when it's needed
 
-        return;
+        // entry was checked on the server recently
+        t = time (NULL);
+        if (en && en->updated_time && t >= en->updated_time &&
+            t - en->updated_time < (time_t)conf_get_uint (application_get_conf (dtree->app), "filesystem.file_cache_max_time")) {
+            LOG_debug (DIR_TREE_LOG, INO_H"Entry (%s) is up to date.", INO_T (dir_en->ino), name);
+        } else {
+            if (!en && dir_tree_negative_lookup (dtree, parent_ino, name)) {
+                LOG_debug (DIR_TREE_LOG, INO_H"Entry (%s) is known to be missing.", INO_T (dir_en->ino), name);
+                lookup_cb (req, FALSE, 0, 0, 0, 0);
+                return;
+            }
+
+            dir_tree_lookup_target (dtree, dir_en, name, lookup_cb, req);
+            return;
+        }
     }
 
-    en = g_hash_table_lookup (dir_en->h_dir_tree, name);
     if (!en) {
         LookupOpData *op_data;
 
+        if (dir_tree_negative_lookup (dtree, parent_ino, name)) {
+            LOG_debug (DIR_TREE_LOG, INO_H"Entry (%s) is known to be missing.", INO_T (dir_en->ino), name);
+            lookup_cb (req, FALSE, 0, 0, 0, 0);
+            return;
+        }
+
         //XXX: CacheMng !
 
         op_data = g_new0 (LookupOpData, 1);
@@ -1116,7 +2442,7 @@ void dir_tree_lookup (DirTree *dtree, fuse_ino_t parent_ino, const char *name,
     }
 
     // update access time
-    en->access_time = time (NULL);
+    dir_tree_entry_touch (dtree, en);
 
     // get extra info for file
     /*
@@ -1176,17 +2502,16 @@ void dir_tree_lookup (DirTree *dtree, fuse_ino_t parent_ino, const char *name,
     }
 
 
-    // compatibility with s3fs: send HEAD request to server if file size is 0 to check if it's a directory
-    if (!en->is_updating && en->type == DET_file &&  t >= en->updated_time &&
-        t - en->updated_time >= (time_t)conf_get_uint (application_get_conf (dtree->app), "filesystem.dir_cache_max_time") &&
-        ((conf_get_boolean (application_get_conf (dtree->app), "s3.check_empty_files") && en->size == 0) ||
-         conf_get_boolean (application_get_conf (dtree->app), "s3.force_head_requests_on_lookup")
-        )) {
+    // metadata (mode, creation time) is returned only by HEAD request: get it once per file,
+    // size is refreshed by the parent directory listing, which resets updated_time if the file was changed
+    // empty s3fs directories are detected by the listing too, see dir_tree_update_entry ()
+    if (!en->is_updating && en->type == DET_file && !en->updated_time &&
+        conf_get_boolean (application_get_conf (dtree->app), "s3.force_head_requests_on_lookup")) {
 
         LookupOpData *op_data;
 
         //XXX: CacheMng !
-        LOG_debug (DIR_TREE_LOG, INO_H"Forced to send HEAD request: %s", INO_T (en->ino), en->fullpath);
+        LOG_debug (DIR_TREE_LOG, INO_H"Forced to send HEAD request: %s", INO_T (en->ino), en->basename);
 
         op_data = g_new0 (LookupOpData, 1);
         op_data->dtree = dtree;
@@ -1264,6 +2589,22 @@ void dir_tree_getattr (DirTree *dtree, fuse_ino_t ino,
 
     getattr_cb (req, TRUE, en->ino, en->mode, en->size, en->ctime);
 }
+
+// return attributes of entry which is already in DirTree, no requests are sent
+gboolean dir_tree_get_cached_attr (DirTree *dtree, fuse_ino_t ino, int *mode, off_t *file_size, time_t *ctime)
+{
+    DirEntry *en;
+
+    en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (ino));
+    if (!en || en->removed)
+        return FALSE;
+
+    *mode = en->mode;
+    *file_size = en->size;
+    *ctime = en->ctime;
+
+    return TRUE;
+}
 /*}}}*/
 
 /*{{{ dir_tree_setattr */
@@ -1271,10 +2612,11 @@ void dir_tree_getattr (DirTree *dtree, fuse_ino_t ino,
 // update directory cache
 // XXX: not fully implemented
 void dir_tree_setattr (DirTree *dtree, fuse_ino_t ino,
-    G_GNUC_UNUSED struct stat *attr, G_GNUC_UNUSED int to_set,
-    dir_tree_setattr_cb setattr_cb, fuse_req_t req, G_GNUC_UNUSED void *fi)
+    G_GNUC_UNUSED struct stat *attr, int to_set,
+    dir_tree_setattr_cb setattr_cb, fuse_req_t req, void *fi)
 {
     DirEntry  *en;
+    struct fuse_file_info *file_info = (struct fuse_file_info *) fi;
 
     LOG_debug (DIR_TREE_LOG, INO_H"Setting attributes", INO_T (ino));
 
@@ -1286,6 +2628,15 @@ void dir_tree_setattr (DirTree *dtree, fuse_ino_t ino,
         setattr_cb (req, FALSE, 0, 0, 0);
         return;
     }
+
+    // truncated file must not keep the content of the object (O_TRUNC is sent as a separate setattr call)
+    if ((to_set & FUSE_SET_ATTR_SIZE) && en->type == DET_file) {
+        if (file_info && file_info->fh)
+            fileio_set_keep_content ((FileIO *) convert_fh_to_ptr (file_info->fh), FALSE);
+        else
+            en->truncated = TRUE;
+    }
+
     //XXX: en->mode
     setattr_cb (req, TRUE, en->ino, en->mode, en->size);
 }
@@ -1299,6 +2650,7 @@ void dir_tree_file_create (DirTree *dtree, fuse_ino_t parent_ino, const char *na
 {
     DirEntry *dir_en, *en;
     FileIO *fop;
+    gchar *fullpath;
 
     // get parent, must be dir
     dir_en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (parent_ino));
@@ -1311,7 +2663,7 @@ void dir_tree_file_create (DirTree *dtree, fuse_ino_t parent_ino, const char *na
     }
 
     // check if such entry exists
-    en = g_hash_table_lookup (dir_en->h_dir_tree, name);
+    en = g_hash_table_lookup (dir_en->dir->h_dir_tree, name);
     if (!en) {
         // create a new entry
         en = dir_tree_add_entry (dtree, name, mode, DET_file, parent_ino, 0, time (NULL));
@@ -1323,7 +2675,7 @@ void dir_tree_file_create (DirTree *dtree, fuse_ino_t parent_ino, const char *na
     } else {
         // update
         en->removed = FALSE;
-        en->access_time = time (NULL);
+        dir_tree_entry_touch (dtree, en);
         en->age = dir_en->age;
 
         // inform the parent that his dir cache is no longer up-to-dated
@@ -1333,7 +2685,10 @@ void dir_tree_file_create (DirTree *dtree, fuse_ino_t parent_ino, const char *na
     //XXX: set as new
     en->is_modified = TRUE;
 
-    fop = fileio_create (dtree->app, en->fullpath, en->ino, TRUE);
+    fullpath = dir_tree_entry_get_fullpath (dtree, en);
+    fop = fileio_create (dtree->app, fullpath, en->ino, TRUE);
+    g_free (fullpath);
+    fileio_set_base_etag (fop, en->etag);
     fi->fh = convert_ptr_to_fh (fop);
 
     LOG_debug (DIR_TREE_LOG, INO_FOP_H"New Entry created: %s, directory ino: %"INO_FMT, INO_T (en->ino), (void *)fop, name, INO parent_ino);
@@ -1349,6 +2704,7 @@ void dir_tree_file_open (DirTree *dtree, fuse_ino_t ino, struct fuse_file_info *
 {
     DirEntry *en;
     FileIO *fop;
+    gchar *fullpath;
 
     en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (ino));
 
@@ -1360,7 +2716,14 @@ void dir_tree_file_open (DirTree *dtree, fuse_ino_t ino, struct fuse_file_info *
         return;
     }
 
-    fop = fileio_create (dtree->app, en->fullpath, en->ino, FALSE);
+    dir_tree_entry_touch (dtree, en);
+
+    fullpath = dir_tree_entry_get_fullpath (dtree, en);
+    fop = fileio_create (dtree->app, fullpath, en->ino, FALSE);
+    g_free (fullpath);
+    fileio_set_base_etag (fop, en->etag);
+    fileio_set_keep_content (fop, !(fi->flags & O_TRUNC) && !en->truncated);
+    en->truncated = FALSE;
     fi->fh = convert_ptr_to_fh (fop);
 
     LOG_debug (DIR_TREE_LOG, INO_FOP_H"dir_tree_open", INO_T (en->ino), (void *)fop);
@@ -1485,11 +2848,13 @@ static void dir_tree_on_buffer_written_cb (FileIO *fop, gpointer ctx, gboolean s
             return;
         }
 
-        // try to get file size from CacheMng
-        len = cache_mng_get_file_length (application_get_cache_mng (op_data->dtree->app), op_data->ino);
+        // try to get file size from CacheMng, unless the existing object is modified in place
+        if (!fileio_get_patched_size (fop, &len))
+            len = cache_mng_get_file_length (application_get_cache_mng (op_data->dtree->app), op_data->ino);
 
-        // calculate current size in case of CacheMng is disabled or the file is not stored in CacheMng
-        if (len == 0) {
+        // calculate current size in case of CacheMng is disabled, the file is not stored in CacheMng
+        // or the written data is still staged by FileIO
+        if (len < (guint64) op_data->off + count) {
             len = op_data->off + count;
             LOG_debug (DIR_TREE_LOG, INO_H"Recalculating file size !", INO_T (op_data->ino));
         }
@@ -1600,7 +2965,7 @@ static void dir_tree_file_remove_on_con_cb (gpointer client, gpointer ctx)
 
     http_connection_acquire (con);
 
-    req_path = g_strdup_printf ("/%s", en->fullpath);
+    req_path = dir_tree_entry_get_req_path (data->dtree, en);
     res = http_connection_make_request (con,
         req_path, "DELETE",
         NULL, TRUE, NULL,
@@ -1668,13 +3033,13 @@ void dir_tree_file_unlink (DirTree *dtree, fuse_ino_t parent_ino, const char *na
     LOG_debug (DIR_TREE_LOG, "Unlinking %s, parent_ino: %"INO_FMT, name, INO parent_ino);
 
     parent_en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (parent_ino));
-    if (!parent_en) {
+    if (!parent_en || !parent_en->dir) {
         LOG_err (DIR_TREE_LOG, "Parent not found, parent_ino: %"INO_FMT, INO parent_ino);
         file_remove_cb (req, FALSE);
         return;
     }
 
-    en = g_hash_table_lookup (parent_en->h_dir_tree, name);
+    en = g_hash_table_lookup (parent_en->dir->h_dir_tree, name);
     if (!en) {
         LOG_err (DIR_TREE_LOG, "Entry not found, parent_ino: %"INO_FMT, INO parent_ino);
         file_remove_cb (req, FALSE);
@@ -1704,19 +3069,19 @@ gboolean dir_tree_dir_remove (DirTree *dtree, fuse_ino_t parent_ino, const char
         return FALSE;
     }
 
-    en = g_hash_table_lookup (parent_en->h_dir_tree, name);
+    en = g_hash_table_lookup (parent_en->dir->h_dir_tree, name);
     if (!en) {
         LOG_err (DIR_TREE_LOG, "Entry not found: %s", name);
         return FALSE;
     }
 
-    if (en->type != DET_dir || !en->h_dir_tree) {
+    if (!en->dir) {
         LOG_err (DIR_TREE_LOG, INO_H"Entry is not a directory !", INO_T (en->ino));
         return FALSE;
     }
 
     // check that all entries are removed
-    g_hash_table_iter_init (&iter, en->h_dir_tree);
+    g_hash_table_iter_init (&iter, en->dir->h_dir_tree);
     while (g_hash_table_iter_next (&iter, NULL, &value)) {
         DirEntry *tmp_en = (DirEntry *) value;
         if (!tmp_en->removed) {
@@ -1727,7 +3092,7 @@ gboolean dir_tree_dir_remove (DirTree *dtree, fuse_ino_t parent_ino, const char
     }
 
     if (!entries_removed) {
-        LOG_debug (DIR_TREE_LOG, INO_H"Directory is not empty, items: %u !", INO_T (en->ino), g_hash_table_size (en->h_dir_tree));
+        LOG_debug (DIR_TREE_LOG, INO_H"Directory is not empty, items: %u !", INO_T (en->ino), g_hash_table_size (en->dir->h_dir_tree));
         return FALSE;
     }
 
@@ -1759,7 +3124,7 @@ void dir_tree_dir_create (DirTree *dtree, fuse_ino_t parent_ino, const char *nam
         return;
     }
 
-    en = g_hash_table_lookup (dir_en->h_dir_tree, name);
+    en = g_hash_table_lookup (dir_en->dir->h_dir_tree, name);
     if (!en) {
         // create a new entry
         en = dir_tree_add_entry (dtree, name, mode, DET_dir, parent_ino, 10, time (NULL));
@@ -1770,16 +3135,12 @@ void dir_tree_dir_create (DirTree *dtree, fuse_ino_t parent_ino, const char *nam
         }
     } else {
         // lookup has created a default "file type" entry
-        en->type = DET_dir;
-        if (!en->h_dir_tree)
-            en->h_dir_tree = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, dir_entry_destroy);
+        dir_tree_entry_set_dir (dtree, en);
         en->removed = FALSE;
-        en->access_time = time (NULL);
-        if (en->dir_cache)
-            g_free (en->dir_cache);
-        en->dir_cache = NULL;
-        en->dir_cache_size = 0;
-        //en->dir_cache_created = 0;
+        dir_tree_entry_touch (dtree, en);
+        if (en->dir->dir_cache)
+            dir_buf_destroy (en->dir->dir_cache);
+        en->dir->dir_cache = NULL;
     }
 
     // inform parent that directory listing is no longer valid
@@ -1847,7 +3208,7 @@ static void dir_tree_on_rename_delete_cb (HttpConnection *con, gpointer ctx, gbo
         return;
     }
 
-    en = g_hash_table_lookup (parent_en->h_dir_tree, rdata->name);
+    en = g_hash_table_lookup (parent_en->dir->h_dir_tree, rdata->name);
     if (!en) {
         LOG_debug (DIR_TREE_LOG, "Entry '%s' not found, parent_ino: %"INO_FMT, rdata->name, INO_T (rdata->parent_ino));
         if (rdata->rename_cb)
@@ -1896,7 +3257,7 @@ static void dir_tree_on_rename_delete_con_cb (gpointer client, gpointer ctx)
         return;
     }
 
-    en = g_hash_table_lookup (parent_en->h_dir_tree, rdata->name);
+    en = g_hash_table_lookup (parent_en->dir->h_dir_tree, rdata->name);
     if (!en) {
         LOG_debug (DIR_TREE_LOG, "Entry '%s' not found, parent_ino: %"INO_FMT, rdata->name, INO rdata->parent_ino);
         if (rdata->rename_cb)
@@ -1906,7 +3267,7 @@ static void dir_tree_on_rename_delete_con_cb (gpointer client, gpointer ctx)
     }
 
     http_connection_acquire (con);
-    req_path = g_strdup_printf ("/%s", en->fullpath);
+    req_path = dir_tree_entry_get_req_path (rdata->dtree, en);
     res = http_connection_make_request (con,
         req_path, "DELETE",
         NULL, TRUE, NULL,
@@ -1957,7 +3318,19 @@ static void dir_tree_on_rename_copy_cb (HttpConnection *con, gpointer ctx, gbool
         return;
     }
 
-    en = g_hash_table_lookup (newparent_en->h_dir_tree, rdata->newname);
+    en = g_hash_table_lookup (newparent_en->dir->h_dir_tree, rdata->newname);
+    if (!en) {
+        DirEntry *parent_en;
+        DirEntry *src_en = NULL;
+
+        // destination didn't exist, create it with the source attributes
+        parent_en = g_hash_table_lookup (rdata->dtree->h_inodes, GUINT_TO_POINTER (rdata->parent_ino));
+        if (parent_en && parent_en->type == DET_dir)
+            src_en = g_hash_table_lookup (parent_en->dir->h_dir_tree, rdata->name);
+        if (src_en)
+            en = dir_tree_add_entry (rdata->dtree, rdata->newname, src_en->mode, src_en->type,
+                rdata->newparent_ino, src_en->size, time (NULL));
+    }
     if (!en) {
         LOG_debug (DIR_TREE_LOG, "Entry '%s' not found, parent_ino: %"INO_FMT, rdata->newname, INO rdata->newparent_ino);
         if (rdata->rename_cb)
@@ -1967,7 +3340,7 @@ static void dir_tree_on_rename_copy_cb (HttpConnection *con, gpointer ctx, gbool
     }
 
     en->removed = FALSE;
-    en->access_time = time (NULL);
+    dir_tree_entry_touch (rdata->dtree, en);
 
     // inform the parent that his dir cache is no longer up-to-dated
     dir_tree_entry_modified (rdata->dtree, newparent_en);
@@ -1989,6 +3362,7 @@ static void dir_tree_on_rename_copy_con_cb (gpointer client, gpointer ctx)
     RenameData *rdata = (RenameData *) ctx;
     gchar *dst_path = NULL;
     gchar *src_path = NULL;
+    gchar *fullpath;
     gboolean res;
     DirEntry *en;
     DirEntry *parent_en;
@@ -2003,7 +3377,7 @@ static void dir_tree_on_rename_copy_con_cb (gpointer client, gpointer ctx)
         return;
     }
 
-    en = g_hash_table_lookup (parent_en->h_dir_tree, rdata->name);
+    en = g_hash_table_lookup (parent_en->dir->h_dir_tree, rdata->name);
     if (!en) {
         LOG_debug (DIR_TREE_LOG, "Entry '%s' not found, parent_ino: %"INO_FMT, rdata->name, INO rdata->parent_ino);
         if (rdata->rename_cb)
@@ -2024,18 +3398,20 @@ static void dir_tree_on_rename_copy_con_cb (gpointer client, gpointer ctx)
     http_connection_acquire (con);
 
     // source
-    src_path = g_strdup_printf ("%s/%s", conf_get_string (application_get_conf (rdata->dtree->app), "s3.bucket_name"), en->fullpath);
+    fullpath = dir_tree_entry_get_fullpath (rdata->dtree, en);
+    src_path = g_strdup_printf ("%s/%s", conf_get_string (application_get_conf (rdata->dtree->app), "s3.bucket_name"), fullpath);
     http_connection_add_output_header (con, "x-amz-copy-source", src_path);
     g_free (src_path);
 
     http_connection_add_output_header (con, "x-amz-storage-class", conf_get_string (application_get_conf (rdata->dtree->app), "s3.storage_type"));
 
     if (rdata->newparent_ino == FUSE_ROOT_ID)
-        dst_path = g_strdup_printf ("%s/%s", newparent_en->fullpath, rdata->newname);
+        dst_path = g_strdup_printf ("%s/%s", newparent_en->dir->fullpath, rdata->newname);
     else
-        dst_path = g_strdup_printf ("/%s/%s", newparent_en->fullpath, rdata->newname);
+        dst_path = g_strdup_printf ("/%s/%s", newparent_en->dir->fullpath, rdata->newname);
 
-    LOG_debug (DIR_TREE_LOG, INO_CON_H"Rename: coping %s to %s", INO_T (en->ino), (void *)con, en->fullpath, dst_path);
+    LOG_debug (DIR_TREE_LOG, INO_CON_H"Rename: coping %s to %s", INO_T (en->ino), (void *)con, fullpath, dst_path);
+    g_free (fullpath);
 
     res = http_connection_make_request (con,
         dst_path, "PUT",
@@ -2084,7 +3460,7 @@ void dir_tree_rename (DirTree *dtree,
         return;
     }
 
-    en = g_hash_table_lookup (parent_en->h_dir_tree, name);
+    en = g_hash_table_lookup (parent_en->dir->h_dir_tree, name);
     if (!en) {
         LOG_debug (DIR_TREE_LOG, "Entry '%s' not found !", name);
         if (rename_cb)
@@ -2161,6 +3537,28 @@ static const gchar *dir_tree_getxattr_from_entry (DirEntry *en, XAttrType attr_t
     return out;
 }
 
+// entry was in the last listing of the parent directory, which is not expired
+static gboolean dir_tree_entry_is_listed (DirTree *dtree, DirEntry *en)
+{
+    DirEntry *parent_en;
+
+    parent_en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (en->parent_ino));
+    if (!parent_en)
+        return FALSE;
+
+    return en->age >= parent_en->age &&
+        (!dir_tree_is_cache_expired (dtree, parent_en) || dir_tree_is_cache_stale (dtree, parent_en));
+}
+
+// ETag is updated by every listing of the parent directory
+static gboolean dir_tree_entry_etag_is_listed (DirTree *dtree, DirEntry *en)
+{
+    if (!en->etag || en->is_modified)
+        return FALSE;
+
+    return dir_tree_entry_is_listed (dtree, en);
+}
+
 static void dir_tree_entry_update_xattrs (DirEntry *en, struct evkeyvalq *headers)
 {
     const gchar *header = NULL;
@@ -2171,15 +3569,17 @@ static void dir_tree_entry_update_xattrs (DirEntry *en, struct evkeyvalq *header
     header = http_find_header (headers, "ETag");
     if (header) {
         gchar *tmp;
-        tmp = (gchar *)header;
-        tmp = str_remove_quotes (tmp);
+
+        // headers are used by the caller, don't modify them
+        tmp = str_remove_quotes (g_strdup (header));
 
         if (!en->etag)
-            en->etag = g_strdup (tmp);
+            en->etag = tmp;
         else if (strcmp (en->etag, tmp)) {
             g_free (en->etag);
-            en->etag = g_strdup (tmp);
-        }
+            en->etag = tmp;
+        } else
+            g_free (tmp);
     }
 
     header = http_find_header (headers, "x-amz-version-id");
@@ -2260,7 +3660,7 @@ static void dir_tree_on_getxattr_con_cb (gpointer client, gpointer ctx)
 
     http_connection_acquire (con);
 
-    req_path = g_strdup_printf ("/%s", en->fullpath);
+    req_path = dir_tree_entry_get_req_path (xattr_data->dtree, en);
 
     res = http_connection_make_request (con,
         req_path, "HEAD", NULL, FALSE, NULL,
@@ -2320,7 +3720,8 @@ void dir_tree_getxattr (DirTree *dtree, fuse_ino_t ino,
     // check if we can get data from cache
     t = time (NULL);
     if (t >= en->xattr_time &&
-        t - en->xattr_time >= (time_t)conf_get_uint (application_get_conf (dtree->app), "filesystem.dir_cache_max_time")) {
+        t - en->xattr_time >= (time_t)conf_get_uint (application_get_conf (dtree->app), "filesystem.dir_cache_max_time") &&
+        !(attr_type == XATR_etag && dir_tree_entry_etag_is_listed (dtree, en))) {
 
         xattr_data = g_new0 (XAttrData, 1);
         xattr_data->dtree = dtree;
@@ -2376,6 +3777,397 @@ guint dir_tree_get_inode_count (DirTree *dtree)
     return g_hash_table_size (dtree->h_inodes);
 }
 
+void dir_tree_foreach_subdir (DirTree *dtree, fuse_ino_t ino, DirTree_subdir_cb subdir_cb, gpointer ctx)
+{
+    GHashTableIter iter;
+    DirEntry *en;
+    gpointer value;
+
+    en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (ino));
+    if (!en || en->type != DET_dir)
+        return;
+
+    g_hash_table_iter_init (&iter, en->dir->h_dir_tree);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        DirEntry *child = (DirEntry *) value;
+
+        if (child->type == DET_dir && !child->removed)
+            subdir_cb (child->ino, child->dir->fullpath, ctx);
+    }
+}
+
+/*}}}*/
+
+/*{{{ snapshot */
+// Snapshot file is a header followed by records, one per DirEntry (except of the root).
+// Parents are written before their children, numbers are in host byte order,
+// records are 8 bytes aligned, so the file can be walked in place after mmap ().
+
+#define DIR_TREE_SNAPSHOT_MAGIC "RIOFSDT"
+#define DIR_TREE_SNAPSHOT_VERSION 1
+// number of entries written per event loop iteration
+#define DIR_TREE_SNAPSHOT_STEP_ENTRIES 1000
+
+typedef struct {
+    gchar magic[8];
+    guint32 version;
+    guint32 entry_count;
+    guint64 max_ino;
+    gint64 created;
+} DirTreeSnapshotHeader;
+
+typedef struct {
+    guint64 ino;
+    guint64 parent_ino;
+    guint64 size;
+    gint64 ctime;
+    guint32 mode;
+    guint32 rec_size; // size of the record, including strings and padding
+    guint16 type;
+    guint16 name_len;
+    guint16 etag_len;
+    guint16 version_id_len;
+    gchar data[]; // name, etag and version_id, not 0-terminated
+} DirTreeSnapshotRecord;
+
+#define DIR_TREE_SNAPSHOT_REC_SIZE(len) \
+    ((sizeof (DirTreeSnapshotRecord) + (len) + sizeof (guint64) - 1) & ~(sizeof (guint64) - 1))
+
+static gboolean dir_tree_snapshot_write_entry (FILE *f, DirEntry *en)
+{
+    DirTreeSnapshotRecord rec;
+    static const gchar padding[sizeof (guint64)] = {0};
+    size_t name_len, etag_len, version_id_len;
+
+    name_len = strlen (en->basename);
+    etag_len = en->etag ? strlen (en->etag) : 0;
+    version_id_len = en->version_id ? strlen (en->version_id) : 0;
+    if (name_len > G_MAXUINT16 || etag_len > G_MAXUINT16 || version_id_len > G_MAXUINT16)
+        return TRUE;
+
+    memset (&rec, 0, sizeof (rec));
+    rec.ino = en->ino;
+    rec.parent_ino = en->parent_ino;
+    rec.size = en->size;
+    rec.ctime = en->ctime;
+    rec.mode = en->mode;
+    rec.type = en->type;
+    rec.name_len = name_len;
+    rec.etag_len = etag_len;
+    rec.version_id_len = version_id_len;
+    rec.rec_size = DIR_TREE_SNAPSHOT_REC_SIZE (name_len + etag_len + version_id_len);
+
+    if (fwrite (&rec, sizeof (rec), 1, f) != 1 ||
+        fwrite (en->basename, 1, name_len, f) != name_len ||
+        (etag_len && fwrite (en->etag, 1, etag_len, f) != etag_len) ||
+        (version_id_len && fwrite (en->version_id, 1, version_id_len, f) != version_id_len))
+        return FALSE;
+
+    name_len = rec.rec_size - sizeof (rec) - name_len - etag_len - version_id_len;
+    if (name_len && fwrite (padding, 1, name_len, f) != name_len)
+        return FALSE;
+
+    return TRUE;
+}
+
+static gboolean dir_tree_snapshot_write_header (DirTree *dtree)
+{
+    DirTreeSnapshotSave *save = dtree->snapshot_save;
+    DirTreeSnapshotHeader hdr;
+
+    memset (&hdr, 0, sizeof (hdr));
+    memcpy (hdr.magic, DIR_TREE_SNAPSHOT_MAGIC, sizeof (DIR_TREE_SNAPSHOT_MAGIC));
+    hdr.version = DIR_TREE_SNAPSHOT_VERSION;
+    // entries added while the snapshot was written have larger inode numbers
+    hdr.max_ino = dtree->max_ino;
+    hdr.entry_count = save->entry_count;
+    hdr.created = save->created;
+
+    return !fseek (save->f, 0, SEEK_SET) && fwrite (&hdr, sizeof (hdr), 1, save->f) == 1;
+}
+
+static gboolean dir_tree_snapshot_start (DirTree *dtree)
+{
+    DirTreeSnapshotSave *save;
+    FILE *f;
+    gchar *tmp_path;
+
+    if (!dtree->snapshot_path)
+        return FALSE;
+
+    tmp_path = g_strdup_printf ("%s.tmp", dtree->snapshot_path);
+    f = fopen (tmp_path, "w");
+    if (!f) {
+        LOG_err (DIR_TREE_LOG, "Failed to create file: %s", tmp_path);
+        g_free (tmp_path);
+        return FALSE;
+    }
+
+    save = g_new0 (DirTreeSnapshotSave, 1);
+    save->f = f;
+    save->tmp_path = tmp_path;
+    save->q_dirs = g_queue_new ();
+    save->a_inos = g_array_new (FALSE, FALSE, sizeof (fuse_ino_t));
+    save->created = time (NULL);
+    save->changes = dtree->changes;
+    dtree->snapshot_save = save;
+
+    // breadth-first, parents go first
+    g_queue_push_tail (save->q_dirs, GUINT_TO_POINTER (dtree->root->ino));
+
+    // the number of entries is updated when the snapshot is finished
+    if (!dir_tree_snapshot_write_header (dtree))
+        return dir_tree_snapshot_finish (dtree, FALSE);
+
+    return TRUE;
+}
+
+static gboolean dir_tree_snapshot_finish (DirTree *dtree, gboolean res)
+{
+    DirTreeSnapshotSave *save = dtree->snapshot_save;
+
+    if (dtree->ev_snapshot_step)
+        event_del (dtree->ev_snapshot_step);
+
+    if (res)
+        res = dir_tree_snapshot_write_header (dtree);
+
+    if (fclose (save->f))
+        res = FALSE;
+
+    if (res && rename (save->tmp_path, dtree->snapshot_path)) {
+        LOG_err (DIR_TREE_LOG, "Failed to rename file %s: %s", save->tmp_path, strerror (errno));
+        res = FALSE;
+    }
+
+    if (res) {
+        dtree->snapshot_changes = save->changes;
+        LOG_debug (DIR_TREE_LOG, "DirTree snapshot saved: %s, entries: %u", dtree->snapshot_path, save->entry_count);
+    } else {
+        LOG_err (DIR_TREE_LOG, "Failed to save DirTree snapshot: %s", save->tmp_path);
+        unlink (save->tmp_path);
+    }
+
+    g_free (save->tmp_path);
+    g_queue_free (save->q_dirs);
+    g_array_free (save->a_inos, TRUE);
+    g_free (save);
+    dtree->snapshot_save = NULL;
+
+    return res;
+}
+
+// writes up to max_entries entries (0 for no limit), returns FALSE if the snapshot is finished
+// entries are looked up by inode number, as they could be removed between the steps
+static gboolean dir_tree_snapshot_step (DirTree *dtree, guint max_entries, gboolean *res)
+{
+    DirTreeSnapshotSave *save = dtree->snapshot_save;
+    guint written = 0;
+
+    *res = TRUE;
+    for (;;) {
+        DirEntry *en;
+        fuse_ino_t ino;
+
+        // take the next directory
+        if (save->pos >= save->a_inos->len) {
+            GHashTableIter iter;
+            gpointer value;
+
+            g_array_set_size (save->a_inos, 0);
+            save->pos = 0;
+
+            if (g_queue_is_empty (save->q_dirs))
+                break;
+
+            ino = GPOINTER_TO_UINT (g_queue_pop_head (save->q_dirs));
+            en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (ino));
+            if (!en || en->removed || en->type != DET_dir)
+                continue;
+
+            g_hash_table_iter_init (&iter, en->dir->h_dir_tree);
+            while (g_hash_table_iter_next (&iter, NULL, &value))
+                g_array_append_val (save->a_inos, ((DirEntry *) value)->ino);
+            continue;
+        }
+
+        if (max_entries && written >= max_entries)
+            return TRUE;
+
+        ino = g_array_index (save->a_inos, fuse_ino_t, save->pos);
+        save->pos++;
+
+        // modified files are not uploaded yet
+        en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (ino));
+        if (!en || en->removed || en->is_modified)
+            continue;
+
+        if (!dir_tree_snapshot_write_entry (save->f, en)) {
+            *res = FALSE;
+            break;
+        }
+        save->entry_count++;
+        written++;
+
+        if (en->type == DET_dir)
+            g_queue_push_tail (save->q_dirs, GUINT_TO_POINTER (en->ino));
+    }
+
+    *res = dir_tree_snapshot_finish (dtree, *res);
+
+    return FALSE;
+}
+
+static void dir_tree_snapshot_on_step_cb (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short event, void *ctx)
+{
+    DirTree *dtree = (DirTree *) ctx;
+    gboolean res;
+
+    if (dtree->snapshot_save && dir_tree_snapshot_step (dtree, DIR_TREE_SNAPSHOT_STEP_ENTRIES, &res))
+        event_active (dtree->ev_snapshot_step, EV_TIMEOUT, 0);
+}
+
+// writes the whole snapshot at once, finishes the one in progress
+gboolean dir_tree_snapshot_save (DirTree *dtree)
+{
+    gboolean res;
+
+    if (!dtree->snapshot_save && !dir_tree_snapshot_start (dtree))
+        return FALSE;
+
+    dir_tree_snapshot_step (dtree, 0, &res);
+
+    return res;
+}
+
+static void dir_tree_snapshot_on_timer_cb (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short event, void *ctx)
+{
+    DirTree *dtree = (DirTree *) ctx;
+
+    if (dtree->snapshot_save || dtree->changes == dtree->snapshot_changes)
+        return;
+
+    if (dir_tree_snapshot_start (dtree))
+        event_active (dtree->ev_snapshot_step, EV_TIMEOUT, 0);
+}
+
+// snapshot file is shared by all instances which mount the same bucket with the same cache_dir,
+// only the first one reads and writes it, snapshot is disabled for others
+static gboolean dir_tree_snapshot_lock (DirTree *dtree)
+{
+    gchar *lock_path;
+
+    lock_path = g_strdup_printf ("%s.lock", dtree->snapshot_path);
+    dtree->snapshot_lock_fd = open (lock_path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if (dtree->snapshot_lock_fd < 0 || flock (dtree->snapshot_lock_fd, LOCK_EX | LOCK_NB) != 0) {
+        LOG_msg (DIR_TREE_LOG, "DirTree snapshot is used by another instance, disabling it: %s", lock_path);
+        if (dtree->snapshot_lock_fd >= 0)
+            close (dtree->snapshot_lock_fd);
+        dtree->snapshot_lock_fd = -1;
+        g_free (dtree->snapshot_path);
+        dtree->snapshot_path = NULL;
+        g_free (lock_path);
+        return FALSE;
+    }
+    g_free (lock_path);
+
+    return TRUE;
+}
+
+// entries keep their inode numbers, directory content is checked the first time directory is accessed
+static void dir_tree_snapshot_load (DirTree *dtree)
+{
+    const DirTreeSnapshotHeader *hdr;
+    struct stat st;
+    const gchar *p;
+    size_t pos;
+    guint32 i;
+    guint loaded = 0;
+    int fd;
+
+    fd = open (dtree->snapshot_path, O_RDONLY);
+    if (fd < 0) {
+        LOG_debug (DIR_TREE_LOG, "DirTree snapshot not found: %s", dtree->snapshot_path);
+        return;
+    }
+
+    if (fstat (fd, &st) || (size_t) st.st_size < sizeof (DirTreeSnapshotHeader)) {
+        LOG_err (DIR_TREE_LOG, "Invalid DirTree snapshot: %s", dtree->snapshot_path);
+        close (fd);
+        return;
+    }
+
+    p = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (p == MAP_FAILED) {
+        LOG_err (DIR_TREE_LOG, "Failed to map DirTree snapshot: %s", strerror (errno));
+        return;
+    }
+
+    hdr = (const DirTreeSnapshotHeader *) p;
+    if (memcmp (hdr->magic, DIR_TREE_SNAPSHOT_MAGIC, sizeof (DIR_TREE_SNAPSHOT_MAGIC)) ||
+        hdr->version != DIR_TREE_SNAPSHOT_VERSION || hdr->max_ino <= FUSE_ROOT_ID) {
+        LOG_err (DIR_TREE_LOG, "Invalid DirTree snapshot: %s", dtree->snapshot_path);
+        munmap ((void *) p, st.st_size);
+        return;
+    }
+
+    // inodes assigned by dir_tree_add_entry () must not clash with the saved ones
+    dtree->max_ino = hdr->max_ino;
+
+    pos = sizeof (DirTreeSnapshotHeader);
+    for (i = 0; i < hdr->entry_count; i++) {
+        const DirTreeSnapshotRecord *rec = (const DirTreeSnapshotRecord *) (p + pos);
+        DirEntry *en, *parent_en;
+        gchar *name;
+
+        if (pos + sizeof (DirTreeSnapshotRecord) > (size_t) st.st_size ||
+            rec->rec_size < DIR_TREE_SNAPSHOT_REC_SIZE (rec->name_len + rec->etag_len + rec->version_id_len) ||
+            pos + rec->rec_size > (size_t) st.st_size ||
+            rec->ino <= FUSE_ROOT_ID || rec->ino >= hdr->max_ino ||
+            (rec->type != DET_file && rec->type != DET_dir)) {
+            LOG_err (DIR_TREE_LOG, "DirTree snapshot is corrupted: %s", dtree->snapshot_path);
+            break;
+        }
+        pos += rec->rec_size;
+
+        // entry was moved while the snapshot was written, the first record is used
+        if (g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (rec->ino)))
+            continue;
+
+        // parent must be a directory which is already loaded
+        parent_en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (rec->parent_ino));
+        if (!parent_en || parent_en->type != DET_dir)
+            continue;
+
+        name = g_strndup (rec->data, rec->name_len);
+        en = dir_tree_add_entry (dtree, name, rec->mode, rec->type,
+            rec->parent_ino, rec->size, rec->ctime);
+        g_free (name);
+        if (!en)
+            continue;
+
+        // restore inode number
+        g_hash_table_steal (dtree->h_inodes, GUINT_TO_POINTER (en->ino));
+        en->ino = rec->ino;
+        g_hash_table_insert (dtree->h_inodes, GUINT_TO_POINTER (en->ino), en);
+
+        if (rec->etag_len)
+            en->etag = g_strndup (rec->data + rec->name_len, rec->etag_len);
+        if (rec->version_id_len)
+            en->version_id = g_strndup (rec->data + rec->name_len + rec->etag_len, rec->version_id_len);
+
+        loaded++;
+    }
+
+    // all temporary inode numbers are replaced
+    dtree->max_ino = hdr->max_ino;
+    dtree->snapshot_changes = dtree->changes;
+
+    LOG_msg (DIR_TREE_LOG, "DirTree snapshot loaded: %s, entries: %u", dtree->snapshot_path, loaded);
+
+    munmap ((void *) p, st.st_size);
+}
 /*}}}*/
 
 /*{{{ dir_tree_create_symlink */
@@ -2396,8 +4188,13 @@ static void dir_tree_on_symlink_cb (gpointer ctx, gboolean success)
     if (!en || en->type != DET_file) {
         LOG_err (DIR_TREE_LOG, INO_H"Symlink not found !", INO_T (sdata->ino));
         sdata->symlink_cb (sdata->req, FALSE, 0, 0, 0, 0);
-    } else
+    } else {
+        if (!success) {
+            g_free (en->link_target);
+            en->link_target = NULL;
+        }
         sdata->symlink_cb (sdata->req, success, en->ino, en->mode, en->size, en->ctime);
+    }
 
     g_free (sdata);
 }
@@ -2406,6 +4203,7 @@ void dir_tree_create_symlink (DirTree *dtree, fuse_ino_t parent_ino, const char
 {
     DirEntry *dir_en, *en;
     SymlinkData *sdata;
+    gchar *fullpath;
     mode_t mode = S_IFLNK | S_IRWXU | S_IRWXG | S_IRWXO;
 
     // get parent, must be dir
@@ -2419,7 +4217,7 @@ void dir_tree_create_symlink (DirTree *dtree, fuse_ino_t parent_ino, const char
     }
 
     // check if such entry exists
-    en = g_hash_table_lookup (dir_en->h_dir_tree, fname);
+    en = g_hash_table_lookup (dir_en->dir->h_dir_tree, fname);
     if (!en) {
         // create a new entry
         en = dir_tree_add_entry (dtree, fname, mode, DET_file, parent_ino, 0, time (NULL));
@@ -2431,7 +4229,7 @@ void dir_tree_create_symlink (DirTree *dtree, fuse_ino_t parent_ino, const char
     } else {
         // update
         en->removed = FALSE;
-        en->access_time = time (NULL);
+        dir_tree_entry_touch (dtree, en);
         en->age = dir_en->age;
 
         // inform the parent that his dir cache is no longer up-to-dated
@@ -2442,13 +4240,19 @@ void dir_tree_create_symlink (DirTree *dtree, fuse_ino_t parent_ino, const char
     en->is_modified = TRUE;
     en->mode = mode;
 
+    // readlink doesn't have to download the link
+    g_free (en->link_target);
+    en->link_target = g_strdup (link);
+
     sdata = g_new0 (SymlinkData, 1);
     sdata->dtree = dtree;
     sdata->ino = en->ino;
     sdata->symlink_cb = symlink_cb;
     sdata->req = req;
 
-    fileio_simple_upload (dtree->app, en->fullpath, link, mode, dir_tree_on_symlink_cb, sdata);
+    fullpath = dir_tree_entry_get_fullpath (dtree, en);
+    fileio_simple_upload (dtree->app, fullpath, link, mode, dir_tree_on_symlink_cb, sdata);
+    g_free (fullpath);
 }
 /*}}}*/
 
@@ -2463,10 +4267,18 @@ typedef struct {
 static void dir_tree_on_readlink_cb (gpointer ctx, gboolean success, const gchar *buf, size_t buf_len)
 {
     ReadlinkData *rdata = (ReadlinkData *) ctx;
+    DirEntry *en;
     gchar *str;
 
-    str = g_new0 (gchar, buf_len);
-    strncpy (str, buf, buf_len);
+    str = success ? g_strndup (buf, buf_len) : NULL;
+
+    // cache the target until the listing reports a new ETag
+    en = g_hash_table_lookup (rdata->dtree->h_inodes, GUINT_TO_POINTER (rdata->ino));
+    if (success && en && en->type == DET_file) {
+        g_free (en->link_target);
+        en->link_target = g_strdup (str);
+    }
+
     rdata->readlink_cb (rdata->req, success, rdata->ino, str);
     g_free (str);
     g_free (rdata);
@@ -2476,6 +4288,7 @@ void dir_tree_readlink (DirTree *dtree, fuse_ino_t ino, DirTree_readlink_cb read
 {
     DirEntry *en;
     ReadlinkData *rdata;
+    gchar *fullpath;
 
     en = g_hash_table_lookup (dtree->h_inodes, GUINT_TO_POINTER (ino));
     // entry not found
@@ -2485,11 +4298,21 @@ void dir_tree_readlink (DirTree *dtree, fuse_ino_t ino, DirTree_readlink_cb read
         return;
     }
 
+    // target is known and the link wasn't changed since it was received
+    if (en->link_target && (en->is_modified || dir_tree_entry_is_listed (dtree, en))) {
+        LOG_debug (DIR_TREE_LOG, INO_H"Returning cached symlink target", INO_T (ino));
+        readlink_cb (req, TRUE, ino, en->link_target);
+        return;
+    }
+
     rdata = g_new0 (ReadlinkData, 1);
+    rdata->dtree = dtree;
     rdata->ino = ino;
     rdata->readlink_cb = readlink_cb;
     rdata->req = req;
 
-    fileio_simple_download (dtree->app, en->fullpath, dir_tree_on_readlink_cb, rdata);
+    fullpath = dir_tree_entry_get_fullpath (dtree, en);
+    fileio_simple_download (dtree->app, fullpath, dir_tree_on_readlink_cb, rdata);
+    g_free (fullpath);
 }
 /*}}}*/
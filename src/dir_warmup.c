@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) 2012-2014 Paul Ionkin <paul.ionkin@gmail.com>
+ * Copyright (C) 2012-2014 Skoobe GmbH. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "dir_warmup.h"
+#include "dir_tree.h"
+#include "client_pool.h"
+
+/*{{{ struct */
+struct _DirWarmup {
+    Application *app;
+    gboolean enabled;
+
+    GList *l_prefixes; // list of gchar *, directories to warm up, the whole tree if empty
+    guint max_depth; // levels below the prefix directory
+    guint rate; // maximum directory listings per second, 0 - no limit
+    guint max_entries; // stop when DirTree contains this number of inodes
+
+    GQueue *q_dirs; // DirWarmupItem, directories to list
+    struct event *ev_next;
+    guint dirs_listed;
+};
+
+typedef struct {
+    fuse_ino_t ino;
+    guint depth;
+    gboolean inside; // directory is one of the prefixes or their subdirectory
+} DirWarmupItem;
+
+#define WARMUP_LOG "warmup"
+/*}}}*/
+
+/*{{{ create / destroy */
+
+static void dir_warmup_on_next_cb (evutil_socket_t fd, short event, void *ctx);
+
+DirWarmup *dir_warmup_create (Application *app)
+{
+    ConfData *conf = application_get_conf (app);
+    DirWarmup *warmup;
+    GList *l;
+
+    warmup = g_new0 (DirWarmup, 1);
+    warmup->app = app;
+    warmup->q_dirs = g_queue_new ();
+    warmup->dirs_listed = 0;
+
+    warmup->enabled = FALSE;
+    if (conf_node_exists (conf, "warmup.enabled"))
+        warmup->enabled = conf_get_boolean (conf, "warmup.enabled");
+
+    warmup->max_depth = 3;
+    if (conf_node_exists (conf, "warmup.max_depth"))
+        warmup->max_depth = conf_get_uint (conf, "warmup.max_depth");
+
+    warmup->rate = 10;
+    if (conf_node_exists (conf, "warmup.rate"))
+        warmup->rate = conf_get_uint (conf, "warmup.rate");
+
+    warmup->max_entries = 100000;
+    if (conf_node_exists (conf, "warmup.max_entries"))
+        warmup->max_entries = conf_get_uint (conf, "warmup.max_entries");
+
+    // DirTree full paths don't have leading and trailing delimiters
+    if (conf_node_exists (conf, "warmup.prefixes")) {
+        for (l = g_list_first (conf_get_list (conf, "warmup.prefixes")); l; l = g_list_next (l)) {
+            gchar *prefix = g_strdup ((const gchar *) l->data);
+            gchar *p = prefix;
+
+            while (*p == '/')
+                p++;
+            memmove (prefix, p, strlen (p) + 1);
+            while (strlen (prefix) && prefix[strlen (prefix) - 1] == '/')
+                prefix[strlen (prefix) - 1] = '\0';
+
+            warmup->l_prefixes = g_list_append (warmup->l_prefixes, prefix);
+        }
+    }
+
+    warmup->ev_next = evtimer_new (application_get_evbase (app), dir_warmup_on_next_cb, warmup);
+
+    return warmup;
+}
+
+void dir_warmup_destroy (DirWarmup *warmup)
+{
+    DirWarmupItem *item;
+    GList *l;
+
+    while ((item = g_queue_pop_head (warmup->q_dirs)))
+        g_free (item);
+    g_queue_free (warmup->q_dirs);
+
+    for (l = g_list_first (warmup->l_prefixes); l; l = g_list_next (l))
+        g_free (l->data);
+    g_list_free (warmup->l_prefixes);
+
+    if (warmup->ev_next)
+        event_free (warmup->ev_next);
+
+    g_free (warmup);
+}
+/*}}}*/
+
+/*{{{ prefixes */
+
+// "path" is "prefix" or its subdirectory
+static gboolean dir_warmup_path_is_inside (const gchar *path, const gchar *prefix)
+{
+    size_t len = strlen (prefix);
+
+    if (!len)
+        return TRUE;
+
+    return !strncmp (path, prefix, len) && (path[len] == '\0' || path[len] == '/');
+}
+
+// "path" is a parent directory of "prefix"
+static gboolean dir_warmup_path_is_parent (const gchar *path, const gchar *prefix)
+{
+    size_t len = strlen (path);
+
+    if (!len)
+        return TRUE;
+
+    return !strncmp (prefix, path, len) && prefix[len] == '/';
+}
+/*}}}*/
+
+/*{{{ crawler */
+
+static void dir_warmup_schedule (DirWarmup *warmup, gboolean delay)
+{
+    struct timeval tv;
+
+    tv.tv_sec = 0;
+    tv.tv_usec = 0;
+    if (delay && warmup->rate) {
+        tv.tv_sec = 1 / warmup->rate;
+        tv.tv_usec = (1000000 / warmup->rate) % 1000000;
+    }
+
+    evtimer_add (warmup->ev_next, &tv);
+}
+
+static void dir_warmup_add_dir (DirWarmup *warmup, fuse_ino_t ino, const gchar *fullpath, guint depth)
+{
+    DirWarmupItem *item;
+    gboolean inside = FALSE;
+    gboolean parent = FALSE;
+    GList *l;
+
+    if (!warmup->l_prefixes) {
+        inside = TRUE;
+    } else {
+        for (l = g_list_first (warmup->l_prefixes); l; l = g_list_next (l)) {
+            const gchar *prefix = (const gchar *) l->data;
+
+            if (dir_warmup_path_is_inside (fullpath, prefix))
+                inside = TRUE;
+            else if (dir_warmup_path_is_parent (fullpath, prefix))
+                parent = TRUE;
+        }
+    }
+
+    if (!parent && (!inside || depth > warmup->max_depth))
+        return;
+
+    item = g_new0 (DirWarmupItem, 1);
+    item->ino = ino;
+    item->depth = depth;
+    item->inside = inside;
+    g_queue_push_tail (warmup->q_dirs, item);
+}
+
+typedef struct {
+    DirWarmup *warmup;
+    DirWarmupItem *item;
+} DirWarmupSubdirData;
+
+static void dir_warmup_on_subdir_cb (fuse_ino_t ino, const gchar *fullpath, gpointer ctx)
+{
+    DirWarmupSubdirData *data = (DirWarmupSubdirData *) ctx;
+
+    // depth is counted from the prefix directory
+    dir_warmup_add_dir (data->warmup, ino, fullpath, data->item->inside ? data->item->depth + 1 : 0);
+}
+
+static void dir_warmup_on_listed_cb (G_GNUC_UNUSED fuse_req_t req, gboolean success,
+    G_GNUC_UNUSED size_t max_size, G_GNUC_UNUSED off_t off,
+    G_GNUC_UNUSED const char *buf, G_GNUC_UNUSED size_t buf_size,
+    gpointer ctx)
+{
+    DirWarmup *warmup = (DirWarmup *) ctx;
+    DirWarmupSubdirData data;
+    DirWarmupItem *item;
+
+    item = g_queue_pop_head (warmup->q_dirs);
+    if (!item)
+        return;
+
+    if (success) {
+        warmup->dirs_listed++;
+        data.warmup = warmup;
+        data.item = item;
+        dir_tree_foreach_subdir (application_get_dir_tree (warmup->app), item->ino, dir_warmup_on_subdir_cb, &data);
+    } else {
+        LOG_debug (WARMUP_LOG, INO_H"Failed to list directory", INO_T (item->ino));
+    }
+    g_free (item);
+
+    dir_warmup_schedule (warmup, TRUE);
+}
+
+static void dir_warmup_on_next_cb (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short event, void *ctx)
+{
+    DirWarmup *warmup = (DirWarmup *) ctx;
+    DirTree *dtree = application_get_dir_tree (warmup->app);
+    DirWarmupItem *item;
+
+    if (g_queue_is_empty (warmup->q_dirs)) {
+        LOG_msg (WARMUP_LOG, "Warm-up done, directories listed: %u, inodes: %u",
+            warmup->dirs_listed, dir_tree_get_inode_count (dtree));
+        return;
+    }
+
+    if (dir_tree_get_inode_count (dtree) >= warmup->max_entries) {
+        LOG_msg (WARMUP_LOG, "Warm-up stopped, inodes limit is reached: %u, directories listed: %u",
+            dir_tree_get_inode_count (dtree), warmup->dirs_listed);
+        return;
+    }
+
+    // user requests are waiting for a connection, try later
+    if (client_pool_get_queue_depth (application_get_ops_client_pool (warmup->app), CLIENT_POOL_LANE_INTERACTIVE)) {
+        dir_warmup_schedule (warmup, TRUE);
+        return;
+    }
+
+    // item stays in the queue until the directory is listed
+    item = g_queue_peek_head (warmup->q_dirs);
+    LOG_debug (WARMUP_LOG, INO_H"Listing directory, depth: %u", INO_T (item->ino), item->depth);
+
+    dir_tree_fill_dir_buf (dtree, item->ino, 0, 0, dir_warmup_on_listed_cb, NULL, warmup, NULL);
+}
+
+void dir_warmup_start (DirWarmup *warmup)
+{
+    if (!warmup->enabled)
+        return;
+
+    LOG_msg (WARMUP_LOG, "Starting directory tree warm-up, max depth: %u, rate: %u/sec, max inodes: %u",
+        warmup->max_depth, warmup->rate, warmup->max_entries);
+
+    dir_warmup_add_dir (warmup, FUSE_ROOT_ID, "", 0);
+    dir_warmup_schedule (warmup, FALSE);
+}
+/*}}}*/
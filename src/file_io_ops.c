@@ -20,6 +20,8 @@
 #include "cache_mng.h"
 #include "utils.h"
 #include "dir_tree.h"
+#include "upload_journal.h"
+#include "rfuse.h"
 
 /*{{{ struct */
 struct _FileIO {
@@ -28,6 +30,7 @@ struct _FileIO {
     gchar *content_type;
     fuse_ino_t ino;
     gboolean assume_new; // assume file does not exist yet
+    gchar *base_etag; // ETag of the object when the file was opened, NULL if unknown
 
     // write
     guint64 current_size;
@@ -37,6 +40,20 @@ struct _FileIO {
     guint part_number;
     GList *l_parts; // list of FileIOPart
     MD5_CTX md5;
+    UploadJournalEntry *journal; // on-disk journal of multipart upload
+
+    // consecutive writes are staged and stored into CacheMng in large chunks
+    struct evbuffer *cache_buf;
+    guint64 cache_buf_off; // file offset of the first staged byte
+    gboolean cache_held; // cache file is kept opened by CacheMng
+
+    // patch: existing object is modified in place,
+    // unchanged ranges are copied on the server side (UploadPartCopy)
+    gboolean patch;
+    gboolean keep_content; // file isn't truncated, writes at offset 0 modify the object too
+    guint64 patch_size; // size of the original object
+    gchar *patch_etag; // ETag of the original object
+    GList *l_copy_parts; // list of FileIOCopyPart
 
     // read
     gboolean head_req_sent;
@@ -45,13 +62,28 @@ struct _FileIO {
 
 typedef struct {
     guint part_number;
-    gchar *md5str;
+    gchar *md5str; // ETag of the part, for copied parts it's returned by the server
     gchar *md5b;
 } FileIOPart;
+
+// range of the original object: [start, end)
+typedef struct {
+    guint part_number;
+    guint64 start;
+    guint64 end;
+} FileIOCopyPart;
 /*}}}*/
 
 #define FIO_LOG "fio"
 
+// S3 requires all parts but the last one to be at least 5Mb
+#define FIO_MIN_PART_SIZE (5 * 1024 * 1024)
+
+// staged writes are flushed to CacheMng at offsets aligned to this size
+#define FIO_CACHE_CHUNK_SIZE (1024 * 1024)
+
+static void fileio_cache_flush (FileIO *fop, gboolean all);
+
 /*{{{ create / destroy */
 
 FileIO *fileio_create (Application *app, const gchar *fname, fuse_ino_t ino, gboolean assume_new)
@@ -69,6 +101,10 @@ FileIO *fileio_create (Application *app, const gchar *fname, fuse_ino_t ino, gbo
     fop->multipart_initiated = FALSE;
     fop->uploadid = NULL;
     fop->l_parts = NULL;
+    fop->journal = NULL;
+    fop->cache_buf = evbuffer_new ();
+    fop->cache_buf_off = 0;
+    fop->cache_held = FALSE;
     fop->ino = ino;
     fop->assume_new = assume_new;
     MD5_Init (&fop->md5);
@@ -87,32 +123,405 @@ void fileio_destroy (FileIO *fop)
         g_free (part);
     }
     g_list_free(fop->l_parts);
+    // upload is not finished, journal is used to resume it after restart
+    if (fop->journal)
+        upload_journal_entry_close (fop->journal);
+    fileio_cache_flush (fop, TRUE);
+    if (fop->cache_held)
+        cache_mng_release_file (application_get_cache_mng (fop->app), fop->ino);
+    evbuffer_free (fop->cache_buf);
     evbuffer_free (fop->write_buf);
     g_free (fop->fname);
     if (fop->content_type)
         g_free (fop->content_type);
     if (fop->uploadid)
         g_free (fop->uploadid);
+    if (fop->patch_etag)
+        g_free (fop->patch_etag);
+    g_free (fop->base_etag);
+    for (l = g_list_first (fop->l_copy_parts); l; l = g_list_next (l))
+        g_free (l->data);
+    g_list_free (fop->l_copy_parts);
     g_free (fop);
 }
+
+// ETag of the object which is going to be overwritten
+void fileio_set_base_etag (FileIO *fop, const gchar *etag)
+{
+    g_free (fop->base_etag);
+    fop->base_etag = g_strdup (etag);
+}
+
+// FALSE if the file was opened with O_TRUNC or truncated
+void fileio_set_keep_content (FileIO *fop, gboolean keep_content)
+{
+    fop->keep_content = keep_content;
+}
+/*}}}*/
+
+/*{{{ cache staging */
+// store staged data into CacheMng,
+// unless "all" is set only the data up to the last chunk boundary is stored
+static void fileio_cache_flush (FileIO *fop, gboolean all)
+{
+    size_t len;
+    guint64 end;
+
+    len = evbuffer_get_length (fop->cache_buf);
+    if (!len)
+        return;
+
+    if (!all) {
+        end = fop->cache_buf_off + len;
+        end -= end % FIO_CACHE_CHUNK_SIZE;
+        if (end <= fop->cache_buf_off)
+            return;
+        len = end - fop->cache_buf_off;
+    }
+
+    // CacheMng writes data at once, buffer can be drained after the call
+    cache_mng_store_file_buf (application_get_cache_mng (fop->app),
+        fop->ino, len, fop->cache_buf_off, evbuffer_pullup (fop->cache_buf, len),
+        NULL, NULL);
+
+    evbuffer_drain (fop->cache_buf, len);
+    fop->cache_buf_off += len;
+}
+
+static void fileio_cache_add (FileIO *fop, const char *buf, size_t buf_size, off_t off)
+{
+    if (!fop->cache_held) {
+        cache_mng_hold_file (application_get_cache_mng (fop->app), fop->ino);
+        fop->cache_held = TRUE;
+    }
+
+    // not a continuation of staged data
+    if (evbuffer_get_length (fop->cache_buf) &&
+        fop->cache_buf_off + evbuffer_get_length (fop->cache_buf) != (guint64) off)
+        fileio_cache_flush (fop, TRUE);
+
+    if (!evbuffer_get_length (fop->cache_buf))
+        fop->cache_buf_off = off;
+
+    evbuffer_add (fop->cache_buf, buf, buf_size);
+
+    if (evbuffer_get_length (fop->cache_buf) >= FIO_CACHE_CHUNK_SIZE)
+        fileio_cache_flush (fop, FALSE);
+}
+/*}}}*/
+
+/*{{{ upload journal */
+// the last added part is being sent
+static void fileio_journal_add_part (FileIO *fop, FileIOPart *part, size_t buf_len)
+{
+    if (!fop->journal)
+        return;
+
+    upload_journal_entry_add_part (fop->journal, part->part_number,
+        fop->current_size - buf_len, buf_len, part->md5str);
+}
+
+// the last added part is stored on the server
+static void fileio_journal_part_done (FileIO *fop, struct evkeyvalq *headers)
+{
+    GList *l;
+
+    if (!fop->journal)
+        return;
+
+    l = g_list_last (fop->l_parts);
+    if (l)
+        upload_journal_entry_part_done (fop->journal, ((FileIOPart *) l->data)->part_number,
+            http_find_header (headers, "ETag"));
+}
+/*}}}*/
+
+/*{{{ XML helpers */
+
+// returns the content of the first node matching xpath, must be freed by xmlFree ()
+static gchar *get_xml_node_value (const char *xml, size_t xml_len, const gchar *xpath)
+{
+    xmlDocPtr doc;
+    xmlXPathContextPtr ctx;
+    xmlXPathObjectPtr xp;
+    xmlNodeSetPtr nodes;
+    gchar *value = NULL;
+
+    doc = xmlReadMemory (xml, xml_len, "", NULL, 0);
+    if (!doc) {
+        LOG_err (FIO_LOG, "S3 returned incorrect XML !");
+        return NULL;
+    }
+
+    ctx = xmlXPathNewContext (doc);
+    xmlXPathRegisterNs (ctx, (xmlChar *) "s3", (xmlChar *) "http://s3.amazonaws.com/doc/2006-03-01/");
+
+    xp = xmlXPathEvalExpression ((xmlChar *) xpath, ctx);
+    if (!xp) {
+        LOG_err (FIO_LOG, "S3 returned incorrect XML !");
+        xmlXPathFreeContext (ctx);
+        xmlFreeDoc (doc);
+        return NULL;
+    }
+
+    nodes = xp->nodesetval;
+    if (!nodes || nodes->nodeNr < 1) {
+        value = NULL;
+    } else {
+        value = (char *) xmlNodeListGetString (doc, nodes->nodeTab[0]->xmlChildrenNode, 1);
+    }
+
+    xmlXPathFreeObject (xp);
+    xmlXPathFreeContext (ctx);
+    xmlFreeDoc (doc);
+
+    return value;
+}
+/*}}}*/
+
+/*{{{ AbortMultipartUpload */
+
+typedef struct {
+    gchar *fname;
+    gchar *uploadid;
+} FileAbortData;
+
+static void fileio_abort_multipart_on_cb (HttpConnection *con, void *ctx, gboolean success,
+    G_GNUC_UNUSED const gchar *buf, G_GNUC_UNUSED size_t buf_len,
+    G_GNUC_UNUSED struct evkeyvalq *headers)
+{
+    FileAbortData *adata = (FileAbortData *) ctx;
+
+    http_connection_release (con);
+
+    if (!success)
+        LOG_err (FIO_LOG, CON_H"Failed to abort multipart upload %s of %s !", (void *)con, adata->uploadid, adata->fname);
+    else
+        LOG_debug (FIO_LOG, CON_H"Multipart upload %s of %s is aborted", (void *)con, adata->uploadid, adata->fname);
+
+    g_free (adata->fname);
+    g_free (adata->uploadid);
+    g_free (adata);
+}
+
+static void fileio_abort_multipart_on_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    FileAbortData *adata = (FileAbortData *) ctx;
+    gchar *path;
+    gboolean res;
+
+    http_connection_acquire (con);
+
+    path = g_strdup_printf ("%s?uploadId=%s", adata->fname, adata->uploadid);
+    res = http_connection_make_request (con,
+        path, "DELETE", NULL, TRUE, NULL,
+        fileio_abort_multipart_on_cb,
+        adata
+    );
+    g_free (path);
+
+    if (!res) {
+        LOG_err (FIO_LOG, CON_H"Failed to create HTTP request !", (void *)con);
+        http_connection_release (con);
+        g_free (adata->fname);
+        g_free (adata->uploadid);
+        g_free (adata);
+    }
+}
+
+// upload can't be completed, remove parts which are already stored (or copied) on the server
+static void fileio_abort_multipart (FileIO *fop)
+{
+    FileAbortData *adata;
+
+    if (!fop->uploadid)
+        return;
+
+    LOG_msg (FIO_LOG, INO_H"Aborting multipart upload %s", INO_T (fop->ino), fop->uploadid);
+
+    // FileIO might be destroyed before the request is sent
+    adata = g_new0 (FileAbortData, 1);
+    adata->fname = g_strdup (fop->fname);
+    adata->uploadid = g_strdup (fop->uploadid);
+
+    if (!client_pool_get_client (application_get_write_client_pool (fop->app),
+        fileio_abort_multipart_on_con_cb, adata)) {
+        LOG_err (FIO_LOG, INO_H"Failed to get HTTP client !", INO_T (fop->ino));
+        g_free (adata->fname);
+        g_free (adata->uploadid);
+        g_free (adata);
+    }
+}
+/*}}}*/
+
+/*{{{ patch helpers */
+
+// returns TRUE if the existing object is modified in place, size is set to the resulting file size
+gboolean fileio_get_patched_size (FileIO *fop, guint64 *size)
+{
+    if (!fop->patch)
+        return FALSE;
+
+    *size = MAX (fop->patch_size, fop->current_size);
+    return TRUE;
+}
+
+// schedule copying of [start, end) range of the original object,
+// each part is limited to 5Gb, all parts are larger than 5Mb if the range is
+static void fileio_patch_add_copy_range (FileIO *fop, guint64 start, guint64 end)
+{
+    guint64 parts_num;
+    guint64 part_len;
+
+    if (start >= end)
+        return;
+
+    parts_num = (end - start + FIVEG - 1) / FIVEG;
+    part_len = (end - start + parts_num - 1) / parts_num;
+
+    while (start < end) {
+        FileIOCopyPart *cpart = g_new0 (FileIOCopyPart, 1);
+
+        cpart->part_number = fop->part_number++;
+        cpart->start = start;
+        cpart->end = MIN (start + part_len, end);
+        fop->l_copy_parts = g_list_append (fop->l_copy_parts, cpart);
+
+        start = cpart->end;
+    }
+}
+
+typedef void (*FileIO_on_range_fetched_cb) (FileIO *fop, gboolean success, gpointer ctx);
+
+typedef struct {
+    FileIO *fop;
+    guint64 start;
+    guint64 end;
+    FileIO_on_range_fetched_cb on_range_fetched_cb;
+    gpointer ctx;
+} FileFetchData;
+
+static void fileio_fetch_range_on_get_cb (HttpConnection *con, void *ctx, gboolean success,
+    const gchar *buf, size_t buf_len,
+    G_GNUC_UNUSED struct evkeyvalq *headers)
+{
+    FileFetchData *fdata = (FileFetchData *) ctx;
+
+    http_connection_release (con);
+
+    if (!success || buf_len != fdata->end - fdata->start) {
+        LOG_err (FIO_LOG, INO_CON_H"Failed to get range of the original object !", INO_T (fdata->fop->ino), (void *)con);
+        fdata->on_range_fetched_cb (fdata->fop, FALSE, fdata->ctx);
+        g_free (fdata);
+        return;
+    }
+
+    // unchanged data is uploaded together with the modified part
+    evbuffer_add (fdata->fop->write_buf, buf, buf_len);
+    fdata->fop->current_size += buf_len;
+
+    cache_mng_store_file_buf (application_get_cache_mng (fdata->fop->app),
+        fdata->fop->ino, buf_len, fdata->start, (unsigned char *) buf,
+        NULL, NULL);
+
+    fdata->on_range_fetched_cb (fdata->fop, TRUE, fdata->ctx);
+    g_free (fdata);
+}
+
+static void fileio_fetch_range_on_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    FileFetchData *fdata = (FileFetchData *) ctx;
+    gchar *range_hdr;
+    gboolean res;
+
+    http_connection_acquire (con);
+
+    range_hdr = g_strdup_printf ("bytes=%"G_GUINT64_FORMAT"-%"G_GUINT64_FORMAT, fdata->start, fdata->end - 1);
+    http_connection_add_output_header (con, "Range", range_hdr);
+    g_free (range_hdr);
+    if (fdata->fop->patch_etag)
+        http_connection_add_output_header (con, "If-Match", fdata->fop->patch_etag);
+
+    res = http_connection_make_request (con,
+        fdata->fop->fname, "GET", NULL, TRUE, NULL,
+        fileio_fetch_range_on_get_cb,
+        fdata
+    );
+
+    if (!res) {
+        LOG_err (FIO_LOG, INO_CON_H"Failed to create HTTP request !", INO_T (fdata->fop->ino), (void *)con);
+        http_connection_release (con);
+        fdata->on_range_fetched_cb (fdata->fop, FALSE, fdata->ctx);
+        g_free (fdata);
+        return;
+    }
+}
+
+// download [start, end) range of the original object and append it to the write buffer
+static void fileio_fetch_range (FileIO *fop, guint64 start, guint64 end,
+    FileIO_on_range_fetched_cb on_range_fetched_cb, gpointer ctx)
+{
+    FileFetchData *fdata;
+
+    fdata = g_new0 (FileFetchData, 1);
+    fdata->fop = fop;
+    fdata->start = start;
+    fdata->end = end;
+    fdata->on_range_fetched_cb = on_range_fetched_cb;
+    fdata->ctx = ctx;
+
+    LOG_debug (FIO_LOG, INO_H"Fetching original range [%"G_GUINT64_FORMAT" %"G_GUINT64_FORMAT"]", INO_T (fop->ino), start, end);
+
+    if (!client_pool_get_client (application_get_read_client_pool (fop->app),
+        fileio_fetch_range_on_con_cb, fdata)) {
+        LOG_err (FIO_LOG, INO_H"Failed to get HTTP client !", INO_T (fop->ino));
+        on_range_fetched_cb (fop, FALSE, ctx);
+        g_free (fdata);
+    }
+}
 /*}}}*/
 
 /*{{{ fileio_release*/
 
-static void fileio_release_update_headers (FileIO *fop)
+// file is uploaded, adopt the data written to CacheMng and update DirTree
+// with the new ETag, so the next read of this file is served from the local cache
+static void fileio_release_update_headers (FileIO *fop, const gchar *etag, const gchar *version_id)
 {
-        LOG_debug (FIO_LOG, INO_H"File uploaded !", INO_T (fop->ino));
-        fileio_destroy (fop);
+    LOG_debug (FIO_LOG, INO_H"File uploaded !", INO_T (fop->ino));
+
+    if (etag) {
+        gchar *tmp;
+        gchar *aws_etag;
+
+        // CacheMng keeps ETag as it's returned in HEAD response: quoted
+        tmp = str_remove_quotes (g_strdup (etag));
+        aws_etag = g_strdup_printf ("\"%s\"", tmp);
+
+        if (cache_mng_update_etag (application_get_cache_mng (fop->app), fop->ino, aws_etag))
+            LOG_debug (FIO_LOG, INO_H"Set cache etag: %.8s...", INO_T (fop->ino), aws_etag + 1);
+
+        dir_tree_set_entry_etag (application_get_dir_tree (fop->app), fop->ino, tmp, version_id, fop->content_type);
+
+        g_free (aws_etag);
+        g_free (tmp);
+    } else {
+        LOG_debug (FIO_LOG, INO_H"Server did not return ETag for the uploaded file !", INO_T (fop->ino));
+    }
+
+    fileio_destroy (fop);
 }
 /*}}}*/
 
 /*{{{ Complete Multipart Upload */
 // multipart is sent
 static void fileio_release_on_complete_cb (HttpConnection *con, void *ctx, gboolean success,
-    G_GNUC_UNUSED const gchar *buf, G_GNUC_UNUSED size_t buf_len,
-    G_GNUC_UNUSED struct evkeyvalq *headers)
+    const gchar *buf, size_t buf_len,
+    struct evkeyvalq *headers)
 {
     FileIO *fop = (FileIO *) ctx;
+    gchar *etag = NULL;
 
     http_connection_release (con);
 
@@ -125,8 +534,24 @@ static void fileio_release_on_complete_cb (HttpConnection *con, void *ctx, gbool
     // done
     LOG_debug (FIO_LOG, INO_CON_H"Multipart Upload is done !", INO_T (fop->ino), (void *)con);
 
-    // fileio_destroy (fop);
-    fileio_release_update_headers (fop);
+    if (fop->journal) {
+        upload_journal_entry_remove (fop->journal);
+        fop->journal = NULL;
+    }
+
+    // ETag of the assembled object is returned in the response body
+    if (buf_len)
+        etag = get_xml_node_value (buf, buf_len, "//s3:ETag");
+
+    fileio_release_update_headers (fop, etag, http_find_header (headers, "x-amz-version-id"));
+
+    if (etag)
+        xmlFree (etag);
+}
+
+static gint fileio_part_cmp (const FileIOPart *a, const FileIOPart *b)
+{
+    return (gint)a->part_number - (gint)b->part_number;
 }
 
 // got HttpConnection object
@@ -139,6 +564,9 @@ static void fileio_release_on_complete_con_cb (gpointer client, gpointer ctx)
     struct evbuffer *xml_buf;
     GList *l;
 
+    // copied parts are not sent in order
+    fop->l_parts = g_list_sort (fop->l_parts, (GCompareFunc) fileio_part_cmp);
+
     xml_buf = evbuffer_new ();
     evbuffer_add_printf (xml_buf, "%s", "<CompleteMultipartUpload>");
     for (l = g_list_first (fop->l_parts); l; l = g_list_next (l)) {
@@ -171,16 +599,113 @@ static void fileio_release_on_complete_con_cb (gpointer client, gpointer ctx)
     }
 }
 
+static void fileio_release_complete_multipart (FileIO *fop);
+
+/*{{{ UploadPartCopy */
+// range is copied
+static void fileio_release_on_copy_cb (HttpConnection *con, void *ctx, gboolean success,
+    const gchar *buf, size_t buf_len,
+    G_GNUC_UNUSED struct evkeyvalq *headers)
+{
+    FileIO *fop = (FileIO *) ctx;
+    FileIOCopyPart *cpart = (FileIOCopyPart *) g_list_first (fop->l_copy_parts)->data;
+    FileIOPart *part;
+    gchar *etag = NULL;
+
+    http_connection_release (con);
+
+    if (success && buf_len)
+        etag = get_xml_node_value (buf, buf_len, "//s3:ETag");
+
+    if (!etag) {
+        LOG_err (FIO_LOG, INO_CON_H"Failed to copy part %u !", INO_T (fop->ino), (void *)con, cpart->part_number);
+        fileio_abort_multipart (fop);
+        fileio_destroy (fop);
+        return;
+    }
+
+    part = g_new0 (FileIOPart, 1);
+    part->part_number = cpart->part_number;
+    part->md5str = str_remove_quotes (g_strdup (etag));
+    xmlFree (etag);
+    fop->l_parts = g_list_append (fop->l_parts, part);
+
+    fop->l_copy_parts = g_list_remove (fop->l_copy_parts, cpart);
+    g_free (cpart);
+
+    fileio_release_complete_multipart (fop);
+}
+
+// got HttpConnection object
+static void fileio_release_on_copy_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    FileIO *fop = (FileIO *) ctx;
+    FileIOCopyPart *cpart = (FileIOCopyPart *) g_list_first (fop->l_copy_parts)->data;
+    gchar *path;
+    gchar *tmp;
+    gboolean res;
+
+    LOG_debug (FIO_LOG, INO_CON_H"Copying part %u [%"G_GUINT64_FORMAT" %"G_GUINT64_FORMAT"]",
+        INO_T (fop->ino), (void *)con, cpart->part_number, cpart->start, cpart->end);
+
+    http_connection_acquire (con);
+
+    tmp = g_strdup_printf ("%s%s", conf_get_string (application_get_conf (fop->app), "s3.bucket_name"), fop->fname);
+    http_connection_add_output_header (con, "x-amz-copy-source", tmp);
+    g_free (tmp);
+
+    tmp = g_strdup_printf ("bytes=%"G_GUINT64_FORMAT"-%"G_GUINT64_FORMAT, cpart->start, cpart->end - 1);
+    http_connection_add_output_header (con, "x-amz-copy-source-range", tmp);
+    g_free (tmp);
+
+    // make sure the original object was not replaced in the meantime
+    if (fop->patch_etag)
+        http_connection_add_output_header (con, "x-amz-copy-source-if-match", fop->patch_etag);
+
+    path = g_strdup_printf ("%s?partNumber=%u&uploadId=%s",
+        fop->fname, cpart->part_number, fop->uploadid);
+    res = http_connection_make_request (con,
+        path, "PUT", NULL, TRUE, NULL,
+        fileio_release_on_copy_cb,
+        fop
+    );
+    g_free (path);
+
+    if (!res) {
+        LOG_err (FIO_LOG, INO_CON_H"Failed to create HTTP request !", INO_T (fop->ino), (void *)con);
+        http_connection_release (con);
+        fileio_abort_multipart (fop);
+        fileio_destroy (fop);
+        return;
+    }
+}
+/*}}}*/
+
 static void fileio_release_complete_multipart (FileIO *fop)
 {
+    ClientPool_on_client_ready on_client_ready;
+
     if (!fop->uploadid) {
         LOG_err (FIO_LOG, INO_H"UploadID is not set, aborting operation !", INO_T (fop->ino));
         fileio_destroy (fop);
         return;
     }
 
+    // all data is sent, the rest of the original object is copied after the last uploaded part
+    if (fop->patch && fop->current_size < fop->patch_size) {
+        fileio_patch_add_copy_range (fop, fop->current_size, fop->patch_size);
+        fop->current_size = fop->patch_size;
+    }
+
+    // copy unchanged ranges of the original object first
+    if (fop->l_copy_parts)
+        on_client_ready = fileio_release_on_copy_con_cb;
+    else
+        on_client_ready = fileio_release_on_complete_con_cb;
+
     if (!client_pool_get_client (application_get_write_client_pool (fop->app),
-        fileio_release_on_complete_con_cb, fop)) {
+        on_client_ready, fop)) {
         LOG_err (FIO_LOG, INO_H"Failed to get HTTP client !", INO_T (fop->ino));
         fileio_destroy (fop);
         return;
@@ -192,7 +717,7 @@ static void fileio_release_complete_multipart (FileIO *fop)
 // file is sent
 static void fileio_release_on_part_sent_cb (HttpConnection *con, void *ctx, gboolean success,
     G_GNUC_UNUSED const gchar *buf, G_GNUC_UNUSED size_t buf_len,
-    G_GNUC_UNUSED struct evkeyvalq *headers)
+    struct evkeyvalq *headers)
 {
     FileIO *fop = (FileIO *) ctx;
 
@@ -206,12 +731,13 @@ static void fileio_release_on_part_sent_cb (HttpConnection *con, void *ctx, gboo
 
     // if it's a multi part upload - Complete Multipart Upload
     if (fop->multipart_initiated) {
+        fileio_journal_part_done (fop, headers);
         fileio_release_complete_multipart (fop);
 
     // or we are done
     } else {
-        fileio_release_update_headers (fop);
-        //fileio_destroy (fop);
+        fileio_release_update_headers (fop,
+            http_find_header (headers, "ETag"), http_find_header (headers, "x-amz-version-id"));
     }
 }
 
@@ -255,6 +781,8 @@ static void fileio_release_on_part_con_cb (gpointer client, gpointer ctx)
             fop->fname, fop->part_number, fop->uploadid);
         fop->part_number++;
 
+        fileio_journal_add_part (fop, part, buf_len);
+
     } else {
         path = g_strdup (fop->fname);
     }
@@ -308,14 +836,44 @@ static void fileio_release_on_part_con_cb (gpointer client, gpointer ctx)
 }
 /*}}}*/
 
+static void fileio_release_on_tail_fetched_cb (FileIO *fop, gboolean success, G_GNUC_UNUSED gpointer ctx)
+{
+    if (!success) {
+        fileio_destroy (fop);
+        return;
+    }
+
+    fileio_release (fop);
+}
+
 // file is released, finish all operations
 void fileio_release (FileIO *fop)
 {
+    // all written data must be in CacheMng before the upload is finished
+    fileio_cache_flush (fop, TRUE);
+
+    // patched object: the last uploaded part is followed by the copied tail of the original object,
+    // such part can't be smaller than 5Mb, fill it with the original data
+    if (fop->patch && fop->current_size < fop->patch_size &&
+        evbuffer_get_length (fop->write_buf) &&
+        evbuffer_get_length (fop->write_buf) < FIO_MIN_PART_SIZE) {
+        fileio_fetch_range (fop, fop->current_size,
+            MIN (fop->patch_size, fop->current_size + (FIO_MIN_PART_SIZE - evbuffer_get_length (fop->write_buf))),
+            fileio_release_on_tail_fetched_cb, NULL);
+        return;
+    }
+
+    // all data is written, from now on the upload can be resumed
+    if (fop->journal && !upload_journal_entry_set_size (fop->journal, fop->current_size)) {
+        upload_journal_entry_remove (fop->journal);
+        fop->journal = NULL;
+    }
+
     // if write buffer has some data left - send it to the server
     // or an empty file was created
     if (evbuffer_get_length (fop->write_buf) || fop->assume_new) {
-        if (!client_pool_get_client (application_get_write_client_pool (fop->app),
-            fileio_release_on_part_con_cb, fop)) {
+        if (!client_pool_get_client_sized (application_get_write_client_pool (fop->app),
+            evbuffer_get_length (fop->write_buf), fileio_release_on_part_con_cb, fop)) {
             LOG_err (FIO_LOG, INO_H"Failed to get HTTP client !", INO_T (fop->ino));
             fileio_destroy (fop);
             return;
@@ -348,7 +906,7 @@ typedef struct {
 // buffer is sent
 static void fileio_write_on_send_cb (HttpConnection *con, void *ctx, gboolean success,
     G_GNUC_UNUSED const gchar *buf, G_GNUC_UNUSED size_t buf_len,
-    G_GNUC_UNUSED struct evkeyvalq *headers)
+    struct evkeyvalq *headers)
 {
     FileWriteData *wdata = (FileWriteData *) ctx;
 
@@ -361,6 +919,8 @@ static void fileio_write_on_send_cb (HttpConnection *con, void *ctx, gboolean su
         return;
     }
 
+    fileio_journal_part_done (wdata->fop, headers);
+
     // empty part buffer
     evbuffer_drain (wdata->fop->write_buf, -1);
 
@@ -403,6 +963,8 @@ static void fileio_write_on_send_con_cb (gpointer client, gpointer ctx)
     wdata->fop->part_number++;
     // XXX: check that part_number does not exceeds 10000
 
+    fileio_journal_add_part (wdata->fop, part, buf_len);
+
     // add output headers
     http_connection_add_output_header (con, "Content-MD5", part->md5b);
 
@@ -431,8 +993,8 @@ static void fileio_write_send_part (FileWriteData *wdata)
         return;
     }
 
-    if (!client_pool_get_client (application_get_write_client_pool (wdata->fop->app),
-        fileio_write_on_send_con_cb, wdata)) {
+    if (!client_pool_get_client_sized (application_get_write_client_pool (wdata->fop->app),
+        evbuffer_get_length (wdata->fop->write_buf), fileio_write_on_send_con_cb, wdata)) {
         LOG_err (FIO_LOG, INO_H"Failed to get HTTP client !", INO_T (wdata->ino));
         wdata->on_buffer_written_cb (wdata->fop, wdata->ctx, FALSE, 0);
         g_free (wdata);
@@ -444,44 +1006,7 @@ static void fileio_write_send_part (FileWriteData *wdata)
 /*{{{ Multipart Init */
 
 static gchar *get_uploadid (const char *xml, size_t xml_len) {
-    xmlDocPtr doc;
-    xmlXPathContextPtr ctx;
-    xmlXPathObjectPtr uploadid_xp;
-    xmlNodeSetPtr nodes;
-    gchar *uploadid = NULL;
-
-    doc = xmlReadMemory (xml, xml_len, "", NULL, 0);
-    ctx = xmlXPathNewContext (doc);
-    xmlXPathRegisterNs (ctx, (xmlChar *) "s3", (xmlChar *) "http://s3.amazonaws.com/doc/2006-03-01/");
-
-    uploadid_xp = xmlXPathEvalExpression ((xmlChar *) "//s3:UploadId", ctx);
-    if (!uploadid_xp) {
-        LOG_err (FIO_LOG, "S3 returned incorrect XML !");
-        xmlXPathFreeContext (ctx);
-        xmlFreeDoc (doc);
-        return NULL;
-    }
-
-    nodes = uploadid_xp->nodesetval;
-    if (!nodes) {
-        LOG_err (FIO_LOG, "S3 returned incorrect XML !");
-        xmlXPathFreeObject (uploadid_xp);
-        xmlXPathFreeContext (ctx);
-        xmlFreeDoc (doc);
-        return NULL;
-    }
-
-    if (!nodes || nodes->nodeNr < 1) {
-        uploadid = NULL;
-    } else {
-        uploadid = (char *) xmlNodeListGetString (doc, nodes->nodeTab[0]->xmlChildrenNode, 1);
-    }
-
-    xmlXPathFreeObject (uploadid_xp);
-    xmlXPathFreeContext (ctx);
-    xmlFreeDoc (doc);
-
-    return uploadid;
+    return get_xml_node_value (xml, xml_len, "//s3:UploadId");
 }
 
 static void fileio_write_on_multipart_init_cb (HttpConnection *con, void *ctx, gboolean success,
@@ -512,6 +1037,10 @@ static void fileio_write_on_multipart_init_cb (HttpConnection *con, void *ctx, g
     wdata->fop->uploadid = g_strdup (uploadid);
     xmlFree (uploadid);
 
+    // start journal, written data is kept in the held cache file
+    wdata->fop->journal = upload_journal_entry_create (application_get_upload_journal (wdata->fop->app),
+        wdata->fop->fname, wdata->fop->uploadid, wdata->fop->ino, wdata->fop->base_etag);
+
     // done, resume uploading part
     wdata->fop->part_number = 1;
     fileio_write_send_part (wdata);
@@ -560,12 +1089,234 @@ static void fileio_write_init_multipart (FileWriteData *wdata)
 }
 /*}}}*/
 
+/*{{{ patch existing object */
+
+// the first write to an existing object doesn't start at offset 0:
+// 1. HEAD the original object
+// 2. init multipart upload, unchanged head of the object is copied on the server side
+// 3. fetch original data between the copied head and the write offset (if any)
+// 4. continue as a regular write
+typedef struct {
+    FileIO *fop;
+    char *buf;
+    size_t buf_size;
+    off_t off;
+    fuse_ino_t ino;
+    FileIO_on_buffer_written_cb on_buffer_written_cb;
+    gpointer ctx;
+} FilePatchData;
+
+static void fileio_patch_failed (FilePatchData *pdata)
+{
+    FileIO *fop = pdata->fop;
+    GList *l;
+
+    // never complete the upload without the new data
+    if (fop->uploadid) {
+        fileio_abort_multipart (fop);
+        g_free (fop->uploadid);
+        fop->uploadid = NULL;
+    }
+    for (l = g_list_first (fop->l_copy_parts); l; l = g_list_next (l))
+        g_free (l->data);
+    g_list_free (fop->l_copy_parts);
+    fop->l_copy_parts = NULL;
+    evbuffer_drain (fop->write_buf, -1);
+    fop->current_size = 0;
+    fop->multipart_initiated = FALSE;
+    fop->patch = FALSE;
+
+    pdata->on_buffer_written_cb (pdata->fop, pdata->ctx, FALSE, 0);
+    g_free (pdata->buf);
+    g_free (pdata);
+}
+
+static void fileio_patch_on_head_fetched_cb (FileIO *fop, gboolean success, gpointer ctx)
+{
+    FilePatchData *pdata = (FilePatchData *) ctx;
+
+    if (!success) {
+        fileio_patch_failed (pdata);
+        return;
+    }
+
+    LOG_debug (FIO_LOG, INO_H"Patching object, original size: %"G_GUINT64_FORMAT", write offset: %"OFF_FMT,
+        INO_T (fop->ino), fop->patch_size, pdata->off);
+
+    // resume writing
+    fileio_write_buffer (fop, pdata->buf, pdata->buf_size, pdata->off, pdata->ino,
+        pdata->on_buffer_written_cb, pdata->ctx);
+    g_free (pdata->buf);
+    g_free (pdata);
+}
+
+static void fileio_patch_on_multipart_init_cb (HttpConnection *con, void *ctx, gboolean success,
+    const gchar *buf, size_t buf_len,
+    G_GNUC_UNUSED struct evkeyvalq *headers)
+{
+    FilePatchData *pdata = (FilePatchData *) ctx;
+    FileIO *fop = pdata->fop;
+    gchar *uploadid;
+    guint64 copy_end;
+
+    http_connection_release (con);
+
+    uploadid = (success && buf_len) ? get_uploadid (buf, buf_len) : NULL;
+    if (!uploadid) {
+        LOG_err (FIO_LOG, INO_CON_H"Failed to get multipart init data from the server !", INO_T (fop->ino), (void *)con);
+        fileio_patch_failed (pdata);
+        return;
+    }
+    fop->uploadid = g_strdup (uploadid);
+    xmlFree (uploadid);
+    fop->multipart_initiated = TRUE;
+
+    // unchanged head is copied if it's large enough to be a separate part,
+    // otherwise it's uploaded together with the new data
+    if ((guint64) pdata->off >= FIO_MIN_PART_SIZE)
+        copy_end = pdata->off;
+    else
+        copy_end = 0;
+
+    fop->part_number = 1;
+    fileio_patch_add_copy_range (fop, 0, copy_end);
+    fop->current_size = copy_end;
+
+    if (copy_end < (guint64) pdata->off)
+        fileio_fetch_range (fop, copy_end, pdata->off, fileio_patch_on_head_fetched_cb, pdata);
+    else
+        fileio_patch_on_head_fetched_cb (fop, TRUE, pdata);
+}
+
+// got HttpConnection object
+static void fileio_patch_on_multipart_init_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    FilePatchData *pdata = (FilePatchData *) ctx;
+    gboolean res;
+    gchar *path;
+
+    http_connection_acquire (con);
+
+    path = g_strdup_printf ("%s?uploads", pdata->fop->fname);
+
+    http_connection_add_output_header (con, "x-amz-storage-class", conf_get_string (application_get_conf (con->app), "s3.storage_type"));
+
+    res = http_connection_make_request (con,
+        path, "POST", NULL, TRUE, NULL,
+        fileio_patch_on_multipart_init_cb,
+        pdata
+    );
+    g_free (path);
+
+    if (!res) {
+        LOG_err (FIO_LOG, INO_CON_H"Failed to create HTTP request !", INO_T (pdata->ino), (void *)con);
+        http_connection_release (con);
+        fileio_patch_failed (pdata);
+        return;
+    }
+}
+
+static void fileio_patch_on_head_cb (HttpConnection *con, void *ctx, gboolean success,
+    G_GNUC_UNUSED const gchar *buf, G_GNUC_UNUSED size_t buf_len,
+    struct evkeyvalq *headers)
+{
+    FilePatchData *pdata = (FilePatchData *) ctx;
+    const gchar *header;
+
+    http_connection_release (con);
+
+    if (!success) {
+        LOG_err (FIO_LOG, INO_CON_H"Failed to get HEAD from server !", INO_T (pdata->ino), (void *)con);
+        fileio_patch_failed (pdata);
+        return;
+    }
+
+    header = http_find_header (headers, "Content-Length");
+    if (header)
+        pdata->fop->patch_size = strtoull (header, NULL, 10);
+
+    header = http_find_header (headers, "ETag");
+    if (header)
+        pdata->fop->patch_etag = g_strdup (header);
+
+    // sparse files are not supported
+    if ((guint64) pdata->off > pdata->fop->patch_size) {
+        LOG_err (FIO_LOG, INO_H"Write call with offset %"OFF_FMT" is beyond the file size !", INO_T (pdata->ino), pdata->off);
+        fileio_patch_failed (pdata);
+        return;
+    }
+
+    if (!client_pool_get_client (application_get_write_client_pool (pdata->fop->app),
+        fileio_patch_on_multipart_init_con_cb, pdata)) {
+        LOG_err (FIO_LOG, INO_H"Failed to get HTTP client !", INO_T (pdata->ino));
+        fileio_patch_failed (pdata);
+    }
+}
+
+// got HttpConnection object
+static void fileio_patch_on_head_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    FilePatchData *pdata = (FilePatchData *) ctx;
+    gboolean res;
+
+    http_connection_acquire (con);
+
+    res = http_connection_make_request (con,
+        pdata->fop->fname, "HEAD", NULL, TRUE, NULL,
+        fileio_patch_on_head_cb,
+        pdata
+    );
+
+    if (!res) {
+        LOG_err (FIO_LOG, INO_CON_H"Failed to create HTTP request !", INO_T (pdata->ino), (void *)con);
+        http_connection_release (con);
+        fileio_patch_failed (pdata);
+        return;
+    }
+}
+
+static void fileio_patch_start (FileIO *fop,
+    const char *buf, size_t buf_size, off_t off, fuse_ino_t ino,
+    FileIO_on_buffer_written_cb on_buffer_written_cb, gpointer ctx)
+{
+    FilePatchData *pdata;
+
+    pdata = g_new0 (FilePatchData, 1);
+    pdata->fop = fop;
+    // FUSE buffer is not valid after the write call returns
+    pdata->buf = g_memdup (buf, buf_size);
+    pdata->buf_size = buf_size;
+    pdata->off = off;
+    pdata->ino = ino;
+    pdata->on_buffer_written_cb = on_buffer_written_cb;
+    pdata->ctx = ctx;
+
+    fop->patch = TRUE;
+
+    if (!client_pool_get_client (application_get_read_client_pool (fop->app),
+        fileio_patch_on_head_con_cb, pdata)) {
+        LOG_err (FIO_LOG, INO_H"Failed to get HTTP client !", INO_T (ino));
+        fileio_patch_failed (pdata);
+    }
+}
+/*}}}*/
+
 void fileio_write_buffer (FileIO *fop,
     const char *buf, size_t buf_size, off_t off, fuse_ino_t ino,
     FileIO_on_buffer_written_cb on_buffer_written_cb, gpointer ctx)
 {
     FileWriteData *wdata;
 
+    // the first write to an existing file which isn't truncated, or isn't at the beginning:
+    // append or in-place modification, the unchanged parts are copied on the server side
+    if (!fop->assume_new && !fop->patch && !fop->multipart_initiated &&
+        fop->current_size == 0 && (off > 0 || fop->keep_content)) {
+        fileio_patch_start (fop, buf, buf_size, off, ino, on_buffer_written_cb, ctx);
+        return;
+    }
+
     // XXX: allow only sequentially write
     // current written bytes should be always match offset
     if (off >= 0 && fop->current_size != (guint64)off) {
@@ -576,14 +1327,13 @@ void fileio_write_buffer (FileIO *fop,
 
     // add data to output buffer
     evbuffer_add (fop->write_buf, buf, buf_size);
+
     fop->current_size += buf_size;
 
     LOG_debug (FIO_LOG, INO_H"Write buf size: %zd", INO_T (ino), evbuffer_get_length (fop->write_buf));
 
     // CacheMng
-    cache_mng_store_file_buf (application_get_cache_mng (fop->app),
-        ino, buf_size, off, (unsigned char *) buf,
-        NULL, NULL);
+    fileio_cache_add (fop, buf, buf_size, off);
 
     // if current write buffer exceeds "part_size" - this is a multipart upload
     if (evbuffer_get_length (fop->write_buf) >= conf_get_uint (application_get_conf (fop->app), "s3.part_size")) {
@@ -668,6 +1418,8 @@ static gboolean insure_cache_etag_consistent_or_invalidate_cache(struct evkeyval
             LOG_debug (FIO_LOG, INO_H"ETags differ, invalidating local cached file!: AWS %.8s..., cache %.8s...",
                 INO_T (rdata->ino), rdata->aws_etag+1, cached_etag+1);
             cache_mng_remove_file (application_get_cache_mng (rdata->fop->app), rdata->ino);
+            // kernel page cache keeps the old content too
+            rfuse_notify_inval_inode (application_get_rfuse (rdata->fop->app), rdata->ino);
         }
     } else {
         if (cache_mng_update_etag (application_get_cache_mng (rdata->fop->app), rdata->ino, rdata->aws_etag)) {
@@ -699,6 +1451,9 @@ static void fileio_read_on_get_cb (HttpConnection *con, void *ctx, gboolean succ
     if (!insure_cache_etag_consistent_or_invalidate_cache(headers, rdata))
         return;
 
+    // getxattr is answered without HEAD request
+    dir_tree_set_entry_xattrs (application_get_dir_tree (rdata->fop->app), rdata->ino, headers);
+
     // store it in the local cache
     cache_mng_store_file_buf (application_get_cache_mng (rdata->fop->app),
         rdata->ino, buf_len, rdata->request_offset, (unsigned char *) buf,
@@ -868,6 +1623,8 @@ static void fileio_read_on_head_cb (HttpConnection *con, void *ctx, gboolean suc
     if (!insure_cache_etag_consistent_or_invalidate_cache(headers, rdata))
         return;
 
+    dir_tree_set_entry_xattrs (dtree, rdata->ino, headers);
+
     // resume downloading file
     fileio_read_get_buf (rdata);
 }
@@ -915,6 +1672,9 @@ void fileio_read_buffer (FileIO *fop,
     rdata->request_offset = off;
     rdata->aws_etag = NULL;
 
+    // data written by this handle could be still staged
+    fileio_cache_flush (fop, TRUE);
+
     // send HEAD request first
     if (!rdata->fop->head_req_sent) {
         rdata->cache_etag_is_set = FALSE;
@@ -17,349 +17,352 @@
  */
 #include "http_connection.h"
 #include "dir_tree.h"
+#include "list_parser.h"
 
 typedef struct {
     Application *app;
     DirTree *dir_tree;
-    HttpConnection *con;
     gchar *dir_path;
     fuse_ino_t ino;
+    HttpConnection_directory_listing_page_callback directory_listing_page_callback;
     HttpConnection_directory_listing_callback directory_listing_callback;
     gpointer callback_data;
     guint max_keys;
+
+    guint partitions; // maximum number of key ranges listed concurrently
+    gboolean partitioned;
+    guint parts_pending; // number of key ranges which are still being listed
+    gboolean success;
 } DirListRequest;
 
+// key range of the directory listing, walked on its own HttpConnection
+typedef struct {
+    DirListRequest *dir_req;
+    HttpConnection *con;
+    gchar *start_after; // NULL for the first range
+    gchar *upper; // the last key of the range (inclusive), NULL for the last range
+    gboolean past_upper; // listing reached the next range
+} DirListPart;
+
 #define CON_DIR_LOG "con_dir"
 
-// parses  directory XML
-// returns TRUE if ok
-static gboolean parse_dir_xml (DirListRequest *dir_list, const char *xml, size_t xml_len)
+// ListBucketResult entry is parsed
+static void directory_listing_on_entry (gpointer ctx, const gchar *name, gboolean is_prefix, gint64 size, time_t last_modified,
+    const gchar *etag)
 {
-    xmlDocPtr doc;
-    xmlXPathContextPtr ctx;
-    xmlXPathObjectPtr contents_xp;
-    xmlNodeSetPtr content_nodes;
-    xmlXPathObjectPtr subdirs_xp;
-    xmlNodeSetPtr subdir_nodes;
-    int i;
-    xmlXPathObjectPtr key;
-    xmlNodeSetPtr key_nodes;
-
-// checks value for NULL, continue if it fails
-#define XML_VAR_CHK(v) \
-        if ((v) == NULL) { \
-            LOG_err (CON_DIR_LOG, "S3 returned incorrect XML !"); \
-            continue; \
-        }
-// checks value for NULL, continue if it fails, free key to avoid memleaks
-#define XML_VAR_CHK_KEY(v) \
-        if ((v) == NULL) { \
-            LOG_err (CON_DIR_LOG, "S3 returned incorrect XML !"); \
-            xmlXPathFreeObject (key); \
-            continue; \
+    DirListPart *part = (DirListPart *) ctx;
+    DirListRequest *dir_list = part->dir_req;
+    const gchar *bname;
+    gchar *tmp;
+    size_t len;
+
+    // belongs to the next key range
+    if (part->upper && strcmp (name, part->upper) > 0) {
+        part->past_upper = TRUE;
+        return;
+    }
+
+    // directories
+    if (is_prefix) {
+        bname = strstr (name, dir_list->dir_path);
+        if (!bname) {
+            LOG_err (CON_DIR_LOG, "S3 returned incorrect XML !");
+            return;
         }
+        bname = bname + strlen (dir_list->dir_path);
+        len = strlen (bname);
 
-    doc = xmlReadMemory (xml, xml_len, "", NULL, 0);
-    if (doc == NULL)
-        return FALSE;
+        //XXX: remove trailing '/' characters
+        if (len > 1 && bname[len - 1] == '/') {
+            tmp = g_strndup (bname, len - 1);
+        // XXX:
+        } else if (len == 1 && bname[0] == '/')  {
+            LOG_debug (CON_DIR_LOG, "Wrong directory name !");
+            return;
+        } else {
+            tmp = g_strdup (bname);
+        }
 
-    ctx = xmlXPathNewContext (doc);
-    if (!ctx) {
-        LOG_err (CON_DIR_LOG, "S3 returned incorrect XML !");
-        xmlFreeDoc (doc);
-        return FALSE;
+        // XXX: save / restore directory mtime
+        dir_tree_update_entry (dir_list->dir_tree, dir_list->dir_path, DET_dir, dir_list->ino, tmp, 0, last_modified, NULL);
+        g_free (tmp);
+        return;
     }
-    xmlXPathRegisterNs (ctx, (xmlChar *) "s3", (xmlChar *) "http://s3.amazonaws.com/doc/2006-03-01/");
 
     // files
-    contents_xp = xmlXPathEvalExpression ((xmlChar *) "//s3:Contents", ctx);
-    if (!contents_xp) {
-        LOG_err (CON_DIR_LOG, "S3 returned incorrect XML !");
-        xmlXPathFreeContext (ctx);
-        xmlFreeDoc (doc);
-        return FALSE;
-    }
+    if (!strncmp (name, dir_list->dir_path, strlen (name)))
+        return;
 
-    content_nodes = contents_xp->nodesetval;
-    if (!content_nodes) {
+    bname = strstr (name, dir_list->dir_path);
+    if (!bname) {
         LOG_err (CON_DIR_LOG, "S3 returned incorrect XML !");
-        xmlXPathFreeObject (contents_xp);
-        xmlXPathFreeContext (ctx);
-        xmlFreeDoc (doc);
-        return FALSE;
+        return;
     }
+    bname = bname + strlen (dir_list->dir_path);
 
-    for(i = 0; i < content_nodes->nodeNr; i++) {
-        gchar *bname = NULL;
-        gint64 size = 0;
-        time_t last_modified = time (NULL);
-        gchar *name = NULL;
-        gchar *s_size = NULL;
-        gchar *s_last_modified = NULL;
-
-        ctx->node = content_nodes->nodeTab[i];
-
-        // object name
-        key = xmlXPathEvalExpression ((xmlChar *) "s3:Key", ctx);
-        XML_VAR_CHK (key);
-        key_nodes = key->nodesetval;
-        XML_VAR_CHK_KEY (key_nodes);
-        name = (gchar *)xmlNodeListGetString (doc, key_nodes->nodeTab[0]->xmlChildrenNode, 1);
-        xmlXPathFreeObject (key);
-        XML_VAR_CHK (name);
-
-        key = xmlXPathEvalExpression ((xmlChar *) "s3:Size", ctx);
-        XML_VAR_CHK (key);
-        key_nodes = key->nodesetval;
-        XML_VAR_CHK_KEY (key_nodes);
-        s_size = (gchar *)xmlNodeListGetString (doc, key_nodes->nodeTab[0]->xmlChildrenNode, 1);
-        if (s_size) {
-            size = strtoll (s_size, NULL, 10);
-            xmlFree (s_size);
-        }
-        xmlXPathFreeObject (key);
-
-        key = xmlXPathEvalExpression ((xmlChar *) "s3:LastModified", ctx);
-        XML_VAR_CHK (key);
-        key_nodes = key->nodesetval;
-        XML_VAR_CHK_KEY (key_nodes);
-        s_last_modified = (gchar *)xmlNodeListGetString (doc, key_nodes->nodeTab[0]->xmlChildrenNode, 1);
-        if (s_last_modified) {
-            struct tm tmp = {0};
-            // 2013-04-11T15:16
-            if (strptime (s_last_modified, "%Y-%m-%dT%H:%M:%S", &tmp))
-                last_modified = mktime (&tmp);
-            xmlFree (s_last_modified);
-        }
-        xmlXPathFreeObject (key);
+    if (strlen (bname) == 1 && bname[0] == '/')  {
+        LOG_debug (CON_DIR_LOG, "Wrong file name !");
+        return;
+    }
 
-        //
-        if (!strncmp (name, dir_list->dir_path, strlen (name))) {
-            xmlFree (name);
-            continue;
-        }
+    // make sure size is set correctly
+    if (size < 0) {
+        LOG_err (CON_DIR_LOG, "S3 returned incorrect file size for %s", bname);
+        size = 0;
+    }
 
-        bname = strstr (name, dir_list->dir_path);
-        bname = bname + strlen (dir_list->dir_path);
+    dir_tree_update_entry (dir_list->dir_tree, dir_list->dir_path, DET_file, dir_list->ino,
+        bname, size, last_modified, etag);
+}
 
-        if (strlen (bname) == 1 && bname[0] == '/')  {
-            LOG_debug (CON_DIR_LOG, "Wrong file name !");
-            xmlFree (name);
-            continue;
-        }
+// free DirListPart, release HTTPConnection
+// free DirListRequest and call callback function when all key ranges are listed
+static void directory_listing_done (DirListPart *part, gboolean success)
+{
+    DirListRequest *dir_req = part->dir_req;
 
-        // make sure size is set correctly
-        if (size < 0) {
-            LOG_err (CON_DIR_LOG, "S3 returned incorrect file size for %s", bname);
-            size = 0;
-        }
+    if (!success)
+        dir_req->success = FALSE;
 
-        dir_tree_update_entry (dir_list->dir_tree, dir_list->dir_path, DET_file, dir_list->ino,
-            bname, size, last_modified);
+    dir_req->parts_pending--;
+    if (!dir_req->parts_pending) {
+        if (dir_req->directory_listing_callback)
+            dir_req->directory_listing_callback (dir_req->callback_data, dir_req->success);
 
-        xmlFree (name);
+        // we are done, stop updating
+        dir_tree_stop_update (dir_req->dir_tree, dir_req->ino, dir_req->success);
     }
 
-    xmlXPathFreeObject (contents_xp);
+    // release HTTP client
+    if (part->con)
+        http_connection_release (part->con);
 
-    // directories
-    subdirs_xp = xmlXPathEvalExpression ((xmlChar *) "//s3:CommonPrefixes", ctx);
-    if (!subdirs_xp) {
-        xmlXPathFreeContext (ctx);
-        xmlFreeDoc (doc);
-        return TRUE;
-    }
+    g_free (part->start_after);
+    g_free (part->upper);
+    g_free (part);
 
-    subdir_nodes = subdirs_xp->nodesetval;
-    if (!subdir_nodes) {
-        xmlXPathFreeObject (subdirs_xp);
-        xmlXPathFreeContext (ctx);
-        xmlFreeDoc (doc);
-        return TRUE;
+    if (!dir_req->parts_pending) {
+        g_free (dir_req->dir_path);
+        g_free (dir_req);
     }
+}
 
-    for(i = 0; i < subdir_nodes->nodeNr; i++) {
-        gchar *bname = NULL;
-        gchar *name = NULL;
-        time_t last_modified;
-
-        ctx->node = subdir_nodes->nodeTab[i];
+static void http_connection_on_directory_listing_data (HttpConnection *con, void *ctx, gboolean success,
+        const gchar *buf, size_t buf_len, G_GNUC_UNUSED struct evkeyvalq *headers);
 
-        // object name
-        key = xmlXPathEvalExpression((xmlChar *) "s3:Prefix", ctx);
-        XML_VAR_CHK (key);
-        key_nodes = key->nodesetval;
-        XML_VAR_CHK_KEY (key_nodes);
-        name = (gchar *)xmlNodeListGetString (doc, key_nodes->nodeTab[0]->xmlChildrenNode, 1);
-        xmlXPathFreeObject (key);
-        XML_VAR_CHK (name);
+// request the next page of the key range, "marker" is NULL for the first page
+static gboolean directory_listing_send_request (DirListPart *part, const gchar *marker)
+{
+    DirListRequest *dir_req = part->dir_req;
+    gchar *req_path;
+    gboolean res;
 
-        bname = strstr (name, dir_list->dir_path);
-        bname = bname + strlen (dir_list->dir_path);
+    // key ranges, except of the first one, are listed with ListObjectsV2
+    if (part->start_after) {
+        char *tmp;
 
-        //XXX: remove trailing '/' characters
-        if (strlen (bname) > 1 && bname[strlen (bname) - 1] == '/') {
-            bname[strlen (bname) - 1] = '\0';
-        // XXX:
-        } else if (strlen (bname) == 1 && bname[0] == '/')  {
-            LOG_debug (CON_DIR_LOG, "Wrong directory name !");
-            xmlFree (name);
-            continue;
+        if (marker) {
+            tmp = evhttp_uriencode (marker, -1, FALSE);
+            req_path = g_strdup_printf ("/?list-type=2&fetch-owner=false&delimiter=/&continuation-token=%s&max-keys=%u&prefix=%s",
+                tmp, dir_req->max_keys, dir_req->dir_path);
+        } else {
+            tmp = evhttp_uriencode (part->start_after, -1, FALSE);
+            req_path = g_strdup_printf ("/?list-type=2&fetch-owner=false&delimiter=/&start-after=%s&max-keys=%u&prefix=%s",
+                tmp, dir_req->max_keys, dir_req->dir_path);
         }
-
-        // XXX: save / restore directory mtime
-        last_modified = time (NULL);
-
-        dir_tree_update_entry (dir_list->dir_tree, dir_list->dir_path, DET_dir, dir_list->ino, bname, 0, last_modified);
-
-        xmlFree (name);
+        free (tmp);
+    } else if (marker) {
+        req_path = g_strdup_printf ("/?delimiter=/&marker=%s&max-keys=%u&prefix=%s", marker, dir_req->max_keys, dir_req->dir_path);
+    } else {
+        req_path = g_strdup_printf ("/?delimiter=/&max-keys=%u&prefix=%s", dir_req->max_keys, dir_req->dir_path);
     }
 
-    xmlXPathFreeObject (subdirs_xp);
-
-    xmlXPathFreeContext (ctx);
-    xmlFreeDoc (doc);
+    res = http_connection_make_request (part->con,
+        req_path, "GET",
+        NULL, TRUE, NULL,
+        http_connection_on_directory_listing_data,
+        part
+    );
+    g_free (req_path);
 
-    return TRUE;
+    return res;
 }
 
-static const char *get_next_marker(const char *xml, size_t xml_len) {
-    xmlDocPtr doc;
-    xmlXPathContextPtr ctx;
-    xmlXPathObjectPtr marker_xp;
-    xmlNodeSetPtr nodes;
-    char *next_marker = NULL;
+static void directory_listing_on_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    DirListPart *part = (DirListPart *) ctx;
 
-    doc = xmlReadMemory (xml, xml_len, "", NULL, 0);
-    if (!doc) {
-        LOG_err (CON_DIR_LOG, "S3 returned incorrect XML !");
-        return NULL;
-    }
+    part->con = con;
+    http_connection_acquire (con);
 
-    ctx = xmlXPathNewContext (doc);
-    if (!ctx) {
-        xmlFreeDoc (doc);
-        LOG_err (CON_DIR_LOG, "S3 returned incorrect XML !");
-        return NULL;
+    LOG_debug (CON_DIR_LOG, INO_CON_H"Listing key range after: >>%s<<", INO_T (part->dir_req->ino), (void *)con, part->start_after);
+
+    if (!directory_listing_send_request (part, NULL)) {
+        LOG_err (CON_DIR_LOG, INO_CON_H"Failed to create HTTP request !", INO_T (part->dir_req->ino), (void *)con);
+        directory_listing_done (part, FALSE);
     }
+}
 
-    xmlXPathRegisterNs (ctx, (xmlChar *) "s3", (xmlChar *) "http://s3.amazonaws.com/doc/2006-03-01/");
-    marker_xp = xmlXPathEvalExpression ((xmlChar *) "//s3:NextMarker", ctx);
-    if (!marker_xp) {
-        LOG_err (CON_DIR_LOG, "S3 returned incorrect XML !");
-        next_marker = NULL;
-    } else {
-        nodes = marker_xp->nodesetval;
+// directory does not fit into one page:
+// split the rest of key space by the first character of the object name
+// and list key ranges concurrently, each one on its own connection
+static void directory_listing_partition (DirListPart *first, const gchar *next_marker)
+{
+    DirListRequest *dir_req = first->dir_req;
+    DirListPart *prev = first;
+    GList *l_parts = NULL, *l;
+    size_t prefix_len;
+    guint c, n, step, i;
 
-        if (!nodes || nodes->nodeNr < 1) {
-            next_marker = NULL;
-        } else {
-            next_marker = (char *) xmlNodeListGetString (doc, nodes->nodeTab[0]->xmlChildrenNode, 1);
-        }
+    dir_req->partitioned = TRUE;
 
-        xmlXPathFreeObject (marker_xp);
-    }
-    xmlXPathFreeContext (ctx);
-    xmlFreeDoc (doc);
+    prefix_len = strlen (dir_req->dir_path);
+    if (!next_marker || strlen (next_marker) <= prefix_len)
+        return;
 
-    return next_marker;
-}
+    // printable ASCII characters are split into ranges, the rest goes to the last range
+    c = (guchar) next_marker[prefix_len];
+    if (c >= 0x7e)
+        return;
 
+    n = MIN (dir_req->partitions, 0x7f - c);
+    if (n < 2)
+        return;
+    step = (0x7f - c) / n;
 
-// free DirListRequest, release HTTPConnection, call callback function
-static void directory_listing_done (HttpConnection *con, DirListRequest *dir_req, gboolean success)
-{
-    if (dir_req->directory_listing_callback)
-        dir_req->directory_listing_callback (dir_req->callback_data, success);
+    for (i = 1; i < n; i++) {
+        DirListPart *part;
 
-    // we are done, stop updating
-    dir_tree_stop_update (dir_req->dir_tree, dir_req->ino);
+        part = g_new0 (DirListPart, 1);
+        part->dir_req = dir_req;
+        part->start_after = g_strdup_printf ("%s%c", dir_req->dir_path, (gchar) (c + i * step));
+        prev->upper = g_strdup (part->start_after);
+        prev = part;
 
-    // release HTTP client
-    if (con)
-        http_connection_release (con);
+        l_parts = g_list_append (l_parts, part);
+    }
+
+    LOG_debug (CON_DIR_LOG, INO_H"Listing directory in %u key ranges", INO_T (dir_req->ino), n);
 
-    g_free (dir_req->dir_path);
-    g_free (dir_req);
+    for (l = g_list_first (l_parts); l; l = g_list_next (l)) {
+        DirListPart *part = (DirListPart *) l->data;
 
+        dir_req->parts_pending++;
+        if (!client_pool_get_client (application_get_ops_client_pool (dir_req->app), directory_listing_on_con_cb, part)) {
+            LOG_err (CON_DIR_LOG, INO_H"Failed to get HTTP client !", INO_T (dir_req->ino));
+            directory_listing_done (part, FALSE);
+        }
+    }
+    g_list_free (l_parts);
 }
 
 // Directory read callback function
 static void http_connection_on_directory_listing_data (HttpConnection *con, void *ctx, gboolean success,
         const gchar *buf, size_t buf_len, G_GNUC_UNUSED struct evkeyvalq *headers)
 {
-    DirListRequest *dir_req = (DirListRequest *) ctx;
-    const gchar *next_marker = NULL;
-    gchar *req_path;
-    gboolean res;
+    DirListPart *part = (DirListPart *) ctx;
+    DirListRequest *dir_req = part->dir_req;
+    ListParserResult result;
+    const gchar *next_marker;
 
     if (!buf_len || !buf) {
         LOG_err (CON_DIR_LOG, INO_CON_H"Directory buffer is empty !", INO_T (dir_req->ino), (void *)con);
-        directory_listing_done (con, dir_req, FALSE);
+        directory_listing_done (part, FALSE);
         return;
     }
 
     if (!success) {
         LOG_err (CON_DIR_LOG, INO_CON_H"Error getting directory list !", INO_T (dir_req->ino), (void *)con);
-        directory_listing_done (con, dir_req, FALSE);
+        directory_listing_done (part, FALSE);
         return;
     }
 
-    if (!parse_dir_xml (dir_req, buf, buf_len)) {
+    if (!list_parser_parse (buf, buf_len, directory_listing_on_entry, part, &result)) {
         LOG_err (CON_DIR_LOG, INO_CON_H"Error parsing directory XML !", INO_T (dir_req->ino), (void *)con);
-        directory_listing_done (con, dir_req, FALSE);
+        directory_listing_done (part, FALSE);
         return;
     }
 
     // repeat starting from the mark
-    next_marker = get_next_marker (buf, buf_len);
+    next_marker = part->start_after ? result.next_continuation_token : result.next_marker;
 
     // check if we need to get more data
-    if (!g_strstr_len (buf, buf_len, "<IsTruncated>true</IsTruncated>") && !next_marker) {
+    if (!result.is_truncated && !next_marker) {
         LOG_debug (CON_DIR_LOG, INO_CON_H"Directory listing done !", INO_T (dir_req->ino), (void *)con);
-        directory_listing_done (con, dir_req, TRUE);
+        list_parser_result_clear (&result);
+        directory_listing_done (part, TRUE);
         return;
     }
 
-    // execute HTTP request
-    req_path = g_strdup_printf ("/?delimiter=/&marker=%s&max-keys=%u&prefix=%s", next_marker, dir_req->max_keys, dir_req->dir_path);
+    // the rest of the key space is listed by the next range
+    if (part->past_upper) {
+        LOG_debug (CON_DIR_LOG, INO_CON_H"Key range listing done !", INO_T (dir_req->ino), (void *)con);
+        list_parser_result_clear (&result);
+        directory_listing_done (part, TRUE);
+        return;
+    }
 
-    xmlFree ((void *) next_marker);
+    // ListObjectsV2 would start over without continuation token
+    if (part->start_after && !next_marker) {
+        LOG_err (CON_DIR_LOG, INO_CON_H"Continuation token is not set !", INO_T (dir_req->ino), (void *)con);
+        list_parser_result_clear (&result);
+        directory_listing_done (part, FALSE);
+        return;
+    }
 
-    res = http_connection_make_request (dir_req->con,
-        req_path, "GET",
-        NULL, TRUE, NULL,
-        http_connection_on_directory_listing_data,
-        dir_req
-    );
-    g_free (req_path);
+    if (!part->start_after && !dir_req->partitioned && dir_req->partitions > 1)
+        directory_listing_partition (part, next_marker);
 
-    if (!res) {
+    // let the caller use already received entries
+    if (dir_req->directory_listing_page_callback)
+        dir_req->directory_listing_page_callback (dir_req->callback_data);
+
+    // execute HTTP request
+    if (!directory_listing_send_request (part, next_marker)) {
         LOG_err (CON_DIR_LOG, INO_CON_H"Failed to create HTTP request !", INO_T (dir_req->ino), (void *)con);
-        directory_listing_done (con, dir_req, FALSE);
+        list_parser_result_clear (&result);
+        directory_listing_done (part, FALSE);
         return;
     }
+
+    list_parser_result_clear (&result);
 }
 
 // create DirListRequest
 void http_connection_get_directory_listing (HttpConnection *con, const gchar *dir_path, fuse_ino_t ino,
+    HttpConnection_directory_listing_page_callback directory_listing_page_callback,
     HttpConnection_directory_listing_callback directory_listing_callback, gpointer callback_data)
 {
     DirListRequest *dir_req;
-    gchar *req_path;
-    gboolean res;
+    DirListPart *part;
 
     LOG_debug (CON_DIR_LOG, INO_CON_H"Getting directory listing for: >>%s<<", INO_T (con), (void *)con, dir_path);
 
     dir_req = g_new0 (DirListRequest, 1);
-    dir_req->con = con;
     dir_req->app = http_connection_get_app (con);
     dir_req->dir_tree = application_get_dir_tree (dir_req->app);
     dir_req->ino = ino;
     dir_req->max_keys = conf_get_uint (application_get_conf (con->app), "s3.keys_per_request");
+    dir_req->directory_listing_page_callback = directory_listing_page_callback;
     dir_req->directory_listing_callback = directory_listing_callback;
     dir_req->callback_data = callback_data;
 
+    if (conf_node_exists (application_get_conf (con->app), "s3.list_partitions"))
+        dir_req->partitions = conf_get_uint (application_get_conf (con->app), "s3.list_partitions");
+    else
+        dir_req->partitions = 1;
+    dir_req->partitioned = FALSE;
+    dir_req->success = TRUE;
+
+    // the first key range is listed on the given connection
+    part = g_new0 (DirListPart, 1);
+    part->dir_req = dir_req;
+    part->con = con;
+    part->start_after = NULL;
+    part->upper = NULL;
+    dir_req->parts_pending = 1;
+
     // acquire HTTP client
     http_connection_acquire (con);
 
@@ -370,20 +373,9 @@ void http_connection_get_directory_listing (HttpConnection *con, const gchar *di
         dir_req->dir_path = g_strdup_printf ("%s/", dir_path);
     }
 
-    req_path = g_strdup_printf ("/?delimiter=/&max-keys=%u&prefix=%s", dir_req->max_keys, dir_req->dir_path);
-
-    res = http_connection_make_request (con,
-        req_path, "GET",
-        NULL, TRUE, NULL,
-        http_connection_on_directory_listing_data,
-        dir_req
-    );
-
-    g_free (req_path);
-
-    if (!res) {
+    if (!directory_listing_send_request (part, NULL)) {
         LOG_err (CON_DIR_LOG, INO_CON_H"Failed to create HTTP request !", INO_T (dir_req->ino), (void *)con);
-        directory_listing_done (con, dir_req, FALSE);
+        directory_listing_done (part, FALSE);
         return;
     }
 
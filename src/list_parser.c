@@ -0,0 +1,309 @@
+/*
+ * Copyright (C) 2012-2014 Paul Ionkin <paul.ionkin@gmail.com>
+ * Copyright (C) 2012-2014 Skoobe GmbH. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "list_parser.h"
+
+/*{{{ struct / defines */
+
+// elements which values are used
+typedef enum {
+    LPE_none = 0,
+    LPE_key,
+    LPE_size,
+    LPE_last_modified,
+    LPE_etag,
+    LPE_prefix,
+    LPE_is_truncated,
+    LPE_next_marker,
+    LPE_next_continuation_token,
+} ListParserElement;
+
+#define LIST_PARSER_LOG "list_parser"
+
+#define NAME_IS(name, name_len, str) \
+    ((name_len) == sizeof (str) - 1 && !memcmp ((name), (str), sizeof (str) - 1))
+/*}}}*/
+
+/*{{{ helpers */
+
+// skip till the end of string "str", return NULL if not found
+static const gchar *list_parser_skip_till (const gchar *p, const gchar *end, const gchar *str)
+{
+    size_t len = strlen (str);
+
+    while (p + len <= end) {
+        const gchar *c = memchr (p, str[0], end - p);
+
+        if (!c || c + len > end)
+            return NULL;
+        if (!memcmp (c, str, len))
+            return c + len;
+        p = c + 1;
+    }
+
+    return NULL;
+}
+
+// append element text to "out", replacing XML entities
+static void list_parser_decode (const gchar *p, const gchar *end, GString *out)
+{
+    g_string_truncate (out, 0);
+
+    while (p < end) {
+        const gchar *amp;
+        const gchar *semi;
+        size_t len;
+
+        amp = memchr (p, '&', end - p);
+        if (!amp) {
+            g_string_append_len (out, p, end - p);
+            break;
+        }
+        g_string_append_len (out, p, amp - p);
+
+        semi = memchr (amp, ';', MIN (end - amp, 12));
+        if (!semi) {
+            g_string_append_c (out, '&');
+            p = amp + 1;
+            continue;
+        }
+
+        len = semi - amp - 1;
+        if (NAME_IS (amp + 1, len, "amp"))
+            g_string_append_c (out, '&');
+        else if (NAME_IS (amp + 1, len, "lt"))
+            g_string_append_c (out, '<');
+        else if (NAME_IS (amp + 1, len, "gt"))
+            g_string_append_c (out, '>');
+        else if (NAME_IS (amp + 1, len, "quot"))
+            g_string_append_c (out, '"');
+        else if (NAME_IS (amp + 1, len, "apos"))
+            g_string_append_c (out, '\'');
+        else if (len > 1 && amp[1] == '#') {
+            gunichar c;
+
+            if (amp[2] == 'x' || amp[2] == 'X')
+                c = strtoul (amp + 3, NULL, 16);
+            else
+                c = strtoul (amp + 2, NULL, 10);
+            g_string_append_unichar (out, c);
+        } else
+            g_string_append_len (out, amp, semi - amp + 1);
+
+        p = semi + 1;
+    }
+}
+/*}}}*/
+
+/*{{{ list_parser_parse */
+
+gboolean list_parser_parse (const gchar *xml, size_t xml_len,
+    ListParser_on_entry on_entry, gpointer ctx, ListParserResult *result)
+{
+    const gchar *p = xml;
+    const gchar *end = xml + xml_len;
+    gboolean root_found = FALSE;
+    gboolean in_contents = FALSE;
+    gboolean in_prefixes = FALSE;
+    gboolean has_key = FALSE;
+    GString *key;
+    GString *value;
+    GString *etag;
+    gint64 size = 0;
+    time_t now;
+    time_t last_modified;
+    gboolean res = FALSE;
+
+    result->is_truncated = FALSE;
+    result->next_marker = NULL;
+    result->next_continuation_token = NULL;
+
+    key = g_string_sized_new (256);
+    value = g_string_sized_new (64);
+    etag = g_string_sized_new (64);
+    now = time (NULL);
+    last_modified = now;
+
+    while (p < end) {
+        const gchar *name;
+        const gchar *gt;
+        size_t name_len;
+
+        p = memchr (p, '<', end - p);
+        if (!p)
+            break;
+        p++;
+        if (p >= end)
+            goto out;
+
+        // declaration, comment or DOCTYPE
+        if (*p == '?') {
+            p = list_parser_skip_till (p, end, "?>");
+            if (!p)
+                goto out;
+            continue;
+        } else if (*p == '!') {
+            p = list_parser_skip_till (p, end, (end - p > 3 && !memcmp (p, "!--", 3)) ? "-->" : ">");
+            if (!p)
+                goto out;
+            continue;
+        }
+
+        gt = memchr (p, '>', end - p);
+        if (!gt)
+            goto out;
+
+        // closing tag
+        if (*p == '/') {
+            name = p + 1;
+            for (name_len = 0; name + name_len < gt && !g_ascii_isspace (name[name_len]); name_len++);
+
+            if (in_contents && NAME_IS (name, name_len, "Contents")) {
+                in_contents = FALSE;
+                if (has_key)
+                    on_entry (ctx, key->str, FALSE, size, last_modified, etag->len ? etag->str : NULL);
+                else
+                    LOG_err (LIST_PARSER_LOG, "S3 returned incorrect XML !");
+            } else if (in_prefixes && NAME_IS (name, name_len, "CommonPrefixes")) {
+                in_prefixes = FALSE;
+                if (has_key)
+                    on_entry (ctx, key->str, TRUE, 0, now, NULL);
+                else
+                    LOG_err (LIST_PARSER_LOG, "S3 returned incorrect XML !");
+            }
+
+            p = gt + 1;
+            continue;
+        }
+
+        // opening tag
+        name = p;
+        for (name_len = 0; name + name_len < gt && !g_ascii_isspace (name[name_len]) && name[name_len] != '/'; name_len++);
+        p = gt + 1;
+
+        if (NAME_IS (name, name_len, "ListBucketResult")) {
+            root_found = TRUE;
+        } else if (NAME_IS (name, name_len, "Contents")) {
+            in_contents = TRUE;
+            has_key = FALSE;
+            size = 0;
+            last_modified = now;
+            g_string_truncate (etag, 0);
+        } else if (NAME_IS (name, name_len, "CommonPrefixes")) {
+            in_prefixes = TRUE;
+            has_key = FALSE;
+        } else {
+            ListParserElement el = LPE_none;
+            const gchar *text_end;
+
+            if (in_contents) {
+                if (NAME_IS (name, name_len, "Key"))
+                    el = LPE_key;
+                else if (NAME_IS (name, name_len, "Size"))
+                    el = LPE_size;
+                else if (NAME_IS (name, name_len, "LastModified"))
+                    el = LPE_last_modified;
+                else if (NAME_IS (name, name_len, "ETag"))
+                    el = LPE_etag;
+            } else if (in_prefixes) {
+                if (NAME_IS (name, name_len, "Prefix"))
+                    el = LPE_prefix;
+            } else if (NAME_IS (name, name_len, "IsTruncated")) {
+                el = LPE_is_truncated;
+            } else if (NAME_IS (name, name_len, "NextMarker")) {
+                el = LPE_next_marker;
+            } else if (NAME_IS (name, name_len, "NextContinuationToken")) {
+                el = LPE_next_continuation_token;
+            }
+
+            if (el == LPE_none)
+                continue;
+
+            // <Element/>
+            if (gt[-1] == '/') {
+                text_end = p;
+            } else {
+                text_end = memchr (p, '<', end - p);
+                if (!text_end)
+                    goto out;
+            }
+
+            switch (el) {
+                case LPE_key:
+                case LPE_prefix:
+                    list_parser_decode (p, text_end, key);
+                    has_key = TRUE;
+                    break;
+                case LPE_size:
+                    list_parser_decode (p, text_end, value);
+                    size = strtoll (value->str, NULL, 10);
+                    break;
+                case LPE_last_modified: {
+                    struct tm tmp = {0};
+
+                    list_parser_decode (p, text_end, value);
+                    // 2013-04-11T15:16
+                    if (strptime (value->str, "%Y-%m-%dT%H:%M:%S", &tmp))
+                        last_modified = mktime (&tmp);
+                    break;
+                }
+                case LPE_etag:
+                    list_parser_decode (p, text_end, etag);
+                    break;
+                case LPE_is_truncated:
+                    list_parser_decode (p, text_end, value);
+                    result->is_truncated = !strcmp (value->str, "true");
+                    break;
+                case LPE_next_marker:
+                    list_parser_decode (p, text_end, value);
+                    g_free (result->next_marker);
+                    result->next_marker = g_strdup (value->str);
+                    break;
+                case LPE_next_continuation_token:
+                    list_parser_decode (p, text_end, value);
+                    g_free (result->next_continuation_token);
+                    result->next_continuation_token = g_strdup (value->str);
+                    break;
+                default:
+                    break;
+            }
+
+            p = text_end;
+        }
+    }
+
+    res = root_found;
+
+out:
+    g_string_free (key, TRUE);
+    g_string_free (value, TRUE);
+    g_string_free (etag, TRUE);
+
+    if (!res)
+        list_parser_result_clear (result);
+
+    return res;
+}
+
+void list_parser_result_clear (ListParserResult *result)
+{
+    g_free (result->next_marker);
+    result->next_marker = NULL;
+    g_free (result->next_continuation_token);
+    result->next_continuation_token = NULL;
+}
+/*}}}*/
@@ -22,6 +22,8 @@
 #include "utils.h"
 #include "client_pool.h"
 #include "cache_mng.h"
+#include "upload_journal.h"
+#include "dir_warmup.h"
 #include "stat_srv.h"
 #include "conf_keys.h"
 
@@ -37,6 +39,8 @@ struct _Application {
     RFuse *rfuse;
     DirTree *dir_tree;
     CacheMng *cmng;
+    UploadJournal *journal;
+    DirWarmup *warmup;
     StatSrv *stat_srv;
 
     // initial bucket ACL request
@@ -122,6 +126,11 @@ StatSrv *application_get_stat_srv (Application *app)
     return app->stat_srv;
 }
 
+UploadJournal *application_get_upload_journal (Application *app)
+{
+    return app->journal;
+}
+
 #ifdef SSL_ENABLED
 SSL_CTX *application_get_ssl_ctx (Application *app)
 {
@@ -416,6 +425,15 @@ static gint application_finish_initialization_and_run (Application *app)
     }
 /*}}}*/
 
+/*{{{ UploadJournal */
+    app->journal = upload_journal_create (app);
+    if (!app->journal) {
+        LOG_err (APP_LOG, "Failed to create UploadJournal !");
+        application_exit (app);
+        return -1;
+    }
+/*}}}*/
+
 /*{{{ DirTree*/
     app->dir_tree = dir_tree_create (app);
     if (!app->dir_tree) {
@@ -423,6 +441,8 @@ static gint application_finish_initialization_and_run (Application *app)
         application_exit (app);
         return -1;
     }
+
+    app->warmup = dir_warmup_create (app);
 /*}}}*/
 
 /*{{{ FUSE*/
@@ -479,6 +499,12 @@ static gint application_finish_initialization_and_run (Application *app)
     if (!conf_get_boolean (app->conf, "app.foreground"))
         fuse_daemonize (0);
 
+    // resume or abort multipart uploads left by the previous run
+    upload_journal_recover (app->journal);
+
+    // fill DirTree in background
+    dir_warmup_start (app->warmup);
+
     return 0;
 }
 /*}}}*/
@@ -515,12 +541,22 @@ static void application_destroy (Application *app)
     if (app->ops_client_pool)
         client_pool_destroy (app->ops_client_pool);
 
+    if (app->warmup)
+        dir_warmup_destroy (app->warmup);
+
+    // keep DirTree for the next start, if filesystem was mounted
+    if (app->dir_tree && app->rfuse)
+        dir_tree_snapshot_save (app->dir_tree);
+
     if (app->dir_tree)
         dir_tree_destroy (app->dir_tree);
 
     if (app->cmng)
         cache_mng_destroy (app->cmng);
 
+    if (app->journal)
+        upload_journal_destroy (app->journal);
+
     if (app->sigint_ev)
         event_free (app->sigint_ev);
     if (app->sigterm_ev)
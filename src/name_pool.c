@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2012-2014 Paul Ionkin <paul.ionkin@gmail.com>
+ * Copyright (C) 2012-2014 Skoobe GmbH. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "name_pool.h"
+
+/*{{{ struct / defines */
+
+struct _NamePool {
+    GHashTable *h_names; // name -> NamePoolItem, key points to the item's name
+    guint64 bytes;
+};
+
+typedef struct {
+    NamePool *pool;
+    guint32 ref;
+    gchar name[];
+} NamePoolItem;
+
+#define NAME_POOL_LOG "name_pool"
+#define NAME_POOL_ITEM(name) ((NamePoolItem *) ((gchar *) (name) - offsetof (NamePoolItem, name)))
+/*}}}*/
+
+/*{{{ create / destroy */
+
+NamePool *name_pool_create ()
+{
+    NamePool *pool;
+
+    pool = g_new0 (NamePool, 1);
+    pool->h_names = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_free);
+    pool->bytes = 0;
+
+    return pool;
+}
+
+void name_pool_destroy (NamePool *pool)
+{
+    if (g_hash_table_size (pool->h_names))
+        LOG_debug (NAME_POOL_LOG, "Destroying pool with %u names !", g_hash_table_size (pool->h_names));
+
+    g_hash_table_destroy (pool->h_names);
+    g_free (pool);
+}
+/*}}}*/
+
+/*{{{ ref / unref */
+
+const gchar *name_pool_ref (NamePool *pool, const gchar *name)
+{
+    NamePoolItem *item;
+    size_t len;
+
+    item = g_hash_table_lookup (pool->h_names, name);
+    if (item) {
+        item->ref++;
+        return item->name;
+    }
+
+    len = strlen (name);
+    item = g_malloc (sizeof (NamePoolItem) + len + 1);
+    item->pool = pool;
+    item->ref = 1;
+    memcpy (item->name, name, len + 1);
+
+    g_hash_table_insert (pool->h_names, item->name, item);
+    pool->bytes += sizeof (NamePoolItem) + len + 1;
+
+    return item->name;
+}
+
+void name_pool_unref (const gchar *name)
+{
+    NamePoolItem *item;
+    NamePool *pool;
+
+    if (!name)
+        return;
+
+    item = NAME_POOL_ITEM (name);
+    item->ref--;
+    if (item->ref)
+        return;
+
+    pool = item->pool;
+    pool->bytes -= sizeof (NamePoolItem) + strlen (item->name) + 1;
+    // frees item
+    g_hash_table_remove (pool->h_names, item->name);
+}
+
+void name_pool_get_stats (NamePool *pool, guint *count, guint64 *bytes)
+{
+    *count = g_hash_table_size (pool->h_names);
+    *bytes = pool->bytes;
+}
+/*}}}*/
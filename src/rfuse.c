@@ -17,6 +17,7 @@
  */
 #include "rfuse.h"
 #include "dir_tree.h"
+#include "dir_buf.h"
 
 // error codes: /usr/include/asm/errno.h /usr/include/asm-generic/errno-base.h
 
@@ -29,7 +30,9 @@ struct _RFuse {
 
     // the session that we use to process the fuse stuff
     struct fuse_session *session;
+#if FUSE_USE_VERSION < 30
     struct fuse_chan *chan;
+#endif
     // the event that we use to receive requests
     struct event *ev;
     struct event *ev_timer;
@@ -51,6 +54,16 @@ struct _RFuse {
     pthread_t *unmount_thread;
 #endif
 
+    // kernel cache invalidation requests, sent from a separate thread:
+    // the kernel might hold the inode lock, while waiting for the reply to a request in the main loop
+    pthread_t notify_thread;
+    gboolean notify_started;
+    gboolean notify_stop;
+    gboolean notify_unsupported; // set by the thread if the kernel is too old
+    pthread_mutex_t notify_lock;
+    pthread_cond_t notify_cond;
+    GQueue *q_notify; // RFuseNotify
+
     // statistics
     guint64 read_ops;
     guint64 write_ops;
@@ -62,16 +75,27 @@ struct _RFuse {
     gint gid;
 };
 
+// kernel cache invalidation request
+typedef struct {
+    fuse_ino_t ino; // parent directory for name invalidation
+    gchar *name; // NULL to invalidate inode attributes and data
+} RFuseNotify;
+
+// pending notifications are dropped if the kernel doesn't keep up
+#define RFUSE_NOTIFY_MAX_PENDING 65536
+
 #define FUSE_LOG "fuse"
-#define ENTRY_TIMEOUT 1.0
-#define ATTR_TIMEOUT 1.0
 /*}}}*/
 
 /*{{{ func declarations */
 static void rfuse_init (void *userdata, struct fuse_conn_info *conn);
 static void rfuse_dest (void *userdata);
 static void rfuse_on_read (evutil_socket_t fd, short what, void *arg);
+static void *rfuse_notify_thread (void *arg);
 static void rfuse_readdir (fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi);
+#if FUSE_USE_VERSION >= 30
+static void rfuse_readdirplus (fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi);
+#endif
 static void rfuse_opendir (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
 static void rfuse_releasedir (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
 static void rfuse_lookup (fuse_req_t req, fuse_ino_t parent_ino, const char *name);
@@ -87,7 +111,11 @@ static void rfuse_unlink (fuse_req_t req, fuse_ino_t parent_ino, const char *nam
 static void rfuse_mkdir (fuse_req_t req, fuse_ino_t parent_ino, const char *name, mode_t mode);
 static void rfuse_rmdir (fuse_req_t req, fuse_ino_t parent_ino, const char *name);
 //static void rfuse_on_timer (evutil_socket_t fd, short what, void *arg);
+#if FUSE_USE_VERSION >= 30
+static void rfuse_rename (fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newparent, const char *newname, unsigned int flags);
+#else
 static void rfuse_rename (fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newparent, const char *newname);
+#endif
 #if defined(__APPLE__)
     static void rfuse_getxattr (fuse_req_t req, fuse_ino_t ino, const char *name, size_t size, uint32_t position);
 #else
@@ -104,6 +132,9 @@ static struct fuse_lowlevel_ops rfuse_opers = {
     .destroy    = rfuse_dest,
     .opendir    = rfuse_opendir,
     .readdir    = rfuse_readdir,
+#if FUSE_USE_VERSION >= 30
+    .readdirplus = rfuse_readdirplus,
+#endif
     .releasedir = rfuse_releasedir,
     .lookup     = rfuse_lookup,
     .getattr    = rfuse_getattr,
@@ -178,16 +209,30 @@ RFuse *rfuse_new (Application *app, const gchar *mountpoint, const gchar *fuse_o
 
     g_free (opts);
 
-    if ((rfuse->chan = fuse_mount (rfuse->mountpoint, &args)) == NULL) {
+#if FUSE_USE_VERSION >= 30
+    // allocate a low-level session, mount options are parsed by the session
+    rfuse->session = fuse_session_new (&args, &rfuse_opers, sizeof (rfuse_opers), rfuse);
+    fuse_opt_free_args (&args);
+    if (!rfuse->session) {
+        LOG_err (FUSE_LOG, "Failed to init FUSE !");
+        return NULL;
+    }
+
+    if (fuse_session_mount (rfuse->session, rfuse->mountpoint)) {
         LOG_err (FUSE_LOG, "Failed to mount FUSE partition !");
         return NULL;
     }
     rfuse->mounted = TRUE;
-    fuse_opt_free_args (&args);
 
-#if FUSE_USE_VERSION >= 30
     rfuse->fbuf.mem = NULL;
 #else
+    if ((rfuse->chan = fuse_mount (rfuse->mountpoint, &args)) == NULL) {
+        LOG_err (FUSE_LOG, "Failed to mount FUSE partition !");
+        return NULL;
+    }
+    rfuse->mounted = TRUE;
+    fuse_opt_free_args (&args);
+
     // the receive buffer stuff
     rfuse->recv_size = fuse_chan_bufsize (rfuse->chan);
 
@@ -196,7 +241,6 @@ RFuse *rfuse_new (Application *app, const gchar *mountpoint, const gchar *fuse_o
         LOG_err (FUSE_LOG, "Failed to allocate memory !");
         return NULL;
     }
-#endif
 
     // allocate a low-level session
     rfuse->session = fuse_lowlevel_new (NULL, &rfuse_opers, sizeof (rfuse_opers), rfuse);
@@ -206,9 +250,24 @@ RFuse *rfuse_new (Application *app, const gchar *mountpoint, const gchar *fuse_o
     }
 
     fuse_session_add_chan (rfuse->session, rfuse->chan);
+#endif
+
+    rfuse->q_notify = g_queue_new ();
+    pthread_mutex_init (&rfuse->notify_lock, NULL);
+    pthread_cond_init (&rfuse->notify_cond, NULL);
+    rfuse->notify_stop = FALSE;
+    rfuse->notify_unsupported = FALSE;
+    rfuse->notify_started = pthread_create (&rfuse->notify_thread, NULL, &rfuse_notify_thread, rfuse) == 0;
+    if (!rfuse->notify_started)
+        LOG_err (FUSE_LOG, "Failed to start notification thread, kernel cache is not invalidated !");
 
     rfuse->ev = event_new (application_get_evbase (app),
-        fuse_chan_fd (rfuse->chan), EV_READ, &rfuse_on_read,
+#if FUSE_USE_VERSION >= 30
+        fuse_session_fd (rfuse->session),
+#else
+        fuse_chan_fd (rfuse->chan),
+#endif
+        EV_READ, &rfuse_on_read,
         rfuse
     );
     if (!rfuse->ev) {
@@ -250,6 +309,25 @@ void rfuse_destroy (RFuse *rfuse)
 
     g_free (rfuse->mountpoint);
 
+    if (rfuse->notify_started) {
+        pthread_mutex_lock (&rfuse->notify_lock);
+        rfuse->notify_stop = TRUE;
+        pthread_cond_signal (&rfuse->notify_cond);
+        pthread_mutex_unlock (&rfuse->notify_lock);
+        pthread_join (rfuse->notify_thread, NULL);
+    }
+    if (rfuse->q_notify) {
+        RFuseNotify *notify;
+
+        while ((notify = g_queue_pop_head (rfuse->q_notify))) {
+            g_free (notify->name);
+            g_free (notify);
+        }
+        g_queue_free (rfuse->q_notify);
+        pthread_mutex_destroy (&rfuse->notify_lock);
+        pthread_cond_destroy (&rfuse->notify_cond);
+    }
+
 #if FUSE_USE_VERSION >= 30
     free (rfuse->fbuf.mem);
 #else
@@ -269,7 +347,11 @@ static void *rfuse_unmount_internal (void *arg)
 {
     RFuse *rfuse = (RFuse *)arg;
 
+#if FUSE_USE_VERSION >= 30
+    fuse_session_unmount (rfuse->session);
+#else
     fuse_unmount (rfuse->mountpoint, rfuse->chan);
+#endif
     return NULL;
 }
 
@@ -324,10 +406,18 @@ static void rfuse_on_timer (evutil_socket_t fd, short what, void *arg)
 }
 */
 
-// turn ASYNC read off
+// turn ASYNC read off, get O_TRUNC in open flags
 static void rfuse_init (G_GNUC_UNUSED void *userdata, struct fuse_conn_info *conn)
 {
+#if FUSE_USE_VERSION >= 30
+    conn->want &= ~FUSE_CAP_ASYNC_READ;
+#else
     conn->async_read = 0;
+#endif
+#ifdef FUSE_CAP_ATOMIC_O_TRUNC
+    if (conn->capable & FUSE_CAP_ATOMIC_O_TRUNC)
+        conn->want |= FUSE_CAP_ATOMIC_O_TRUNC;
+#endif
 }
 
 static void rfuse_dest (void *userdata)
@@ -342,13 +432,17 @@ static void rfuse_dest (void *userdata)
 static void rfuse_on_read (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short what, void *arg)
 {
     RFuse *rfuse = (RFuse *)arg;
+#if FUSE_USE_VERSION < 30
     struct fuse_chan *ch = rfuse->chan;
+#endif
     int res;
 
+#if FUSE_USE_VERSION < 30
     if (!ch) {
         LOG_err (FUSE_LOG, "No FUSE channel !");
         return;
     }
+#endif
 
     if (fuse_session_exited (rfuse->session)) {
         LOG_err (FUSE_LOG, "No FUSE session !");
@@ -359,7 +453,7 @@ static void rfuse_on_read (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short
     do {
         // a new fuse_req is available
 #if FUSE_USE_VERSION >= 30
-        res = fuse_session_receive_buf (rfuse->session, &rfuse->fbuf, ch);
+        res = fuse_session_receive_buf (rfuse->session, &rfuse->fbuf);
 #else
         res = fuse_chan_recv (&ch, rfuse->recv_buf, rfuse->recv_size);
 #endif
@@ -375,7 +469,7 @@ static void rfuse_on_read (G_GNUC_UNUSED evutil_socket_t fd, G_GNUC_UNUSED short
      //   LOG_debug (FUSE_LOG, "got %d bytes from /dev/fuse", res);
 
 #if FUSE_USE_VERSION >= 30
-        fuse_session_process_buf (rfuse->session, &rfuse->fbuf, ch);
+        fuse_session_process_buf (rfuse->session, &rfuse->fbuf);
 #else
         fuse_session_process (rfuse->session, rfuse->recv_buf, res, ch);
 #endif
@@ -477,6 +571,111 @@ static void rfuse_readdir (fuse_req_t req, fuse_ino_t ino, size_t size, off_t of
 }
 /*}}}*/
 
+#if FUSE_USE_VERSION >= 30
+/*{{{ readdirplus operation */
+
+typedef struct {
+    fuse_req_t req;
+    RFuse *rfuse;
+    gchar *p; // reply buffer
+    size_t size; // used bytes
+    size_t max_size;
+    GArray *a_inodes; // entries which lookup count is increased by the reply
+} RFuseDirPlusData;
+
+static gboolean rfuse_readdirplus_on_entry_cb (const gchar *name, fuse_ino_t ino, mode_t mode, off_t next_off, gpointer ctx)
+{
+    RFuseDirPlusData *data = (RFuseDirPlusData *) ctx;
+    struct fuse_entry_param e;
+    int en_mode;
+    off_t file_size;
+    time_t ctime;
+    size_t entry_size;
+
+    memset (&e, 0, sizeof (e));
+    e.attr.st_ino = ino;
+    e.attr.st_mode = mode;
+
+    // "." and ".." don't change lookup count, entries which are not in DirTree are looked up by the kernel
+    if (strcmp (name, ".") && strcmp (name, "..") &&
+        dir_tree_get_cached_attr (data->rfuse->dir_tree, ino, &en_mode, &file_size, &ctime)) {
+        e.ino = ino;
+        e.attr_timeout = dir_tree_get_timeout (data->rfuse->dir_tree, ino);
+        e.entry_timeout = e.attr_timeout;
+
+        e.attr.st_mode = en_mode;
+        e.attr.st_nlink = 1;
+        e.attr.st_size = file_size;
+        e.attr.st_ctime = ctime;
+        e.attr.st_atime = ctime;
+        e.attr.st_mtime = ctime;
+        if (data->rfuse->uid >= 0)
+            e.attr.st_uid = data->rfuse->uid;
+        if (data->rfuse->gid >= 0)
+            e.attr.st_gid = data->rfuse->gid;
+    }
+
+    entry_size = fuse_add_direntry_plus (data->req, data->p + data->size, data->max_size - data->size, name, &e, next_off);
+    // reply buffer is full
+    if (data->size + entry_size > data->max_size)
+        return FALSE;
+
+    data->size += entry_size;
+    if (e.ino)
+        g_array_append_val (data->a_inodes, ino);
+
+    return TRUE;
+}
+
+// readdirplus callback, "buf" is the directory buffer, "off" is an offset in it
+// Valid replies: fuse_reply_buf() fuse_reply_err()
+static void rfuse_readdirplus_cb (fuse_req_t req, gboolean success, size_t max_size, off_t off,
+    const char *buf, size_t buf_size, G_GNUC_UNUSED gpointer ctx)
+{
+    RFuseDirPlusData data;
+    guint i;
+
+    LOG_debug (FUSE_LOG, "readdirplus_cb  success: %s, buf_size: %zu, size: %zu, off: %"OFF_FMT,
+        success?"YES":"NO", buf_size, max_size, off);
+
+    if (!success) {
+        fuse_reply_err (req, ENOTDIR);
+        return;
+    }
+
+    data.req = req;
+    data.rfuse = fuse_req_userdata (req);
+    data.p = g_malloc (max_size);
+    data.size = 0;
+    data.max_size = max_size;
+    data.a_inodes = g_array_new (FALSE, FALSE, sizeof (fuse_ino_t));
+
+    dir_buf_data_foreach (buf, buf_size, off, rfuse_readdirplus_on_entry_cb, &data);
+
+    if (!fuse_reply_buf (req, data.p, data.size)) {
+        for (i = 0; i < data.a_inodes->len; i++)
+            dir_tree_lookup_ref (data.rfuse->dir_tree, g_array_index (data.a_inodes, fuse_ino_t, i));
+    }
+
+    g_array_free (data.a_inodes, TRUE);
+    g_free (data.p);
+}
+
+// FUSE lowlevel operation: readdirplus
+// Valid replies: fuse_reply_buf() fuse_reply_err()
+// names are returned with attributes, so the kernel doesn't send lookup for every entry
+static void rfuse_readdirplus (fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
+{
+    RFuse *rfuse = fuse_req_userdata (req);
+
+    LOG_debug (FUSE_LOG, INO_H"readdirplus inode, size: %zu, off: %"OFF_FMT, INO_T (ino), size, off);
+
+    rfuse->readdir_ops++;
+    dir_tree_fill_dir_buf (rfuse->dir_tree, ino, size, off, rfuse_readdirplus_cb, req, NULL, fi);
+}
+/*}}}*/
+#endif
+
 /*{{{ getattr operation */
 
 // getattr callback
@@ -503,7 +702,7 @@ static void rfuse_getattr_cb (fuse_req_t req, gboolean success, fuse_ino_t ino,
     if (rfuse->gid >= 0)
         stbuf.st_gid = rfuse->gid;
 
-    fuse_reply_attr (req, &stbuf, 1.0);
+    fuse_reply_attr (req, &stbuf, dir_tree_get_timeout (rfuse->dir_tree, ino));
 }
 
 // FUSE lowlevel operation: getattr
@@ -540,7 +739,7 @@ static void rfuse_setattr_cb (fuse_req_t req, gboolean success, fuse_ino_t ino,
     if (rfuse->gid >= 0)
         stbuf.st_gid = rfuse->gid;
 
-    fuse_reply_attr (req, &stbuf, 1.0);
+    fuse_reply_attr (req, &stbuf, dir_tree_get_timeout (rfuse->dir_tree, ino));
 }
 
 // FUSE lowlevel operation: setattr
@@ -569,8 +768,8 @@ static void rfuse_lookup_cb (fuse_req_t req, gboolean success, fuse_ino_t ino, i
 
     memset(&e, 0, sizeof(e));
     e.ino = ino;
-    e.attr_timeout = ATTR_TIMEOUT;
-    e.entry_timeout = ENTRY_TIMEOUT;
+    e.attr_timeout = dir_tree_get_timeout (rfuse->dir_tree, ino);
+    e.entry_timeout = e.attr_timeout;
 
     e.attr.st_ino = ino;
     e.attr.st_mode = mode;
@@ -584,7 +783,8 @@ static void rfuse_lookup_cb (fuse_req_t req, gboolean success, fuse_ino_t ino, i
     if (rfuse->gid >= 0)
         e.attr.st_gid = rfuse->gid;
 
-    fuse_reply_entry (req, &e);
+    if (!fuse_reply_entry (req, &e))
+        dir_tree_lookup_ref (rfuse->dir_tree, ino);
 }
 
 // FUSE lowlevel operation: lookup
@@ -638,8 +838,8 @@ void rfuse_create_cb (fuse_req_t req, gboolean success, fuse_ino_t ino, int mode
 
     memset(&e, 0, sizeof(e));
     e.ino = ino;
-    e.attr_timeout = ATTR_TIMEOUT;
-    e.entry_timeout = ENTRY_TIMEOUT;
+    e.attr_timeout = dir_tree_get_timeout (rfuse->dir_tree, ino);
+    e.entry_timeout = e.attr_timeout;
 
     e.attr.st_ino = ino;
     e.attr.st_mode = mode;
@@ -650,7 +850,8 @@ void rfuse_create_cb (fuse_req_t req, gboolean success, fuse_ino_t ino, int mode
     if (rfuse->gid >= 0)
         e.attr.st_gid = rfuse->gid;
 
-    fuse_reply_create (req, &e, fi);
+    if (!fuse_reply_create (req, &e, fi))
+        dir_tree_lookup_ref (rfuse->dir_tree, ino);
 }
 
 // FUSE lowlevel operation: create
@@ -738,26 +939,17 @@ static void rfuse_write (fuse_req_t req, fuse_ino_t ino, const char *buf, size_t
 
 /*{{{ forget operation*/
 
-// forget callback
-static void rfuse_forget_cb (fuse_req_t req, G_GNUC_UNUSED gboolean success)
-{
-    fuse_reply_none (req);
-}
-
 // Forget about an inode
 // Valid replies: fuse_reply_none
-// XXX: it removes files and directories
+// entries which are not referenced by the kernel can be evicted from DirTree
 static void rfuse_forget (fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
 {
     RFuse *rfuse = fuse_req_userdata (req);
 
     LOG_debug (FUSE_LOG, INO_H"forget nlookup: %lu", INO_T (ino), nlookup);
 
-    if (nlookup != 0) {
-        LOG_debug (FUSE_LOG, "Ignoring forget with nlookup > 0");
-        fuse_reply_none (req);
-    } else
-        dir_tree_file_remove (rfuse->dir_tree, ino, rfuse_forget_cb, req);
+    dir_tree_forget (rfuse->dir_tree, ino, nlookup);
+    fuse_reply_none (req);
 }
 /*}}}*/
 
@@ -775,7 +967,6 @@ static void rfuse_unlink_cb (fuse_req_t req, gboolean success)
 
 // Remove a file
 // Valid replies: fuse_reply_err
-// XXX: not used, see rfuse_forget
 static void rfuse_unlink (fuse_req_t req, fuse_ino_t parent, const char *name)
 {
     RFuse *rfuse = fuse_req_userdata (req);
@@ -802,8 +993,8 @@ static void rfuse_mkdir_cb (fuse_req_t req, gboolean success, fuse_ino_t ino, in
 
     memset(&e, 0, sizeof(e));
     e.ino = ino;
-    e.attr_timeout = ATTR_TIMEOUT;
-    e.entry_timeout = ENTRY_TIMEOUT;
+    e.attr_timeout = dir_tree_get_timeout (rfuse->dir_tree, ino);
+    e.entry_timeout = e.attr_timeout;
     e.attr.st_mode = mode;
     e.attr.st_nlink = 1;
     e.attr.st_ctime = ctime;
@@ -817,7 +1008,8 @@ static void rfuse_mkdir_cb (fuse_req_t req, gboolean success, fuse_ino_t ino, in
     e.attr.st_ino = ino;
     e.attr.st_size = file_size;
 
-    fuse_reply_entry (req, &e);
+    if (!fuse_reply_entry (req, &e))
+        dir_tree_lookup_ref (rfuse->dir_tree, ino);
 }
 
 // Create a directory
@@ -866,10 +1058,22 @@ static void rfuse_rename_cb (fuse_req_t req, gboolean success)
 
 // Rename file or directory
 // Valid replies: fuse_reply_err
+#if FUSE_USE_VERSION >= 30
+static void rfuse_rename (fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newparent, const char *newname, unsigned int flags)
+#else
 static void rfuse_rename (fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newparent, const char *newname)
+#endif
 {
     RFuse *rfuse = fuse_req_userdata (req);
 
+#if FUSE_USE_VERSION >= 30
+    // RENAME_NOREPLACE and RENAME_EXCHANGE can't be done atomically on S3
+    if (flags) {
+        fuse_reply_err (req, EINVAL);
+        return;
+    }
+#endif
+
     LOG_debug (FUSE_LOG, "rename  parent_ino: %"INO_FMT", name: %s new_parent_in: %"INO_FMT", newname: %s",
         INO parent, name, INO newparent, newname);
 
@@ -927,6 +1131,86 @@ static void rfuse_getxattr_cb (fuse_req_t req, gboolean success, fuse_ino_t ino,
 }
 /*}}}*/
 
+/*{{{ notify */
+
+static void *rfuse_notify_thread (void *arg)
+{
+    RFuse *rfuse = (RFuse *) arg;
+    RFuseNotify *notify;
+    int res;
+
+    for (;;) {
+        pthread_mutex_lock (&rfuse->notify_lock);
+        while (!rfuse->notify_stop && g_queue_is_empty (rfuse->q_notify))
+            pthread_cond_wait (&rfuse->notify_cond, &rfuse->notify_lock);
+        if (rfuse->notify_stop) {
+            pthread_mutex_unlock (&rfuse->notify_lock);
+            break;
+        }
+        notify = g_queue_pop_head (rfuse->q_notify);
+        pthread_mutex_unlock (&rfuse->notify_lock);
+
+        // blocks until the kernel gets the inode lock
+#if FUSE_USE_VERSION >= 30
+        if (notify->name)
+            res = fuse_lowlevel_notify_inval_entry (rfuse->session, notify->ino, notify->name, strlen (notify->name));
+        else
+            res = fuse_lowlevel_notify_inval_inode (rfuse->session, notify->ino, 0, 0);
+#else
+        if (notify->name)
+            res = fuse_lowlevel_notify_inval_entry (rfuse->chan, notify->ino, notify->name, strlen (notify->name));
+        else
+            res = fuse_lowlevel_notify_inval_inode (rfuse->chan, notify->ino, 0, 0);
+#endif
+        g_free (notify->name);
+        g_free (notify);
+
+        // -ENOENT: kernel doesn't have it in the cache
+        if (res == -ENOSYS) {
+            LOG_err (FUSE_LOG, "Kernel doesn't support cache invalidation requests !");
+            pthread_mutex_lock (&rfuse->notify_lock);
+            rfuse->notify_unsupported = TRUE;
+            pthread_mutex_unlock (&rfuse->notify_lock);
+            break;
+        } else if (res && res != -ENOENT) {
+            LOG_debug (FUSE_LOG, "Failed to send cache invalidation request: %s", strerror (-res));
+        }
+    }
+
+    return NULL;
+}
+
+static void rfuse_notify_add (RFuse *rfuse, fuse_ino_t ino, const gchar *name)
+{
+    RFuseNotify *notify;
+
+    if (!rfuse || !rfuse->notify_started)
+        return;
+
+    pthread_mutex_lock (&rfuse->notify_lock);
+    if (!rfuse->notify_unsupported && g_queue_get_length (rfuse->q_notify) < RFUSE_NOTIFY_MAX_PENDING) {
+        notify = g_new0 (RFuseNotify, 1);
+        notify->ino = ino;
+        notify->name = g_strdup (name);
+        g_queue_push_tail (rfuse->q_notify, notify);
+        pthread_cond_signal (&rfuse->notify_cond);
+    }
+    pthread_mutex_unlock (&rfuse->notify_lock);
+}
+
+void rfuse_notify_inval_inode (RFuse *rfuse, fuse_ino_t ino)
+{
+    LOG_debug (FUSE_LOG, INO_H"Invalidating kernel cache", INO_T (ino));
+    rfuse_notify_add (rfuse, ino, NULL);
+}
+
+void rfuse_notify_inval_entry (RFuse *rfuse, fuse_ino_t parent_ino, const gchar *name)
+{
+    LOG_debug (FUSE_LOG, INO_H"Invalidating kernel cache of entry: %s", INO_T (parent_ino), name);
+    rfuse_notify_add (rfuse, parent_ino, name);
+}
+/*}}}*/
+
 /*{{{ get_stats */
 void rfuse_get_stats (RFuse *rfuse, guint64 *read_ops, guint64 *write_ops, guint64 *readdir_ops, guint64 *lookup_ops)
 {
@@ -972,8 +1256,8 @@ static void rfuse_symlik_cb (fuse_req_t req, gboolean success, fuse_ino_t ino, i
 
     memset(&e, 0, sizeof(e));
     e.ino = ino;
-    e.attr_timeout = ATTR_TIMEOUT;
-    e.entry_timeout = ENTRY_TIMEOUT;
+    e.attr_timeout = dir_tree_get_timeout (rfuse->dir_tree, ino);
+    e.entry_timeout = e.attr_timeout;
 
     e.attr.st_ino = ino;
     e.attr.st_mode = mode;
@@ -987,7 +1271,8 @@ static void rfuse_symlik_cb (fuse_req_t req, gboolean success, fuse_ino_t ino, i
     if (rfuse->gid >= 0)
         e.attr.st_gid = rfuse->gid;
 
-    fuse_reply_entry (req, &e);
+    if (!fuse_reply_entry (req, &e))
+        dir_tree_lookup_ref (rfuse->dir_tree, ino);
 }
 
 static void rfuse_symlink (fuse_req_t req, const char *link, fuse_ino_t parent_ino, const char *name)
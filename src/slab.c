@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2012-2014 Paul Ionkin <paul.ionkin@gmail.com>
+ * Copyright (C) 2012-2014 Skoobe GmbH. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "slab.h"
+
+/*{{{ struct / defines */
+
+typedef struct _SlabBlock SlabBlock;
+
+struct _Slab {
+    size_t obj_size;
+    guint block_capacity; // objects per block
+    SlabBlock *partial; // blocks with free objects
+    guint64 objects;
+    guint64 blocks;
+};
+
+// header at the beginning of every block
+struct _SlabBlock {
+    Slab *slab;
+    SlabBlock *prev; // in "partial" list
+    SlabBlock *next;
+    gpointer free_list; // freed objects, linked through their first pointer
+    guint used; // allocated objects
+    guint initialized; // objects which were ever allocated, the rest of block was never touched
+};
+
+#define SLAB_LOG "slab"
+#define SLAB_BLOCK_SIZE (64 * 1024)
+// objects start after the header, aligned the same way as malloc () does
+#define SLAB_HEADER_SIZE ((sizeof (SlabBlock) + 15) & ~(size_t) 15)
+#define SLAB_BLOCK_DATA(block) ((gchar *) (block) + SLAB_HEADER_SIZE)
+/*}}}*/
+
+/*{{{ create / destroy */
+
+Slab *slab_create (size_t obj_size)
+{
+    Slab *slab;
+
+    slab = g_new0 (Slab, 1);
+    // free list pointer is stored in freed objects
+    slab->obj_size = (MAX (obj_size, sizeof (gpointer)) + sizeof (gpointer) - 1) & ~(sizeof (gpointer) - 1);
+    slab->block_capacity = (SLAB_BLOCK_SIZE - SLAB_HEADER_SIZE) / slab->obj_size;
+    slab->partial = NULL;
+    slab->objects = 0;
+    slab->blocks = 0;
+
+    g_assert (slab->block_capacity > 0);
+
+    return slab;
+}
+
+void slab_destroy (Slab *slab)
+{
+    SlabBlock *block;
+
+    if (slab->objects)
+        LOG_debug (SLAB_LOG, "Destroying slab with %"G_GUINT64_FORMAT" objects !", slab->objects);
+
+    // full blocks are not referenced by slab
+    while (slab->partial) {
+        block = slab->partial;
+        slab->partial = block->next;
+        free (block);
+    }
+
+    g_free (slab);
+}
+/*}}}*/
+
+/*{{{ alloc / free */
+
+static void slab_partial_remove (Slab *slab, SlabBlock *block)
+{
+    if (block->prev)
+        block->prev->next = block->next;
+    else
+        slab->partial = block->next;
+    if (block->next)
+        block->next->prev = block->prev;
+    block->prev = block->next = NULL;
+}
+
+static void slab_partial_add (Slab *slab, SlabBlock *block)
+{
+    block->prev = NULL;
+    block->next = slab->partial;
+    if (slab->partial)
+        slab->partial->prev = block;
+    slab->partial = block;
+}
+
+gpointer slab_alloc0 (Slab *slab)
+{
+    SlabBlock *block;
+    gpointer obj;
+
+    if (!slab->partial) {
+        gpointer p;
+
+        if (posix_memalign (&p, SLAB_BLOCK_SIZE, SLAB_BLOCK_SIZE)) {
+            LOG_err (SLAB_LOG, "Failed to allocate slab block !");
+            g_error ("Out of memory");
+        }
+        block = (SlabBlock *) p;
+        block->slab = slab;
+        block->free_list = NULL;
+        block->used = 0;
+        block->initialized = 0;
+        slab_partial_add (slab, block);
+        slab->blocks++;
+    }
+
+    block = slab->partial;
+    if (block->free_list) {
+        obj = block->free_list;
+        block->free_list = *(gpointer *) obj;
+    } else {
+        obj = SLAB_BLOCK_DATA (block) + block->initialized * slab->obj_size;
+        block->initialized++;
+    }
+
+    block->used++;
+    if (block->used == slab->block_capacity)
+        slab_partial_remove (slab, block);
+
+    slab->objects++;
+    memset (obj, 0, slab->obj_size);
+
+    return obj;
+}
+
+void slab_free (gpointer obj)
+{
+    SlabBlock *block;
+    Slab *slab;
+
+    if (!obj)
+        return;
+
+    block = (SlabBlock *) ((guintptr) obj & ~(guintptr) (SLAB_BLOCK_SIZE - 1));
+    slab = block->slab;
+
+    // block was full
+    if (block->used == slab->block_capacity)
+        slab_partial_add (slab, block);
+
+    *(gpointer *) obj = block->free_list;
+    block->free_list = obj;
+    block->used--;
+    slab->objects--;
+
+    // keep the last block to avoid allocating it again for the next object
+    if (!block->used && (slab->partial != block || block->next)) {
+        slab_partial_remove (slab, block);
+        free (block);
+        slab->blocks--;
+    }
+}
+
+void slab_get_stats (Slab *slab, guint64 *objects, guint64 *bytes)
+{
+    *objects = slab->objects;
+    *bytes = slab->blocks * SLAB_BLOCK_SIZE;
+}
+/*}}}*/
@@ -122,6 +122,12 @@ static void stat_srv_on_stats_cb (struct evhttp_request *req, void *ctx)
     GString *str;
     struct evhttp_uri *uri;
     guint32 total_inodes, file_num, dir_num;
+    guint32 negative_entries;
+    guint64 negative_hits;
+    guint32 max_inodes;
+    guint64 evicted;
+    guint32 stale_time;
+    guint64 stale_hits;
     guint64 read_ops, write_ops, readdir_ops, lookup_ops;
     guint32 cache_entries;
     guint64 total_cache_size, cache_hits, cache_miss;
@@ -169,6 +175,15 @@ static void stat_srv_on_stats_cb (struct evhttp_request *req, void *ctx)
     dir_tree_get_stats (application_get_dir_tree (stat_srv->app), &total_inodes, &file_num, &dir_num);
     g_string_append_printf (str, "<BR>DirTree: <BR>-Total inodes: %u, Total files: %u, Total directories: %u<BR>",
         total_inodes, file_num, dir_num);
+    dir_tree_get_negative_cache_stats (application_get_dir_tree (stat_srv->app), &negative_entries, &negative_hits);
+    g_string_append_printf (str, "-Negative lookup cache: entries: %u, hits: %"G_GUINT64_FORMAT"<BR>",
+        negative_entries, negative_hits);
+    dir_tree_get_eviction_stats (application_get_dir_tree (stat_srv->app), &max_inodes, &evicted);
+    g_string_append_printf (str, "-Inodes limit: %u, evicted entries: %"G_GUINT64_FORMAT"<BR>",
+        max_inodes, evicted);
+    dir_tree_get_stale_stats (application_get_dir_tree (stat_srv->app), &stale_time, &stale_hits);
+    g_string_append_printf (str, "-Stale window: %u sec, stale hits: %"G_GUINT64_FORMAT"<BR>",
+        stale_time, stale_hits);
 
     // Fuse
     rfuse_get_stats (application_get_rfuse (stat_srv->app), &read_ops, &write_ops, &readdir_ops, &lookup_ops);
@@ -186,8 +201,10 @@ static void stat_srv_on_stats_cb (struct evhttp_request *req, void *ctx)
         client_pool_get_client_count (application_get_read_client_pool (stat_srv->app)));
     client_pool_get_client_stats_info (application_get_read_client_pool (stat_srv->app), str, &print_format_http);
 
-    g_string_append_printf (str, "<BR>Write workers (%d): <BR>",
-        client_pool_get_client_count (application_get_write_client_pool (stat_srv->app)));
+    g_string_append_printf (str, "<BR>Write workers (%d, queued: %u interactive, %u bulk): <BR>",
+        client_pool_get_client_count (application_get_write_client_pool (stat_srv->app)),
+        client_pool_get_queue_depth (application_get_write_client_pool (stat_srv->app), CLIENT_POOL_LANE_INTERACTIVE),
+        client_pool_get_queue_depth (application_get_write_client_pool (stat_srv->app), CLIENT_POOL_LANE_BULK));
     client_pool_get_client_stats_info (application_get_write_client_pool (stat_srv->app), str, &print_format_http);
 
     g_string_append_printf (str, "<BR>Op workers (%d): <BR>",
@@ -0,0 +1,984 @@
+/*
+ * Copyright (C) 2012-2014 Paul Ionkin <paul.ionkin@gmail.com>
+ * Copyright (C) 2012-2014 Skoobe GmbH. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "upload_journal.h"
+#include "http_connection.h"
+#include "client_pool.h"
+#include "cache_mng.h"
+#include "utils.h"
+#include "conf.h"
+
+#include <sys/file.h>
+
+// Journal file is a list of text records, one per line:
+//   bucket <bucket name>
+//   path <object path>
+//   uploadid <UploadId>
+//   base <ETag>                (ETag of the object when the upload started, not set for new objects)
+//   started <time>             (time when the upload started)
+//   part <part number> <offset> <size> <MD5 hex string>
+//   done <part number> <ETag>
+//   size <total file size>     (file is released, all data is in data file)
+//
+// Data file is a hard link to the CacheMng file of the uploaded file, data is not written twice.
+
+/*{{{ struct */
+struct _UploadJournal {
+    Application *app;
+    gchar *journal_dir;
+    gboolean enabled;
+};
+
+struct _UploadJournalEntry {
+    UploadJournal *journal;
+    gchar *name;
+    int fd;         // journal file, locked while upload is active
+    int data_fd;    // link to the cache file, opened to sync the data
+};
+
+typedef struct {
+    guint part_number;
+    guint64 off;
+    guint64 size;
+    gchar *md5str;
+    gchar *etag; // ETag returned by the server, unquoted, NULL if unknown (isn't MD5 with SSE-KMS)
+    gboolean done;
+} JournalPart;
+
+// restored upload
+typedef struct {
+    UploadJournal *journal;
+    gchar *name;
+    int fd;
+    int data_fd;
+
+    gchar *fname;
+    gchar *uploadid;
+    gchar *base_etag; // ETag of the object when the upload started, NULL for a new object
+    time_t started;
+    GList *l_parts; // list of JournalPart, sorted by part number
+    gboolean released;
+    guint64 size;
+
+    GList *l_current; // part which is currently uploading
+    guint part_marker;
+} JournalRecovery;
+
+#define JOURNAL_LOG "journal"
+#define JOURNAL_EXT ".journal"
+#define JOURNAL_DATA_EXT ".data"
+/*}}}*/
+
+/*{{{ create / destroy */
+UploadJournal *upload_journal_create (Application *app)
+{
+    UploadJournal *journal;
+    ConfData *conf = application_get_conf (app);
+
+    journal = g_new0 (UploadJournal, 1);
+    journal->app = app;
+    journal->journal_dir = g_strdup_printf ("%s/journal", conf_get_string (conf, "filesystem.cache_dir"));
+
+    if (conf_node_exists (conf, "filesystem.upload_journal_enabled"))
+        journal->enabled = conf_get_boolean (conf, "filesystem.upload_journal_enabled");
+    else
+        journal->enabled = FALSE;
+
+    if (journal->enabled && g_mkdir_with_parents (journal->journal_dir, 0700) != 0) {
+        LOG_err (JOURNAL_LOG, "Failed to create directory: %s", journal->journal_dir);
+        upload_journal_destroy (journal);
+        return NULL;
+    }
+
+    return journal;
+}
+
+void upload_journal_destroy (UploadJournal *journal)
+{
+    g_free (journal->journal_dir);
+    g_free (journal);
+}
+
+static void journal_part_destroy (JournalPart *part)
+{
+    g_free (part->md5str);
+    g_free (part->etag);
+    g_free (part);
+}
+
+static gchar *upload_journal_file_name (UploadJournal *journal, const gchar *name, const gchar *ext)
+{
+    return g_strdup_printf ("%s/%s%s", journal->journal_dir, name, ext);
+}
+
+static void upload_journal_remove_files (UploadJournal *journal, const gchar *name)
+{
+    gchar *path;
+
+    path = upload_journal_file_name (journal, name, JOURNAL_DATA_EXT);
+    unlink (path);
+    g_free (path);
+
+    path = upload_journal_file_name (journal, name, JOURNAL_EXT);
+    unlink (path);
+    g_free (path);
+}
+/*}}}*/
+
+/*{{{ UploadJournalEntry */
+
+static gboolean upload_journal_entry_append (UploadJournalEntry *jentry, const gchar *fmt, ...)
+{
+    va_list args;
+    gchar *str;
+    ssize_t res;
+
+    va_start (args, fmt);
+    str = g_strdup_vprintf (fmt, args);
+    va_end (args);
+
+    res = write (jentry->fd, str, strlen (str));
+    if (res != (ssize_t) strlen (str)) {
+        LOG_err (JOURNAL_LOG, "Failed to write journal record: %s", strerror (errno));
+        g_free (str);
+        return FALSE;
+    }
+
+    g_free (str);
+    return TRUE;
+}
+
+UploadJournalEntry *upload_journal_entry_create (UploadJournal *journal, const gchar *fname, const gchar *uploadid,
+    fuse_ino_t ino, const gchar *base_etag)
+{
+    UploadJournalEntry *jentry;
+    gchar *path;
+
+    if (!journal || !journal->enabled)
+        return NULL;
+
+    jentry = g_new0 (UploadJournalEntry, 1);
+    jentry->journal = journal;
+    jentry->name = get_random_string (20, TRUE);
+    jentry->data_fd = -1;
+
+    path = upload_journal_file_name (journal, jentry->name, JOURNAL_EXT);
+    jentry->fd = open (path, O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+    g_free (path);
+    if (jentry->fd < 0) {
+        LOG_err (JOURNAL_LOG, "Failed to create journal file: %s", strerror (errno));
+        g_free (jentry->name);
+        g_free (jentry);
+        return NULL;
+    }
+    // other instances sharing the same cache directory must not touch active uploads
+    if (flock (jentry->fd, LOCK_EX | LOCK_NB) != 0) {
+        LOG_err (JOURNAL_LOG, "Failed to lock journal file: %s", strerror (errno));
+        upload_journal_entry_remove (jentry);
+        return NULL;
+    }
+
+    // written data is kept by CacheMng, the link keeps it after restart
+    path = upload_journal_file_name (journal, jentry->name, JOURNAL_DATA_EXT);
+    if (!cache_mng_link_file (application_get_cache_mng (journal->app), ino, path)) {
+        g_free (path);
+        upload_journal_entry_remove (jentry);
+        return NULL;
+    }
+    jentry->data_fd = open (path, O_RDONLY);
+    g_free (path);
+    if (jentry->data_fd < 0) {
+        LOG_err (JOURNAL_LOG, "Failed to open journal data file: %s", strerror (errno));
+        upload_journal_entry_remove (jentry);
+        return NULL;
+    }
+
+    if (!upload_journal_entry_append (jentry, "bucket %s\npath %s\nuploadid %s\nstarted %"G_GUINT64_FORMAT"\n",
+        conf_get_string (application_get_conf (journal->app), "s3.bucket_name"), fname, uploadid, (guint64) time (NULL)) ||
+        (base_etag && !upload_journal_entry_append (jentry, "base %s\n", base_etag))) {
+        upload_journal_entry_remove (jentry);
+        return NULL;
+    }
+
+    LOG_debug (JOURNAL_LOG, "Journal %s created for %s", jentry->name, fname);
+
+    return jentry;
+}
+
+void upload_journal_entry_add_part (UploadJournalEntry *jentry, guint part_number, off_t off, size_t size, const gchar *md5str)
+{
+    upload_journal_entry_append (jentry, "part %u %"OFF_FMT" %zu %s\n", part_number, off, size, md5str);
+}
+
+void upload_journal_entry_part_done (UploadJournalEntry *jentry, guint part_number, const gchar *etag)
+{
+    upload_journal_entry_append (jentry, "done %u %s\n", part_number, etag ? etag : "-");
+}
+
+gboolean upload_journal_entry_set_size (UploadJournalEntry *jentry, guint64 size)
+{
+    struct stat st;
+
+    // cache file was removed and created again while the file was written, the link misses a part of data
+    if (fstat (jentry->data_fd, &st) != 0 || st.st_nlink < 2 || (guint64) st.st_size < size) {
+        LOG_err (JOURNAL_LOG, "Journal data of %s is incomplete !", jentry->name);
+        return FALSE;
+    }
+
+    // make sure data is on disk before the upload is marked as resumable
+    fdatasync (jentry->data_fd);
+    if (!upload_journal_entry_append (jentry, "size %"G_GUINT64_FORMAT"\n", size))
+        return FALSE;
+    fdatasync (jentry->fd);
+
+    return TRUE;
+}
+
+static void upload_journal_entry_free (UploadJournalEntry *jentry)
+{
+    if (jentry->data_fd >= 0)
+        close (jentry->data_fd);
+    // closing fd also releases the lock
+    if (jentry->fd >= 0)
+        close (jentry->fd);
+    g_free (jentry->name);
+    g_free (jentry);
+}
+
+void upload_journal_entry_remove (UploadJournalEntry *jentry)
+{
+    LOG_debug (JOURNAL_LOG, "Removing journal %s", jentry->name);
+    upload_journal_remove_files (jentry->journal, jentry->name);
+    upload_journal_entry_free (jentry);
+}
+
+void upload_journal_entry_close (UploadJournalEntry *jentry)
+{
+    LOG_msg (JOURNAL_LOG, "Upload is not finished, keeping journal %s", jentry->name);
+    upload_journal_entry_free (jentry);
+}
+/*}}}*/
+
+/*{{{ JournalRecovery */
+
+static void journal_recovery_destroy (JournalRecovery *rec)
+{
+    GList *l;
+
+    for (l = g_list_first (rec->l_parts); l; l = g_list_next (l))
+        journal_part_destroy ((JournalPart *) l->data);
+    g_list_free (rec->l_parts);
+
+    if (rec->data_fd >= 0)
+        close (rec->data_fd);
+    if (rec->fd >= 0)
+        close (rec->fd);
+    g_free (rec->name);
+    g_free (rec->fname);
+    g_free (rec->uploadid);
+    g_free (rec->base_etag);
+    g_free (rec);
+}
+
+// upload is finished (or can't be finished), remove journal files
+static void journal_recovery_done (JournalRecovery *rec)
+{
+    upload_journal_remove_files (rec->journal, rec->name);
+    journal_recovery_destroy (rec);
+}
+
+static JournalPart *journal_recovery_get_part (JournalRecovery *rec, guint part_number)
+{
+    GList *l;
+
+    for (l = g_list_first (rec->l_parts); l; l = g_list_next (l)) {
+        JournalPart *part = (JournalPart *) l->data;
+        if (part->part_number == part_number)
+            return part;
+    }
+
+    return NULL;
+}
+
+static gint journal_part_cmp (const JournalPart *a, const JournalPart *b)
+{
+    return (gint)a->part_number - (gint)b->part_number;
+}
+
+// parse journal file, returns FALSE if journal belongs to another bucket or it's broken
+static gboolean journal_recovery_parse (JournalRecovery *rec, const gchar *contents)
+{
+    gchar **lines;
+    gchar **line;
+    gboolean res = TRUE;
+
+    lines = g_strsplit (contents, "\n", -1);
+    for (line = lines; *line; line++) {
+        gchar *l = *line;
+
+        if (!strncmp (l, "bucket ", strlen ("bucket "))) {
+            if (strcmp (l + strlen ("bucket "), conf_get_string (application_get_conf (rec->journal->app), "s3.bucket_name")))
+                res = FALSE;
+        } else if (!strncmp (l, "path ", strlen ("path "))) {
+            g_free (rec->fname);
+            rec->fname = g_strdup (l + strlen ("path "));
+        } else if (!strncmp (l, "uploadid ", strlen ("uploadid "))) {
+            g_free (rec->uploadid);
+            rec->uploadid = g_strdup (l + strlen ("uploadid "));
+        } else if (!strncmp (l, "base ", strlen ("base "))) {
+            g_free (rec->base_etag);
+            rec->base_etag = g_strdup (l + strlen ("base "));
+        } else if (!strncmp (l, "started ", strlen ("started "))) {
+            rec->started = (time_t) g_ascii_strtoull (l + strlen ("started "), NULL, 10);
+        } else if (!strncmp (l, "part ", strlen ("part "))) {
+            guint part_number;
+            guint64 off, size;
+            gchar md5str[64];
+            JournalPart *part;
+
+            if (sscanf (l, "part %u %"G_GUINT64_FORMAT" %"G_GUINT64_FORMAT" %63s", &part_number, &off, &size, md5str) != 4)
+                continue;
+
+            part = journal_recovery_get_part (rec, part_number);
+            if (!part) {
+                part = g_new0 (JournalPart, 1);
+                part->part_number = part_number;
+                rec->l_parts = g_list_insert_sorted (rec->l_parts, part, (GCompareFunc) journal_part_cmp);
+            }
+            part->off = off;
+            part->size = size;
+            g_free (part->md5str);
+            part->md5str = g_strdup (md5str);
+            // part is sent again, the previous ETag is obsolete
+            g_free (part->etag);
+            part->etag = NULL;
+        } else if (!strncmp (l, "done ", strlen ("done "))) {
+            guint part_number;
+            gchar etag[128];
+            JournalPart *part;
+
+            if (sscanf (l, "done %u %127s", &part_number, etag) != 2 || !strcmp (etag, "-"))
+                continue;
+
+            part = journal_recovery_get_part (rec, part_number);
+            if (part) {
+                g_free (part->etag);
+                part->etag = str_remove_quotes (g_strdup (etag));
+            }
+        } else if (!strncmp (l, "size ", strlen ("size "))) {
+            rec->size = g_ascii_strtoull (l + strlen ("size "), NULL, 10);
+            rec->released = TRUE;
+        }
+        // "done" records only provide ETags, ListParts is the source of truth
+    }
+    g_strfreev (lines);
+
+    if (!rec->fname || !rec->uploadid)
+        res = FALSE;
+
+    return res;
+}
+
+/*{{{ abort */
+static void journal_recovery_on_abort_cb (HttpConnection *con, gpointer ctx, gboolean success,
+    G_GNUC_UNUSED const gchar *buf, G_GNUC_UNUSED size_t buf_len,
+    G_GNUC_UNUSED struct evkeyvalq *headers)
+{
+    JournalRecovery *rec = (JournalRecovery *) ctx;
+
+    http_connection_release (con);
+
+    if (!success)
+        LOG_err (JOURNAL_LOG, "Failed to abort multipart upload of %s !", rec->fname);
+    else
+        LOG_msg (JOURNAL_LOG, "Aborted unfinished multipart upload of %s", rec->fname);
+
+    journal_recovery_done (rec);
+}
+
+static void journal_recovery_on_abort_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    JournalRecovery *rec = (JournalRecovery *) ctx;
+    gchar *path;
+    gboolean res;
+
+    http_connection_acquire (con);
+
+    path = g_strdup_printf ("%s?uploadId=%s", rec->fname, rec->uploadid);
+    res = http_connection_make_request (con,
+        path, "DELETE", NULL, TRUE, NULL,
+        journal_recovery_on_abort_cb,
+        rec
+    );
+    g_free (path);
+
+    if (!res) {
+        LOG_err (JOURNAL_LOG, CON_H"Failed to create HTTP request !", (void *)con);
+        http_connection_release (con);
+        journal_recovery_destroy (rec);
+        return;
+    }
+}
+
+// upload can't be resumed, abort it to free server space
+static void journal_recovery_abort (JournalRecovery *rec)
+{
+    if (!rec->fname || !rec->uploadid) {
+        journal_recovery_done (rec);
+        return;
+    }
+
+    if (!client_pool_get_client (application_get_write_client_pool (rec->journal->app),
+        journal_recovery_on_abort_con_cb, rec)) {
+        LOG_err (JOURNAL_LOG, "Failed to get HTTP client !");
+        journal_recovery_destroy (rec);
+    }
+}
+/*}}}*/
+
+/*{{{ complete */
+static void journal_recovery_on_complete_cb (HttpConnection *con, gpointer ctx, gboolean success,
+    G_GNUC_UNUSED const gchar *buf, G_GNUC_UNUSED size_t buf_len,
+    G_GNUC_UNUSED struct evkeyvalq *headers)
+{
+    JournalRecovery *rec = (JournalRecovery *) ctx;
+
+    http_connection_release (con);
+
+    if (!success) {
+        LOG_err (JOURNAL_LOG, "Failed to complete resumed upload of %s, will retry on the next start !", rec->fname);
+        journal_recovery_destroy (rec);
+        return;
+    }
+
+    LOG_msg (JOURNAL_LOG, "Resumed upload of %s is completed !", rec->fname);
+    journal_recovery_done (rec);
+}
+
+static void journal_recovery_on_complete_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    JournalRecovery *rec = (JournalRecovery *) ctx;
+    struct evbuffer *xml_buf;
+    gchar *path;
+    gboolean res;
+    GList *l;
+
+    xml_buf = evbuffer_new ();
+    evbuffer_add_printf (xml_buf, "%s", "<CompleteMultipartUpload>");
+    for (l = g_list_first (rec->l_parts); l; l = g_list_next (l)) {
+        JournalPart *part = (JournalPart *) l->data;
+        evbuffer_add_printf (xml_buf,
+            "<Part><PartNumber>%u</PartNumber><ETag>\"%s\"</ETag></Part>",
+            part->part_number, part->etag ? part->etag : part->md5str);
+    }
+    evbuffer_add_printf (xml_buf, "%s", "</CompleteMultipartUpload>");
+
+    http_connection_acquire (con);
+
+    path = g_strdup_printf ("%s?uploadId=%s", rec->fname, rec->uploadid);
+    res = http_connection_make_request (con,
+        path, "POST", xml_buf, TRUE, NULL,
+        journal_recovery_on_complete_cb,
+        rec
+    );
+    g_free (path);
+    evbuffer_free (xml_buf);
+
+    if (!res) {
+        LOG_err (JOURNAL_LOG, CON_H"Failed to create HTTP request !", (void *)con);
+        http_connection_release (con);
+        journal_recovery_destroy (rec);
+        return;
+    }
+}
+/*}}}*/
+
+/*{{{ check object */
+// object was changed on the server since the upload started, "headers" is NULL if it doesn't exist
+static gboolean journal_recovery_object_changed (JournalRecovery *rec, struct evkeyvalq *headers)
+{
+    const gchar *header;
+
+    if (!headers)
+        return rec->base_etag != NULL;
+
+    if (rec->base_etag) {
+        gchar *etag;
+        gboolean changed;
+
+        header = http_find_header (headers, "ETag");
+        if (!header)
+            return TRUE;
+
+        etag = str_remove_quotes (g_strdup (header));
+        changed = strcmp (etag, rec->base_etag) != 0;
+        g_free (etag);
+
+        return changed;
+    }
+
+    // object didn't exist when the upload started
+    header = http_find_header (headers, "Last-Modified");
+    if (header) {
+        struct tm tmp = {0};
+
+        // Sun, 1 Jan 2006 12:00:00 GMT
+        if (strptime (header, "%a, %d %b %Y %H:%M:%S", &tmp))
+            return timegm (&tmp) >= rec->started;
+    }
+
+    return TRUE;
+}
+
+static void journal_recovery_on_head_cb (HttpConnection *con, gpointer ctx, gboolean success,
+    G_GNUC_UNUSED const gchar *buf, G_GNUC_UNUSED size_t buf_len,
+    struct evkeyvalq *headers)
+{
+    JournalRecovery *rec = (JournalRecovery *) ctx;
+
+    http_connection_release (con);
+
+    if (!success && con->cur_code != 404) {
+        LOG_err (JOURNAL_LOG, "Failed to get attributes of %s, will retry on the next start !", rec->fname);
+        journal_recovery_destroy (rec);
+        return;
+    }
+
+    // never replace a newer version of the object with the old data
+    if (journal_recovery_object_changed (rec, success ? headers : NULL)) {
+        LOG_msg (JOURNAL_LOG, "%s was changed since the upload started, aborting it", rec->fname);
+        journal_recovery_abort (rec);
+        return;
+    }
+
+    if (!client_pool_get_client (application_get_write_client_pool (rec->journal->app),
+        journal_recovery_on_complete_con_cb, rec)) {
+        LOG_err (JOURNAL_LOG, "Failed to get HTTP client !");
+        journal_recovery_destroy (rec);
+    }
+}
+
+static void journal_recovery_on_head_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    JournalRecovery *rec = (JournalRecovery *) ctx;
+    gboolean res;
+
+    http_connection_acquire (con);
+
+    res = http_connection_make_request (con,
+        rec->fname, "HEAD", NULL, FALSE, NULL,
+        journal_recovery_on_head_cb,
+        rec
+    );
+
+    if (!res) {
+        LOG_err (JOURNAL_LOG, CON_H"Failed to create HTTP request !", (void *)con);
+        http_connection_release (con);
+        journal_recovery_destroy (rec);
+        return;
+    }
+}
+/*}}}*/
+
+/*{{{ upload missing parts */
+static void journal_recovery_send_next_part (JournalRecovery *rec);
+
+static void journal_recovery_on_part_sent_cb (HttpConnection *con, gpointer ctx, gboolean success,
+    G_GNUC_UNUSED const gchar *buf, G_GNUC_UNUSED size_t buf_len,
+    struct evkeyvalq *headers)
+{
+    JournalRecovery *rec = (JournalRecovery *) ctx;
+    JournalPart *part = (JournalPart *) rec->l_current->data;
+    const gchar *etag;
+
+    http_connection_release (con);
+
+    if (!success) {
+        LOG_err (JOURNAL_LOG, "Failed to upload part %u of %s, will retry on the next start !", part->part_number, rec->fname);
+        journal_recovery_destroy (rec);
+        return;
+    }
+
+    etag = http_find_header (headers, "ETag");
+    if (etag) {
+        g_free (part->etag);
+        part->etag = str_remove_quotes (g_strdup (etag));
+    }
+
+    part->done = TRUE;
+    rec->l_current = g_list_next (rec->l_current);
+    journal_recovery_send_next_part (rec);
+}
+
+static void journal_recovery_on_part_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    JournalRecovery *rec = (JournalRecovery *) ctx;
+    JournalPart *part = (JournalPart *) rec->l_current->data;
+    struct evbuffer *buf;
+    gchar *data;
+    gchar *md5str = NULL;
+    gchar *md5b = NULL;
+    gchar *path;
+    ssize_t res;
+    gboolean sent;
+
+    data = g_malloc (part->size);
+    res = pread (rec->data_fd, data, part->size, part->off);
+    if (res != (ssize_t) part->size) {
+        LOG_err (JOURNAL_LOG, "Failed to read journal data of %s !", rec->fname);
+        g_free (data);
+        journal_recovery_abort (rec);
+        return;
+    }
+
+    get_md5_sum (data, part->size, &md5str, &md5b);
+    // data file is corrupted, there is no way to finish this upload
+    if (strcmp (md5str, part->md5str)) {
+        LOG_err (JOURNAL_LOG, "Journal data of %s doesn't match part %u MD5 !", rec->fname, part->part_number);
+        g_free (md5str);
+        g_free (md5b);
+        g_free (data);
+        journal_recovery_abort (rec);
+        return;
+    }
+
+    buf = evbuffer_new ();
+    evbuffer_add (buf, data, part->size);
+    g_free (data);
+
+    LOG_debug (JOURNAL_LOG, CON_H"Resuming upload of %s, sending part %u", (void *)con, rec->fname, part->part_number);
+
+    http_connection_acquire (con);
+    http_connection_add_output_header (con, "Content-MD5", md5b);
+
+    path = g_strdup_printf ("%s?partNumber=%u&uploadId=%s", rec->fname, part->part_number, rec->uploadid);
+    sent = http_connection_make_request (con,
+        path, "PUT", buf, TRUE, NULL,
+        journal_recovery_on_part_sent_cb,
+        rec
+    );
+    g_free (path);
+    evbuffer_free (buf);
+    g_free (md5str);
+    g_free (md5b);
+
+    if (!sent) {
+        LOG_err (JOURNAL_LOG, CON_H"Failed to create HTTP request !", (void *)con);
+        http_connection_release (con);
+        journal_recovery_destroy (rec);
+        return;
+    }
+}
+
+static void journal_recovery_send_next_part (JournalRecovery *rec)
+{
+    ClientPool_on_client_ready next_cb;
+    guint64 size = 0;
+
+    // skip parts which are already on the server
+    while (rec->l_current && ((JournalPart *) rec->l_current->data)->done)
+        rec->l_current = g_list_next (rec->l_current);
+
+    if (rec->l_current) {
+        next_cb = journal_recovery_on_part_con_cb;
+        size = ((JournalPart *) rec->l_current->data)->size;
+    } else
+        // all parts are uploaded, make sure the object wasn't changed before completing the upload
+        next_cb = journal_recovery_on_head_con_cb;
+
+    if (!client_pool_get_client_sized (application_get_write_client_pool (rec->journal->app), size, next_cb, rec)) {
+        LOG_err (JOURNAL_LOG, "Failed to get HTTP client !");
+        journal_recovery_destroy (rec);
+    }
+}
+/*}}}*/
+
+/*{{{ ListParts */
+static void journal_recovery_list_parts (JournalRecovery *rec);
+
+// mark parts which are stored on the server, returns TRUE if the list is truncated
+static gboolean journal_recovery_parse_parts (JournalRecovery *rec, const gchar *xml, size_t xml_len)
+{
+    xmlDocPtr doc;
+    xmlXPathContextPtr ctx;
+    xmlXPathObjectPtr parts_xp;
+    xmlXPathObjectPtr key;
+    gboolean truncated = FALSE;
+    int i;
+
+    doc = xmlReadMemory (xml, xml_len, "", NULL, 0);
+    if (!doc) {
+        LOG_err (JOURNAL_LOG, "S3 returned incorrect XML !");
+        return FALSE;
+    }
+
+    ctx = xmlXPathNewContext (doc);
+    xmlXPathRegisterNs (ctx, (xmlChar *) "s3", (xmlChar *) "http://s3.amazonaws.com/doc/2006-03-01/");
+
+    parts_xp = xmlXPathEvalExpression ((xmlChar *) "//s3:Part", ctx);
+    if (parts_xp && parts_xp->nodesetval) {
+        for (i = 0; i < parts_xp->nodesetval->nodeNr; i++) {
+            gchar *s_number = NULL;
+            gchar *etag = NULL;
+            JournalPart *part;
+
+            ctx->node = parts_xp->nodesetval->nodeTab[i];
+
+            key = xmlXPathEvalExpression ((xmlChar *) "s3:PartNumber", ctx);
+            if (key && key->nodesetval && key->nodesetval->nodeNr > 0)
+                s_number = (gchar *) xmlNodeListGetString (doc, key->nodesetval->nodeTab[0]->xmlChildrenNode, 1);
+            if (key)
+                xmlXPathFreeObject (key);
+
+            key = xmlXPathEvalExpression ((xmlChar *) "s3:ETag", ctx);
+            if (key && key->nodesetval && key->nodesetval->nodeNr > 0)
+                etag = (gchar *) xmlNodeListGetString (doc, key->nodesetval->nodeTab[0]->xmlChildrenNode, 1);
+            if (key)
+                xmlXPathFreeObject (key);
+
+            if (s_number && etag) {
+                part = journal_recovery_get_part (rec, strtoul (s_number, NULL, 10));
+                // compare with the ETag returned when the part was sent, MD5 if it wasn't recorded
+                if (part && !strcmp (str_remove_quotes (etag), part->etag ? part->etag : part->md5str)) {
+                    part->done = TRUE;
+                    g_free (part->etag);
+                    part->etag = g_strdup (etag);
+                }
+                rec->part_marker = strtoul (s_number, NULL, 10);
+            }
+
+            if (s_number)
+                xmlFree (s_number);
+            if (etag)
+                xmlFree (etag);
+        }
+    }
+    if (parts_xp)
+        xmlXPathFreeObject (parts_xp);
+
+    ctx->node = NULL;
+    key = xmlXPathEvalExpression ((xmlChar *) "//s3:IsTruncated", ctx);
+    if (key && key->nodesetval && key->nodesetval->nodeNr > 0) {
+        gchar *s_truncated = (gchar *) xmlNodeListGetString (doc, key->nodesetval->nodeTab[0]->xmlChildrenNode, 1);
+        if (s_truncated) {
+            truncated = !strcmp (s_truncated, "true");
+            xmlFree (s_truncated);
+        }
+    }
+    if (key)
+        xmlXPathFreeObject (key);
+
+    xmlXPathFreeContext (ctx);
+    xmlFreeDoc (doc);
+
+    return truncated;
+}
+
+static void journal_recovery_on_list_parts_cb (HttpConnection *con, gpointer ctx, gboolean success,
+    const gchar *buf, size_t buf_len,
+    G_GNUC_UNUSED struct evkeyvalq *headers)
+{
+    JournalRecovery *rec = (JournalRecovery *) ctx;
+
+    http_connection_release (con);
+
+    if (!success) {
+        // NoSuchUpload: upload was either completed or aborted
+        if (con->cur_code == 404) {
+            LOG_msg (JOURNAL_LOG, "Multipart upload of %s doesn't exist anymore, removing journal", rec->fname);
+            journal_recovery_done (rec);
+        } else {
+            LOG_err (JOURNAL_LOG, "Failed to list parts of %s, will retry on the next start !", rec->fname);
+            journal_recovery_destroy (rec);
+        }
+        return;
+    }
+
+    if (journal_recovery_parse_parts (rec, buf, buf_len)) {
+        journal_recovery_list_parts (rec);
+        return;
+    }
+
+    rec->l_current = g_list_first (rec->l_parts);
+    journal_recovery_send_next_part (rec);
+}
+
+static void journal_recovery_on_list_parts_con_cb (gpointer client, gpointer ctx)
+{
+    HttpConnection *con = (HttpConnection *) client;
+    JournalRecovery *rec = (JournalRecovery *) ctx;
+    gchar *path;
+    gboolean res;
+
+    http_connection_acquire (con);
+
+    if (rec->part_marker)
+        path = g_strdup_printf ("%s?uploadId=%s&part-number-marker=%u", rec->fname, rec->uploadid, rec->part_marker);
+    else
+        path = g_strdup_printf ("%s?uploadId=%s", rec->fname, rec->uploadid);
+
+    res = http_connection_make_request (con,
+        path, "GET", NULL, FALSE, NULL,
+        journal_recovery_on_list_parts_cb,
+        rec
+    );
+    g_free (path);
+
+    if (!res) {
+        LOG_err (JOURNAL_LOG, CON_H"Failed to create HTTP request !", (void *)con);
+        http_connection_release (con);
+        journal_recovery_destroy (rec);
+        return;
+    }
+}
+
+static void journal_recovery_list_parts (JournalRecovery *rec)
+{
+    if (!client_pool_get_client (application_get_write_client_pool (rec->journal->app),
+        journal_recovery_on_list_parts_con_cb, rec)) {
+        LOG_err (JOURNAL_LOG, "Failed to get HTTP client !");
+        journal_recovery_destroy (rec);
+    }
+}
+/*}}}*/
+
+static void upload_journal_recover_entry (UploadJournal *journal, const gchar *name)
+{
+    JournalRecovery *rec;
+    gchar *path;
+    gchar *contents = NULL;
+    struct stat st;
+    guint64 tail_off = 0;
+    GList *l;
+
+    rec = g_new0 (JournalRecovery, 1);
+    rec->journal = journal;
+    rec->name = g_strdup (name);
+    rec->data_fd = -1;
+
+    path = upload_journal_file_name (journal, name, JOURNAL_EXT);
+    rec->fd = open (path, O_RDONLY);
+    if (rec->fd < 0 || flock (rec->fd, LOCK_EX | LOCK_NB) != 0) {
+        // journal is used by another running instance
+        LOG_debug (JOURNAL_LOG, "Skipping locked journal %s", name);
+        g_free (path);
+        journal_recovery_destroy (rec);
+        return;
+    }
+
+    if (!g_file_get_contents (path, &contents, NULL, NULL)) {
+        LOG_err (JOURNAL_LOG, "Failed to read journal %s", path);
+        g_free (path);
+        journal_recovery_destroy (rec);
+        return;
+    }
+    g_free (path);
+
+    if (!journal_recovery_parse (rec, contents)) {
+        g_free (contents);
+        // upload of another bucket
+        if (rec->fname && rec->uploadid) {
+            journal_recovery_destroy (rec);
+        } else {
+            LOG_err (JOURNAL_LOG, "Journal %s is broken, removing it", name);
+            journal_recovery_done (rec);
+        }
+        return;
+    }
+    g_free (contents);
+
+    // riofs was stopped while the file was being written, the content is incomplete
+    if (!rec->released) {
+        LOG_msg (JOURNAL_LOG, "Upload of %s was interrupted before the file was closed, aborting it", rec->fname);
+        journal_recovery_abort (rec);
+        return;
+    }
+
+    path = upload_journal_file_name (journal, name, JOURNAL_DATA_EXT);
+    rec->data_fd = open (path, O_RDONLY);
+    g_free (path);
+    if (rec->data_fd < 0 || fstat (rec->data_fd, &st) != 0 || (guint64) st.st_size < rec->size) {
+        LOG_err (JOURNAL_LOG, "Journal data of %s is incomplete, aborting upload", rec->fname);
+        journal_recovery_abort (rec);
+        return;
+    }
+
+    // the last part might not be sent at all
+    l = g_list_last (rec->l_parts);
+    if (l)
+        tail_off = ((JournalPart *) l->data)->off + ((JournalPart *) l->data)->size;
+    if (tail_off < rec->size) {
+        JournalPart *part;
+        gchar *data;
+        gchar *md5b = NULL;
+
+        part = g_new0 (JournalPart, 1);
+        part->part_number = l ? ((JournalPart *) l->data)->part_number + 1 : 1;
+        part->off = tail_off;
+        part->size = rec->size - tail_off;
+
+        data = g_malloc (part->size);
+        if (pread (rec->data_fd, data, part->size, part->off) != (ssize_t) part->size) {
+            LOG_err (JOURNAL_LOG, "Failed to read journal data of %s !", rec->fname);
+            g_free (data);
+            journal_part_destroy (part);
+            journal_recovery_abort (rec);
+            return;
+        }
+        get_md5_sum (data, part->size, &part->md5str, &md5b);
+        g_free (md5b);
+        g_free (data);
+
+        rec->l_parts = g_list_append (rec->l_parts, part);
+    }
+
+    LOG_msg (JOURNAL_LOG, "Resuming multipart upload of %s (%u parts)", rec->fname, g_list_length (rec->l_parts));
+    journal_recovery_list_parts (rec);
+}
+
+void upload_journal_recover (UploadJournal *journal)
+{
+    GDir *dir;
+    const gchar *fname;
+
+    if (!journal->enabled)
+        return;
+
+    dir = g_dir_open (journal->journal_dir, 0, NULL);
+    if (!dir) {
+        LOG_err (JOURNAL_LOG, "Failed to open directory: %s", journal->journal_dir);
+        return;
+    }
+
+    while ((fname = g_dir_read_name (dir))) {
+        gchar *name;
+
+        if (!g_str_has_suffix (fname, JOURNAL_EXT))
+            continue;
+
+        name = g_strndup (fname, strlen (fname) - strlen (JOURNAL_EXT));
+        upload_journal_recover_entry (journal, name);
+        g_free (name);
+    }
+
+    g_dir_close (dir);
+}
+/*}}}*/
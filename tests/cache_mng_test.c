@@ -154,6 +154,34 @@ static void cache_mng_test_zero_size (CacheMng **cmng, gconstpointer test_data)
     g_assert (test_ctx.buf == NULL);
 }
 
+static void cache_mng_test_hold (CacheMng **cmng, gconstpointer test_data)
+{
+    struct test_ctx test_ctx = {FALSE, NULL, 0};
+    int i;
+    unsigned char buf[256];
+
+    for (i = 0; i < (int) sizeof (buf); i++)
+        buf[i] = i % 256;
+
+    cache_mng_hold_file (*cmng, 1);
+    g_assert (cache_mng_get_file_length (*cmng, 1) == 0);
+
+    cache_mng_store_file_buf (*cmng, 1, 100, 0, buf, store_cb, &test_ctx);
+    cache_mng_store_file_buf (*cmng, 1, 156, 100, buf + 100, store_cb, &test_ctx);
+    cache_mng_retrieve_file_buf (*cmng, 1, sizeof (buf), 0, retrieve_cb, &test_ctx);
+    app_dispatch (app);
+
+    g_assert (test_ctx.success);
+    g_assert (test_ctx.buflen == sizeof (buf));
+    g_assert (memcmp (test_ctx.buf, buf, test_ctx.buflen) == 0);
+    g_free (test_ctx.buf);
+
+    // entry is removed while being held
+    cache_mng_remove_file (*cmng, 1);
+    cache_mng_release_file (*cmng, 1);
+    g_assert (cache_mng_size (*cmng) == 0);
+}
+
 int main (int argc, char *argv[])
 {
     app = app_create ();
@@ -163,6 +191,7 @@ int main (int argc, char *argv[])
     g_test_add ("/cache_mng/cache_mng_test_remove", CacheMng *, 0, cache_mng_test_setup, cache_mng_test_remove, cache_mng_test_destroy);
     g_test_add ("/cache_mng/cache_mng_test_lru", CacheMng *, 0, cache_mng_test_setup, cache_mng_test_lru, cache_mng_test_destroy);
     g_test_add ("/cache_mng/cache_mng_test_zero_size", CacheMng *, 0, cache_mng_test_setup, cache_mng_test_zero_size, cache_mng_test_destroy);
+    g_test_add ("/cache_mng/cache_mng_test_hold", CacheMng *, 0, cache_mng_test_setup, cache_mng_test_hold, cache_mng_test_destroy);
 
     return g_test_run ();
 }
@@ -118,6 +118,152 @@ static void on_output_timer (evutil_socket_t fd, short event, void *ctx)
     }
 }
 
+/*{{{ request lanes */
+// client which stays busy until test_client_release () is called
+typedef struct {
+    ClientPool_on_released_cb on_released_cb;
+    gpointer ctx;
+    gboolean busy;
+} TestClient;
+
+static TestClient *test_client; // pools are created with a single client
+static GPtrArray *a_served; // request names, in the order the client got them
+
+static gpointer test_client_create (G_GNUC_UNUSED Application *app)
+{
+    test_client = g_new0 (TestClient, 1);
+    return test_client;
+}
+
+static void test_client_destroy (gpointer client)
+{
+    g_free (client);
+}
+
+static void test_client_set_on_released_cb (gpointer client, ClientPool_on_released_cb client_on_released_cb, gpointer ctx)
+{
+    TestClient *tc = (TestClient *) client;
+
+    tc->on_released_cb = client_on_released_cb;
+    tc->ctx = ctx;
+}
+
+static gboolean test_client_check_rediness (gpointer client)
+{
+    TestClient *tc = (TestClient *) client;
+
+    return !tc->busy;
+}
+
+static void test_client_on_ready (gpointer client, gpointer ctx)
+{
+    TestClient *tc = (TestClient *) client;
+
+    tc->busy = TRUE;
+    g_ptr_array_add (a_served, ctx);
+}
+
+// the client is done with the current request and takes the next awaiting one
+static void test_client_release (void)
+{
+    test_client->busy = FALSE;
+    test_client->on_released_cb (test_client, test_client->ctx);
+}
+
+static ClientPool *test_pool_create (guint max_requests, guint reserve, guint weight)
+{
+    conf_set_uint (app->conf, "pool.max_requests_per_pool", max_requests);
+    conf_set_uint (app->conf, "pool.bulk_request_size", 1000);
+    conf_set_uint (app->conf, "pool.interactive_weight", weight);
+    conf_set_uint (app->conf, "pool.interactive_reserve", reserve);
+
+    a_served = g_ptr_array_new ();
+
+    return client_pool_create (app, 1,
+        test_client_create,
+        test_client_destroy,
+        test_client_set_on_released_cb,
+        test_client_check_rediness,
+        NULL,
+        NULL
+    );
+}
+
+static void test_pool_destroy (ClientPool *pool)
+{
+    client_pool_destroy (pool);
+    g_ptr_array_free (a_served, TRUE);
+}
+
+// bulk requests are queued first, but interactive ones are served "weight" in a row before each bulk one
+static void test_lanes_order (void)
+{
+    ClientPool *pool;
+    const gchar *expected[] = { "busy", "i1", "i2", "b1", "i3", "i4", "b2", "i5", "b3" };
+    guint i;
+
+    pool = test_pool_create (100, 20, 2);
+
+    g_assert (client_pool_get_client_sized (pool, 0, test_client_on_ready, "busy"));
+    g_assert (client_pool_get_client_sized (pool, 1000, test_client_on_ready, "b1"));
+    g_assert (client_pool_get_client_sized (pool, 2000, test_client_on_ready, "b2"));
+    g_assert (client_pool_get_client_sized (pool, 1000, test_client_on_ready, "b3"));
+    g_assert (client_pool_get_client_sized (pool, 999, test_client_on_ready, "i1"));
+    g_assert (client_pool_get_client (pool, test_client_on_ready, "i2"));
+    g_assert (client_pool_get_client (pool, test_client_on_ready, "i3"));
+    g_assert (client_pool_get_client (pool, test_client_on_ready, "i4"));
+    g_assert (client_pool_get_client (pool, test_client_on_ready, "i5"));
+
+    g_assert_cmpuint (client_pool_get_queue_depth (pool, CLIENT_POOL_LANE_BULK), ==, 3);
+    g_assert_cmpuint (client_pool_get_queue_depth (pool, CLIENT_POOL_LANE_INTERACTIVE), ==, 5);
+
+    for (i = 1; i < G_N_ELEMENTS (expected); i++)
+        test_client_release ();
+    // nothing is waiting
+    test_client_release ();
+
+    g_assert_cmpuint (a_served->len, ==, G_N_ELEMENTS (expected));
+    for (i = 0; i < G_N_ELEMENTS (expected); i++)
+        g_assert_cmpstr (g_ptr_array_index (a_served, i), ==, expected[i]);
+
+    test_pool_destroy (pool);
+}
+
+// bulk requests can't take the slots reserved for interactive ones
+static void test_lanes_reserve (void)
+{
+    ClientPool *pool;
+    guint i;
+
+    pool = test_pool_create (10, 3, 4);
+
+    g_assert (client_pool_get_client (pool, test_client_on_ready, "busy"));
+    for (i = 0; i < 7; i++)
+        g_assert (client_pool_get_client_sized (pool, 1000, test_client_on_ready, "bulk"));
+    g_assert (!client_pool_get_client_sized (pool, 1000, test_client_on_ready, "bulk"));
+
+    for (i = 0; i < 3; i++)
+        g_assert (client_pool_get_client (pool, test_client_on_ready, "interactive"));
+    g_assert (!client_pool_get_client (pool, test_client_on_ready, "interactive"));
+
+    // the interactive request goes first
+    test_client_release ();
+    g_assert_cmpstr (g_ptr_array_index (a_served, 1), ==, "interactive");
+
+    test_pool_destroy (pool);
+
+    // the reserve doesn't exceed a half of the queue
+    pool = test_pool_create (10, 100, 4);
+
+    g_assert (client_pool_get_client (pool, test_client_on_ready, "busy"));
+    for (i = 0; i < 5; i++)
+        g_assert (client_pool_get_client_sized (pool, 1000, test_client_on_ready, "bulk"));
+    g_assert (!client_pool_get_client_sized (pool, 1000, test_client_on_ready, "bulk"));
+
+    test_pool_destroy (pool);
+}
+/*}}}*/
+
 #define BUFFER_SIZE 1024 * 10
 
 static void on_srv_request (struct evhttp_request *req, void *ctx)
@@ -186,23 +332,29 @@ int main (int argc, char *argv[])
     GList *l_files = NULL;
     CBData *cb;
     gchar *in_dir;
+    gint res;
 
     log_level = LOG_debug;
 
     event_set_mem_functions (g_malloc, g_realloc, g_free);
 
+    g_test_init (&argc, &argv, NULL);
+    app = app_create ();
+
+    g_test_add_func ("/client_pool/lanes_order", test_lanes_order);
+    g_test_add_func ("/client_pool/lanes_reserve", test_lanes_reserve);
+
+    // HTTP server test runs until interrupted
+    res = g_test_run ();
+    if (res || !g_test_thorough ())
+        return res;
+
     in_dir = g_dir_make_tmp (NULL, NULL);
     g_assert (in_dir);
 
     l_files = populate_file_list (100, l_files, in_dir);
     g_assert (l_files);
 
-
-
-    app = app_create ();
-
-
-
     app->h_clients_freq = g_hash_table_new (g_direct_hash, g_direct_equal);
     app->l_files = l_files;
     // start server
@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2012-2014 Paul Ionkin <paul.ionkin@gmail.com>
+ * Copyright (C) 2012-2014 Skoobe GmbH. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "dir_buf.h"
+
+// header of "struct fuse_dirent"
+#define DIRENT_HDR_SIZE 24
+
+// walk the buffer, return the number of entries, check that offsets are consistent
+static guint dir_buf_test_walk (const gchar *buf, size_t size, const gchar *expected_name)
+{
+    size_t pos = 0;
+    guint count = 0;
+    gboolean found = FALSE;
+
+    while (pos < size) {
+        guint64 ino, off;
+        guint32 namelen;
+
+        memcpy (&ino, buf + pos, sizeof (ino));
+        memcpy (&off, buf + pos + 8, sizeof (off));
+        memcpy (&namelen, buf + pos + 16, sizeof (namelen));
+
+        g_assert (ino != 0);
+        g_assert (off > pos && off <= size);
+        g_assert (off - pos == ((DIRENT_HDR_SIZE + namelen + 7) & ~7));
+
+        if (expected_name && namelen == strlen (expected_name) &&
+            !memcmp (buf + pos + DIRENT_HDR_SIZE, expected_name, namelen))
+            found = TRUE;
+
+        pos = off;
+        count++;
+    }
+    g_assert (pos == size);
+    if (expected_name)
+        g_assert (found);
+
+    return count;
+}
+
+static void dir_buf_test_setup (DirBuf **dbuf, gconstpointer test_data)
+{
+    *dbuf = dir_buf_create (1, dir_buf_entry_size ("file1") + dir_buf_entry_size ("file2"));
+}
+
+static void dir_buf_test_destroy (DirBuf **dbuf, gconstpointer test_data)
+{
+    dir_buf_destroy (*dbuf);
+}
+
+static void dir_buf_test_add (DirBuf **dbuf, gconstpointer test_data)
+{
+    const gchar *buf;
+    size_t size;
+    gchar name[32];
+    int i;
+
+    dir_buf_add (*dbuf, "file1", 2, S_IFREG);
+    dir_buf_add (*dbuf, "file2", 3, S_IFREG);
+    buf = dir_buf_get_data (*dbuf, &size);
+    g_assert (dir_buf_test_walk (buf, size, "file2") == 4);
+
+    // buffer grows
+    for (i = 0; i < 1000; i++) {
+        snprintf (name, sizeof (name), "dir_%d", i);
+        dir_buf_add (*dbuf, name, 10 + i, S_IFDIR);
+    }
+    buf = dir_buf_get_data (*dbuf, &size);
+    g_assert (dir_buf_test_walk (buf, size, "dir_999") == 1004);
+    g_assert (dir_buf_get_count (*dbuf) == 1002);
+}
+
+static void dir_buf_test_remove (DirBuf **dbuf, gconstpointer test_data)
+{
+    const gchar *buf;
+    size_t size;
+
+    dir_buf_add (*dbuf, "file1", 2, S_IFREG);
+    dir_buf_add (*dbuf, "file2", 3, S_IFREG);
+    dir_buf_add (*dbuf, "file3", 4, S_IFREG);
+
+    g_assert (dir_buf_remove (*dbuf, 3) == TRUE);
+    g_assert (dir_buf_remove (*dbuf, 3) == FALSE);
+    buf = dir_buf_get_data (*dbuf, &size);
+    g_assert (dir_buf_test_walk (buf, size, "file3") == 4);
+
+    // re-added after compaction
+    dir_buf_add (*dbuf, "file2", 3, S_IFREG);
+    dir_buf_remove (*dbuf, 2);
+    buf = dir_buf_get_data (*dbuf, &size);
+    g_assert (dir_buf_test_walk (buf, size, "file2") == 4);
+    g_assert (dir_buf_get_count (*dbuf) == 2);
+}
+
+static void dir_buf_test_sweep (DirBuf **dbuf, gconstpointer test_data)
+{
+    const gchar *buf;
+    size_t size;
+
+    dir_buf_add (*dbuf, "file1", 2, S_IFREG);
+    dir_buf_add (*dbuf, "file2", 3, S_IFREG);
+    dir_buf_add (*dbuf, "file3", 4, S_IFREG);
+
+    // file1 is unchanged, file2 is renamed, file3 is removed, file4 is new
+    dir_buf_mark_begin (*dbuf);
+    g_assert (dir_buf_mark (*dbuf, "file1", 2, S_IFREG) == TRUE);
+    g_assert (dir_buf_mark (*dbuf, "file2_new", 3, S_IFREG) == FALSE);
+    dir_buf_add (*dbuf, "file2_new", 3, S_IFREG);
+    g_assert (dir_buf_mark (*dbuf, "file4", 5, S_IFREG) == FALSE);
+    dir_buf_add (*dbuf, "file4", 5, S_IFREG);
+    g_assert (dir_buf_sweep (*dbuf) == 1);
+
+    buf = dir_buf_get_data (*dbuf, &size);
+    g_assert (dir_buf_test_walk (buf, size, "file2_new") == 5);
+    g_assert (dir_buf_get_count (*dbuf) == 3);
+
+    // nothing is changed
+    dir_buf_mark_begin (*dbuf);
+    g_assert (dir_buf_mark (*dbuf, "file1", 2, S_IFREG) == TRUE);
+    g_assert (dir_buf_mark (*dbuf, "file2_new", 3, S_IFREG) == TRUE);
+    g_assert (dir_buf_mark (*dbuf, "file4", 5, S_IFREG) == TRUE);
+    g_assert (dir_buf_sweep (*dbuf) == 0);
+}
+
+static void dir_buf_test_snapshot (DirBuf **dbuf, gconstpointer test_data)
+{
+    DirBufSnapshot *snap1, *snap2, *snap3;
+    const gchar *buf;
+    size_t size;
+
+    dir_buf_add (*dbuf, "file1", 2, S_IFREG);
+
+    // the same snapshot is shared until the buffer is changed
+    snap1 = dir_buf_get_snapshot (*dbuf);
+    snap2 = dir_buf_get_snapshot (*dbuf);
+    g_assert (snap1 == snap2);
+
+    dir_buf_add (*dbuf, "file2", 3, S_IFREG);
+    snap3 = dir_buf_get_snapshot (*dbuf);
+    g_assert (snap3 != snap1);
+
+    buf = dir_buf_snapshot_get_data (snap1, &size);
+    g_assert (dir_buf_test_walk (buf, size, "file1") == 3);
+    buf = dir_buf_snapshot_get_data (snap3, &size);
+    g_assert (dir_buf_test_walk (buf, size, "file2") == 4);
+
+    dir_buf_snapshot_unref (snap1);
+    dir_buf_snapshot_unref (snap2);
+    dir_buf_snapshot_unref (snap3);
+}
+
+static gboolean dir_buf_test_foreach_cb (const gchar *name, fuse_ino_t ino, mode_t mode, off_t next_off, gpointer ctx)
+{
+    GString *str = (GString *) ctx;
+
+    g_string_append_printf (str, "%s:%lu:%o:%d;", name, (unsigned long) ino, mode & S_IFMT, next_off > 0);
+
+    // stop after "file2"
+    return strcmp (name, "file2") != 0;
+}
+
+static void dir_buf_test_foreach (DirBuf **dbuf, gconstpointer test_data)
+{
+    GString *str;
+    const gchar *buf;
+    size_t size;
+
+    dir_buf_add (*dbuf, "file1", 2, S_IFREG);
+    dir_buf_add (*dbuf, "dir1", 3, S_IFDIR);
+    dir_buf_add (*dbuf, "file2", 4, S_IFREG);
+    dir_buf_add (*dbuf, "file3", 5, S_IFREG);
+    dir_buf_remove (*dbuf, 3);
+    buf = dir_buf_get_data (*dbuf, &size);
+
+    str = g_string_new (NULL);
+    dir_buf_data_foreach (buf, size, 0, dir_buf_test_foreach_cb, str);
+    g_assert_cmpstr (str->str, ==, ".:1:40000:1;..:1:40000:1;file1:2:100000:1;file2:4:100000:1;");
+
+    // start from the offset of "file3"
+    g_string_truncate (str, 0);
+    dir_buf_data_foreach (buf, size, size - dir_buf_entry_size ("file3"), dir_buf_test_foreach_cb, str);
+    g_assert_cmpstr (str->str, ==, "file3:5:100000:1;");
+
+    // offset past the end
+    g_string_truncate (str, 0);
+    dir_buf_data_foreach (buf, size, size, dir_buf_test_foreach_cb, str);
+    g_assert_cmpstr (str->str, ==, "");
+
+    g_string_free (str, TRUE);
+}
+
+int main (int argc, char *argv[])
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add ("/dir_buf/dir_buf_test_add", DirBuf *, 0, dir_buf_test_setup, dir_buf_test_add, dir_buf_test_destroy);
+    g_test_add ("/dir_buf/dir_buf_test_remove", DirBuf *, 0, dir_buf_test_setup, dir_buf_test_remove, dir_buf_test_destroy);
+    g_test_add ("/dir_buf/dir_buf_test_sweep", DirBuf *, 0, dir_buf_test_setup, dir_buf_test_sweep, dir_buf_test_destroy);
+    g_test_add ("/dir_buf/dir_buf_test_snapshot", DirBuf *, 0, dir_buf_test_setup, dir_buf_test_snapshot, dir_buf_test_destroy);
+    g_test_add ("/dir_buf/dir_buf_test_foreach", DirBuf *, 0, dir_buf_test_setup, dir_buf_test_foreach, dir_buf_test_destroy);
+
+    return g_test_run ();
+}
@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2012-2014 Paul Ionkin <paul.ionkin@gmail.com>
+ * Copyright (C) 2012-2014 Skoobe GmbH. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "list_parser.h"
+
+#define S3_NS "http://s3.amazonaws.com/doc/2006-03-01/"
+
+typedef struct {
+    guint files;
+    guint dirs;
+    gint64 total_size;
+    gchar *last_key;
+    gchar *last_etag;
+} ListParserTestData;
+
+static void list_parser_test_on_entry (gpointer ctx, const gchar *key, gboolean is_prefix, gint64 size, G_GNUC_UNUSED time_t last_modified,
+    const gchar *etag)
+{
+    ListParserTestData *data = (ListParserTestData *) ctx;
+
+    if (is_prefix)
+        data->dirs++;
+    else {
+        data->files++;
+        data->total_size += size;
+    }
+
+    g_free (data->last_key);
+    data->last_key = g_strdup (key);
+    g_free (data->last_etag);
+    data->last_etag = g_strdup (etag);
+}
+
+static void list_parser_test_setup (ListParserTestData *data, G_GNUC_UNUSED gconstpointer test_data)
+{
+    data->files = 0;
+    data->dirs = 0;
+    data->total_size = 0;
+    data->last_key = NULL;
+    data->last_etag = NULL;
+}
+
+static void list_parser_test_destroy (ListParserTestData *data, G_GNUC_UNUSED gconstpointer test_data)
+{
+    g_free (data->last_key);
+    g_free (data->last_etag);
+}
+
+static void list_parser_test_list (ListParserTestData *data, G_GNUC_UNUSED gconstpointer test_data)
+{
+    ListParserResult result;
+    const gchar *xml =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<ListBucketResult xmlns=\"" S3_NS "\">"
+        "<Name>bucket</Name><Prefix>dir/</Prefix><Marker></Marker><MaxKeys>1000</MaxKeys>"
+        "<Delimiter>/</Delimiter><IsTruncated>true</IsTruncated><NextMarker>dir/b&amp;c</NextMarker>"
+        "<Contents><Key>dir/a.txt</Key><LastModified>2013-04-11T15:16:00.000Z</LastModified>"
+        "<ETag>&quot;d41d8cd98f00b204e9800998ecf8427e&quot;</ETag><Size>10</Size>"
+        "<Owner><ID>id</ID><DisplayName>name</DisplayName></Owner><StorageClass>STANDARD</StorageClass></Contents>"
+        "<Contents><Key>dir/b&amp;c &lt;&#x41;&#66;&gt;</Key><Size>20</Size></Contents>"
+        "<CommonPrefixes><Prefix>dir/sub/</Prefix></CommonPrefixes>"
+        "</ListBucketResult>";
+
+    g_assert (list_parser_parse (xml, strlen (xml), list_parser_test_on_entry, data, &result));
+    g_assert (data->files == 2);
+    g_assert (data->dirs == 1);
+    g_assert (data->total_size == 30);
+    g_assert_cmpstr (data->last_key, ==, "dir/sub/");
+    g_assert (data->last_etag == NULL);
+    g_assert (result.is_truncated);
+    g_assert_cmpstr (result.next_marker, ==, "dir/b&c");
+    g_assert (result.next_continuation_token == NULL);
+    list_parser_result_clear (&result);
+
+    // ListObjectsV2, entities in key
+    xml = "<ListBucketResult xmlns=\"" S3_NS "\"><Prefix/><IsTruncated>false</IsTruncated>"
+        "<Contents><Key>b&amp;c &lt;&#x41;&#66;&gt;</Key><Size>5</Size></Contents>"
+        "<NextContinuationToken>1ueGcxLPRx1Tr/XYExHnhbYLgveDs2J/wm36Hy4vbOwM=</NextContinuationToken>"
+        "</ListBucketResult>";
+
+    g_assert (list_parser_parse (xml, strlen (xml), list_parser_test_on_entry, data, &result));
+    g_assert (data->files == 3);
+    g_assert_cmpstr (data->last_key, ==, "b&c <AB>");
+    g_assert (data->last_etag == NULL);
+    g_assert (!result.is_truncated);
+    g_assert (result.next_marker == NULL);
+    g_assert_cmpstr (result.next_continuation_token, ==, "1ueGcxLPRx1Tr/XYExHnhbYLgveDs2J/wm36Hy4vbOwM=");
+    list_parser_result_clear (&result);
+
+    // ETag is reset for every entry
+    xml = "<ListBucketResult xmlns=\"" S3_NS "\"><IsTruncated>false</IsTruncated>"
+        "<Contents><Key>c</Key><ETag>&quot;d41d8cd98f00b204e9800998ecf8427e&quot;</ETag><Size>0</Size></Contents>"
+        "</ListBucketResult>";
+
+    g_assert (list_parser_parse (xml, strlen (xml), list_parser_test_on_entry, data, &result));
+    g_assert_cmpstr (data->last_etag, ==, "\"d41d8cd98f00b204e9800998ecf8427e\"");
+    list_parser_result_clear (&result);
+}
+
+static void list_parser_test_invalid (ListParserTestData *data, G_GNUC_UNUSED gconstpointer test_data)
+{
+    ListParserResult result;
+    const gchar *xml;
+
+    xml = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<Error><Code>NoSuchBucket</Code></Error>";
+    g_assert (!list_parser_parse (xml, strlen (xml), list_parser_test_on_entry, data, &result));
+
+    xml = "<ListBucketResult><Contents><Key>dir/a.txt";
+    g_assert (!list_parser_parse (xml, strlen (xml), list_parser_test_on_entry, data, &result));
+
+    xml = "not xml";
+    g_assert (!list_parser_parse (xml, strlen (xml), list_parser_test_on_entry, data, &result));
+    g_assert (data->files == 0);
+}
+
+/*{{{ benchmark */
+
+// previous implementation: DOM + XPath per entry, NextMarker and IsTruncated are looked up separately
+static gboolean list_parser_test_xpath_parse (const gchar *xml, size_t xml_len, ListParserTestData *data)
+{
+    xmlDocPtr doc;
+    xmlXPathContextPtr ctx;
+    xmlXPathObjectPtr contents_xp;
+    xmlXPathObjectPtr key;
+    int i;
+
+    doc = xmlReadMemory (xml, xml_len, "", NULL, 0);
+    if (!doc)
+        return FALSE;
+    ctx = xmlXPathNewContext (doc);
+    xmlXPathRegisterNs (ctx, (xmlChar *) "s3", (xmlChar *) S3_NS);
+
+    contents_xp = xmlXPathEvalExpression ((xmlChar *) "//s3:Contents", ctx);
+    for (i = 0; contents_xp->nodesetval && i < contents_xp->nodesetval->nodeNr; i++) {
+        gchar *name, *s_size, *s_last_modified;
+        struct tm tmp = {0};
+        gint64 size;
+
+        ctx->node = contents_xp->nodesetval->nodeTab[i];
+
+        key = xmlXPathEvalExpression ((xmlChar *) "s3:Key", ctx);
+        name = (gchar *) xmlNodeListGetString (doc, key->nodesetval->nodeTab[0]->xmlChildrenNode, 1);
+        xmlXPathFreeObject (key);
+
+        key = xmlXPathEvalExpression ((xmlChar *) "s3:Size", ctx);
+        s_size = (gchar *) xmlNodeListGetString (doc, key->nodesetval->nodeTab[0]->xmlChildrenNode, 1);
+        size = strtoll (s_size, NULL, 10);
+        xmlFree (s_size);
+        xmlXPathFreeObject (key);
+
+        key = xmlXPathEvalExpression ((xmlChar *) "s3:LastModified", ctx);
+        s_last_modified = (gchar *) xmlNodeListGetString (doc, key->nodesetval->nodeTab[0]->xmlChildrenNode, 1);
+        strptime (s_last_modified, "%Y-%m-%dT%H:%M:%S", &tmp);
+        xmlFree (s_last_modified);
+        xmlXPathFreeObject (key);
+
+        list_parser_test_on_entry (data, name, FALSE, size, mktime (&tmp), NULL);
+        xmlFree (name);
+    }
+    xmlXPathFreeObject (contents_xp);
+    xmlXPathFreeContext (ctx);
+    xmlFreeDoc (doc);
+
+    // get_next_marker ()
+    doc = xmlReadMemory (xml, xml_len, "", NULL, 0);
+    ctx = xmlXPathNewContext (doc);
+    xmlXPathRegisterNs (ctx, (xmlChar *) "s3", (xmlChar *) S3_NS);
+    key = xmlXPathEvalExpression ((xmlChar *) "//s3:NextMarker", ctx);
+    xmlXPathFreeObject (key);
+    xmlXPathFreeContext (ctx);
+    xmlFreeDoc (doc);
+
+    return g_strstr_len (xml, xml_len, "<IsTruncated>true</IsTruncated>") != NULL;
+}
+
+static void list_parser_test_benchmark (ListParserTestData *data, G_GNUC_UNUSED gconstpointer test_data)
+{
+    GString *xml;
+    ListParserResult result;
+    gdouble xpath_time, parser_time;
+    guint i;
+    const guint pages = 50;
+
+    if (!g_test_perf ())
+        return;
+
+    // one page of 1000 keys
+    xml = g_string_new ("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<ListBucketResult xmlns=\"" S3_NS "\">"
+        "<Name>bucket</Name><Prefix>dir/</Prefix><IsTruncated>true</IsTruncated><NextMarker>dir/file_999</NextMarker>");
+    for (i = 0; i < 1000; i++)
+        g_string_append_printf (xml, "<Contents><Key>dir/file_%u</Key><LastModified>2013-04-11T15:16:00.000Z</LastModified>"
+            "<ETag>&quot;d41d8cd98f00b204e9800998ecf8427e&quot;</ETag><Size>%u</Size>"
+            "<StorageClass>STANDARD</StorageClass></Contents>", i, i);
+    g_string_append (xml, "</ListBucketResult>");
+
+    g_test_timer_start ();
+    for (i = 0; i < pages; i++)
+        list_parser_test_xpath_parse (xml->str, xml->len, data);
+    xpath_time = g_test_timer_elapsed ();
+    g_assert (data->files == pages * 1000);
+
+    data->files = 0;
+    g_test_timer_start ();
+    for (i = 0; i < pages; i++) {
+        g_assert (list_parser_parse (xml->str, xml->len, list_parser_test_on_entry, data, &result));
+        list_parser_result_clear (&result);
+    }
+    parser_time = g_test_timer_elapsed ();
+    g_assert (data->files == pages * 1000);
+
+    g_test_message ("%u pages of 1000 keys: DOM + XPath: %.3f sec, list_parser: %.3f sec", pages, xpath_time, parser_time);
+    g_test_minimized_result (parser_time / pages, "list_parser: %.6f sec per page", parser_time / pages);
+
+    g_string_free (xml, TRUE);
+}
+/*}}}*/
+
+int main (int argc, char *argv[])
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add ("/list_parser/list_parser_test_list", ListParserTestData, 0, list_parser_test_setup, list_parser_test_list, list_parser_test_destroy);
+    g_test_add ("/list_parser/list_parser_test_invalid", ListParserTestData, 0, list_parser_test_setup, list_parser_test_invalid, list_parser_test_destroy);
+    g_test_add ("/list_parser/list_parser_test_benchmark", ListParserTestData, 0, list_parser_test_setup, list_parser_test_benchmark, list_parser_test_destroy);
+
+    return g_test_run ();
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2012-2014 Paul Ionkin <paul.ionkin@gmail.com>
+ * Copyright (C) 2012-2014 Skoobe GmbH. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "name_pool.h"
+
+static void name_pool_test_setup (NamePool **pool, G_GNUC_UNUSED gconstpointer test_data)
+{
+    *pool = name_pool_create ();
+}
+
+static void name_pool_test_destroy (NamePool **pool, G_GNUC_UNUSED gconstpointer test_data)
+{
+    name_pool_destroy (*pool);
+}
+
+static void name_pool_test_ref (NamePool **pool, G_GNUC_UNUSED gconstpointer test_data)
+{
+    const gchar *name1, *name2, *name3;
+    gchar buf[16];
+    guint count;
+    guint64 bytes;
+
+    name1 = name_pool_ref (*pool, "file.txt");
+    // equal strings share the same copy
+    strcpy (buf, "file.txt");
+    name2 = name_pool_ref (*pool, buf);
+    g_assert (name1 == name2);
+    g_assert (name1 != buf);
+    g_assert_cmpstr (name1, ==, "file.txt");
+
+    name3 = name_pool_ref (*pool, "");
+    g_assert_cmpstr (name3, ==, "");
+
+    name_pool_get_stats (*pool, &count, &bytes);
+    g_assert (count == 2);
+    g_assert (bytes >= strlen ("file.txt") + 2);
+
+    // released with the last reference
+    name_pool_unref (name1);
+    name_pool_get_stats (*pool, &count, &bytes);
+    g_assert (count == 2);
+    g_assert_cmpstr (name2, ==, "file.txt");
+
+    name_pool_unref (name2);
+    name_pool_unref (name3);
+    name_pool_get_stats (*pool, &count, &bytes);
+    g_assert (count == 0);
+    g_assert (bytes == 0);
+
+    // added again
+    name1 = name_pool_ref (*pool, "file.txt");
+    g_assert_cmpstr (name1, ==, "file.txt");
+    name_pool_unref (name1);
+}
+
+int main (int argc, char *argv[])
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add ("/name_pool/name_pool_test_ref", NamePool *, 0, name_pool_test_setup, name_pool_test_ref, name_pool_test_destroy);
+
+    return g_test_run ();
+}
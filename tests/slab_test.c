@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2012-2014 Paul Ionkin <paul.ionkin@gmail.com>
+ * Copyright (C) 2012-2014 Skoobe GmbH. All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include "slab.h"
+#include "name_pool.h"
+
+// about the size of DirEntry
+typedef struct {
+    const gchar *basename;
+    gchar *fullpath;
+    guint64 data[14];
+} SlabTestEntry;
+
+// glibc malloc chunk: 8 bytes header, 16 bytes alignment, 32 bytes minimum
+#define SLAB_TEST_MALLOC_SIZE(size) ((MAX ((size) + 8, 32) + 15) & ~(size_t) 15)
+
+static void slab_test_setup (Slab **slab, G_GNUC_UNUSED gconstpointer test_data)
+{
+    *slab = slab_create (sizeof (SlabTestEntry));
+}
+
+static void slab_test_destroy (Slab **slab, G_GNUC_UNUSED gconstpointer test_data)
+{
+    slab_destroy (*slab);
+}
+
+static void slab_test_alloc (Slab **slab, G_GNUC_UNUSED gconstpointer test_data)
+{
+    SlabTestEntry *en1, *en2, *en3;
+    guint64 objects, bytes;
+
+    en1 = slab_alloc0 (*slab);
+    en2 = slab_alloc0 (*slab);
+    g_assert (en1 != en2);
+    g_assert (en1->basename == NULL && en1->data[13] == 0);
+    en1->data[13] = 1;
+
+    slab_get_stats (*slab, &objects, &bytes);
+    g_assert (objects == 2);
+    g_assert (bytes > 0);
+
+    // freed object is reused and zero-filled
+    slab_free (en1);
+    en3 = slab_alloc0 (*slab);
+    g_assert (en3 == en1);
+    g_assert (en3->data[13] == 0);
+
+    slab_free (en2);
+    slab_free (en3);
+    slab_get_stats (*slab, &objects, &bytes);
+    g_assert (objects == 0);
+}
+
+static void slab_test_blocks (Slab **slab, G_GNUC_UNUSED gconstpointer test_data)
+{
+    GPtrArray *a_entries;
+    guint64 objects, bytes, max_bytes;
+    guint i;
+
+    a_entries = g_ptr_array_new ();
+    for (i = 0; i < 10000; i++) {
+        SlabTestEntry *en = slab_alloc0 (*slab);
+
+        en->data[0] = i;
+        g_ptr_array_add (a_entries, en);
+    }
+    slab_get_stats (*slab, &objects, &max_bytes);
+    g_assert (objects == 10000);
+    g_assert (max_bytes >= 10000 * sizeof (SlabTestEntry));
+
+    for (i = 0; i < a_entries->len; i++) {
+        SlabTestEntry *en = g_ptr_array_index (a_entries, i);
+        g_assert (en->data[0] == i);
+    }
+
+    // free every other object, blocks are kept
+    for (i = 0; i < a_entries->len; i += 2)
+        slab_free (g_ptr_array_index (a_entries, i));
+    slab_get_stats (*slab, &objects, &bytes);
+    g_assert (objects == 5000);
+    g_assert (bytes == max_bytes);
+
+    // empty blocks are released
+    for (i = 1; i < a_entries->len; i += 2)
+        slab_free (g_ptr_array_index (a_entries, i));
+    slab_get_stats (*slab, &objects, &bytes);
+    g_assert (objects == 0);
+    g_assert (bytes < max_bytes);
+
+    g_ptr_array_free (a_entries, TRUE);
+}
+
+/*{{{ benchmark */
+
+// synthetic bucket: directories with the same set of file names, as written by batch jobs
+#define BENCH_DIRS 2000
+#define BENCH_FILES 100
+
+static void slab_test_benchmark (Slab **slab, G_GNUC_UNUSED gconstpointer test_data)
+{
+    GPtrArray *a_entries;
+    NamePool *names;
+    gchar name[64];
+    guint64 malloc_bytes = 0, malloc_count = 0;
+    guint64 path_bytes = 0;
+    guint64 objects, slab_bytes, names_bytes;
+    guint names_count;
+    gdouble malloc_time, slab_time;
+    guint d, f, i;
+    const guint total = BENCH_DIRS * (BENCH_FILES + 1);
+
+    if (!g_test_perf ())
+        return;
+
+    a_entries = g_ptr_array_sized_new (total);
+
+    // previous layout: every entry, its name, full path and hash table key are separate allocations
+    g_test_timer_start ();
+    for (d = 0; d < BENCH_DIRS; d++) {
+        SlabTestEntry *dir_en;
+
+        snprintf (name, sizeof (name), "date=2014-%02u-%02u", d / 28 % 12 + 1, d % 28 + 1);
+        dir_en = g_new0 (SlabTestEntry, 1);
+        dir_en->basename = g_strdup (name);
+        dir_en->fullpath = g_strdup_printf ("logs/%u/%s", d, name);
+        g_ptr_array_add (a_entries, dir_en);
+        g_ptr_array_add (a_entries, g_strdup (name));
+        malloc_bytes += SLAB_TEST_MALLOC_SIZE (sizeof (SlabTestEntry)) + 2 * SLAB_TEST_MALLOC_SIZE (strlen (name) + 1) +
+            SLAB_TEST_MALLOC_SIZE (strlen (dir_en->fullpath) + 1);
+
+        for (f = 0; f < BENCH_FILES; f++) {
+            SlabTestEntry *en;
+
+            snprintf (name, sizeof (name), "part-%05u.gz", f);
+            en = g_new0 (SlabTestEntry, 1);
+            en->basename = g_strdup (name);
+            en->fullpath = g_strdup_printf ("%s/%s", dir_en->fullpath, name);
+            g_ptr_array_add (a_entries, en);
+            g_ptr_array_add (a_entries, g_strdup (name));
+            malloc_bytes += SLAB_TEST_MALLOC_SIZE (sizeof (SlabTestEntry)) + 2 * SLAB_TEST_MALLOC_SIZE (strlen (name) + 1) +
+                SLAB_TEST_MALLOC_SIZE (strlen (en->fullpath) + 1);
+        }
+    }
+    malloc_time = g_test_timer_elapsed ();
+    malloc_count = (guint64) total * 4;
+
+    for (i = 0; i < a_entries->len; i += 2) {
+        SlabTestEntry *en = g_ptr_array_index (a_entries, i);
+        g_free ((gchar *) en->basename);
+        g_free (en->fullpath);
+        g_free (en);
+        g_free (g_ptr_array_index (a_entries, i + 1));
+    }
+    g_ptr_array_set_size (a_entries, 0);
+
+    // slab entries with interned names, only directories keep the full path
+    names = name_pool_create ();
+    g_test_timer_start ();
+    for (d = 0; d < BENCH_DIRS; d++) {
+        SlabTestEntry *dir_en;
+
+        snprintf (name, sizeof (name), "date=2014-%02u-%02u", d / 28 % 12 + 1, d % 28 + 1);
+        dir_en = slab_alloc0 (*slab);
+        dir_en->basename = name_pool_ref (names, name);
+        dir_en->fullpath = g_strdup_printf ("logs/%u/%s", d, name);
+        g_ptr_array_add (a_entries, dir_en);
+        path_bytes += SLAB_TEST_MALLOC_SIZE (strlen (dir_en->fullpath) + 1);
+
+        for (f = 0; f < BENCH_FILES; f++) {
+            SlabTestEntry *en;
+
+            snprintf (name, sizeof (name), "part-%05u.gz", f);
+            en = slab_alloc0 (*slab);
+            en->basename = name_pool_ref (names, name);
+            g_ptr_array_add (a_entries, en);
+        }
+    }
+    slab_time = g_test_timer_elapsed ();
+
+    slab_get_stats (*slab, &objects, &slab_bytes);
+    name_pool_get_stats (names, &names_count, &names_bytes);
+    g_assert (objects == total);
+    g_assert (names_count < total / 10);
+
+    g_test_message ("%u entries: malloc: %"G_GUINT64_FORMAT" bytes (%.1f per entry) in %"G_GUINT64_FORMAT" allocations, %.3f sec",
+        total, malloc_bytes, (gdouble) malloc_bytes / total, malloc_count, malloc_time);
+    g_test_message ("%u entries: slab: %"G_GUINT64_FORMAT" bytes, %u names: %"G_GUINT64_FORMAT" bytes, paths: %"G_GUINT64_FORMAT" bytes (%.1f per entry), %.3f sec",
+        total, slab_bytes, names_count, names_bytes, path_bytes,
+        (gdouble) (slab_bytes + names_bytes + path_bytes) / total, slab_time);
+    g_test_minimized_result ((gdouble) (slab_bytes + names_bytes + path_bytes) / total,
+        "%.1f bytes per entry", (gdouble) (slab_bytes + names_bytes + path_bytes) / total);
+
+    for (i = 0; i < a_entries->len; i++) {
+        SlabTestEntry *en = g_ptr_array_index (a_entries, i);
+        name_pool_unref (en->basename);
+        g_free (en->fullpath);
+        slab_free (en);
+    }
+    name_pool_destroy (names);
+    g_ptr_array_free (a_entries, TRUE);
+}
+/*}}}*/
+
+int main (int argc, char *argv[])
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add ("/slab/slab_test_alloc", Slab *, 0, slab_test_setup, slab_test_alloc, slab_test_destroy);
+    g_test_add ("/slab/slab_test_blocks", Slab *, 0, slab_test_setup, slab_test_blocks, slab_test_destroy);
+    g_test_add ("/slab/slab_test_benchmark", Slab *, 0, slab_test_setup, slab_test_benchmark, slab_test_destroy);
+
+    return g_test_run ();
+}
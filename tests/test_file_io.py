@@ -161,6 +161,8 @@ class App ():
             print >> sys.stderr, ">> (" + str (i) + " out of " + str (total) + ") FILE:", entry
             i = i + 1
             res = self.check_file (entry)
+            if res == True:
+                res = self.patch_file_and_check (entry)
             if res == False:
                 print "Test failed !"
                 failed = True
@@ -398,6 +400,74 @@ class App ():
             print "======"
             return False
 
+    # wait till the "read" RioFS instance returns file with the expected content
+    def wait_for_md5 (self, in_dst_name, out_dst_name, md5):
+        for i in range (0, self.nr_retries):
+            self.check_running ()
+            if self.interrupted:
+                print "Interrupted !"
+                return False
+            time.sleep (2)
+            try:
+                shutil.copy (in_dst_name, out_dst_name)
+            except Exception, e:
+                print "Failed to copy: from ", in_dst_name, " to ", out_dst_name, " Error: ", e
+                continue
+            if self.md5_for_file (out_dst_name) == md5:
+                return True
+            print "File is not updated yet, sleeping ..", in_dst_name
+
+        print "Files (", in_dst_name, ") DOES NOT match: ", md5, " != ", self.md5_for_file (out_dst_name)
+        return False
+
+    # modify file in place on "write" RioFS instance: append data, then overwrite the tail,
+    # unchanged data is copied on the server side (UploadPartCopy), check it on the "read" RioFS instance
+    def patch_file_and_check (self, entry):
+        out_src_name = self.write_dir + self.test_dir + os.path.basename (entry["name"])
+        in_dst_name = self.read_dir + self.test_dir + os.path.basename (entry["name"])
+        out_dst_name = self.dst_dir + os.path.basename (entry["name"]) + "_patched"
+
+        print >> sys.stderr, ">> Appending to SRV:", out_src_name
+
+        data = self.str_gen (random.randint (1, 1024 * 64))
+        try:
+            for name in [entry["name"], out_src_name]:
+                fout = open (name, 'a')
+                fout.write (data)
+                fout.close ()
+        except Exception, e:
+            print "Failed to append to file: ", e
+            return False
+
+        entry["md5"] = self.md5_for_file (entry["name"])
+        if not self.wait_for_md5 (in_dst_name, out_dst_name, entry["md5"]):
+            return False
+
+        # the first byte is kept, so it's not a rewrite of the whole file
+        size = os.path.getsize (entry["name"])
+        off = max (1, size - random.randint (1, 1024 * 64))
+        data = self.str_gen (max (1, size - off))
+
+        print >> sys.stderr, ">> Overwriting tail of SRV:", out_src_name, " offset:", off
+
+        try:
+            for name in [entry["name"], out_src_name]:
+                fout = open (name, 'r+')
+                fout.seek (off)
+                fout.write (data)
+                fout.close ()
+        except Exception, e:
+            print "Failed to modify file: ", e
+            return False
+
+        entry["md5"] = self.md5_for_file (entry["name"])
+        if not self.wait_for_md5 (in_dst_name, out_dst_name, entry["md5"]):
+            return False
+
+        print "Patched files match: ", entry["md5"]
+        print "======"
+        return True
+
     # remove file on "write" RioFS instance and then check it on the "read" RioFS instance
     def remove_remote_file_and_check (self, entry, i, total):
         # create paths